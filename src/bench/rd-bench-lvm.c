@@ -0,0 +1,826 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <libdevmapper.h>
+#include <lvm2app.h>
+#include <lvm2cmd.h>
+
+#include "rd-bench-lvm.h"
+#include "libgsystem.h"
+
+#define FAKE_DM_MAJOR 253
+
+typedef struct {
+  char       *name;
+  GPtrArray  *tags;
+  char       *origin;
+  guint64     size;
+  gint        minor;      /* -1 if inactive */
+} FakeLv;
+
+typedef struct {
+  char       *name;
+  char       *uuid;
+  guint64     seqno;
+  char       *pvname;
+  GPtrArray  *tags;
+  GPtrArray  *lvs;
+} FakeVg;
+
+static GPtrArray *fake_vgs;
+static guint n_active;
+
+/* Everything handed out through a handle or VG is owned by its pool,
+ * as with the real library's memory pools.
+ */
+typedef struct {
+  GPtrArray  *allocations;
+} FakePool;
+
+struct lvm {
+  FakePool    pool;
+  int         errnum;
+};
+
+struct volume_group {
+  FakePool    pool;
+  lvm_t       lvmh;
+  FakeVg     *fvg;
+  gboolean    writable;
+};
+
+struct logical_volume {
+  struct volume_group  *vg;
+  FakeLv               *flv;
+};
+
+struct physical_volume {
+  const char  *name;
+};
+
+struct dm_task {
+  int          type;
+  guint32      major;
+  guint32      minor;
+  gboolean     have_device;
+  char        *names;
+  FakeLv      *flv;
+};
+
+static gpointer
+pool_alloc (FakePool   *pool,
+            gsize       size)
+{
+  gpointer mem = g_malloc0 (size);
+  if (!pool->allocations)
+    pool->allocations = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (pool->allocations, mem);
+  return mem;
+}
+
+static const char *
+pool_strdup (FakePool    *pool,
+             const char  *str)
+{
+  char *ret = pool_alloc (pool, strlen (str) + 1);
+  strcpy (ret, str);
+  return ret;
+}
+
+static void
+pool_clear (FakePool *pool)
+{
+  g_clear_pointer (&pool->allocations, g_ptr_array_unref);
+}
+
+static struct dm_list *
+new_list (FakePool *pool)
+{
+  struct dm_list *head = pool_alloc (pool, sizeof (struct dm_list));
+  head->n = head->p = head;
+  return head;
+}
+
+static void
+list_append (struct dm_list  *head,
+             struct dm_list  *elem)
+{
+  elem->n = head;
+  elem->p = head->p;
+  head->p->n = elem;
+  head->p = elem;
+}
+
+static struct dm_list *
+str_list_new (FakePool    *pool,
+              GPtrArray   *strs)
+{
+  struct dm_list *head = new_list (pool);
+  guint i;
+
+  for (i = 0; i < strs->len; i++)
+    {
+      struct lvm_str_list *item = pool_alloc (pool, sizeof (struct lvm_str_list));
+      item->str = pool_strdup (pool, strs->pdata[i]);
+      list_append (head, &item->list);
+    }
+  return head;
+}
+
+static FakeLv *
+fake_lv_new (const char  *name,
+             guint64      size)
+{
+  FakeLv *flv = g_new0 (FakeLv, 1);
+  flv->name = g_strdup (name);
+  flv->tags = g_ptr_array_new_with_free_func (g_free);
+  flv->size = size;
+  flv->minor = -1;
+  return flv;
+}
+
+static void
+fake_lv_free (FakeLv *flv)
+{
+  g_free (flv->name);
+  g_free (flv->origin);
+  g_ptr_array_unref (flv->tags);
+  g_free (flv);
+}
+
+static void
+fake_vg_free (FakeVg *fvg)
+{
+  g_free (fvg->name);
+  g_free (fvg->uuid);
+  g_free (fvg->pvname);
+  g_ptr_array_unref (fvg->tags);
+  g_ptr_array_unref (fvg->lvs);
+  g_free (fvg);
+}
+
+static gboolean
+fake_lv_has_tag (FakeLv      *flv,
+                 const char  *tag)
+{
+  guint i;
+  for (i = 0; i < flv->tags->len; i++)
+    if (strcmp (flv->tags->pdata[i], tag) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+/**
+ * rd_bench_lvm_populate:
+ * @tag_percent: Share of LVs tagged rollback_include
+ * @active_percent: Share of LVs with a device-mapper device
+ *
+ * Replace the fake system with @n_vgs VGs of @n_lvs_per_vg LVs each.
+ */
+void
+rd_bench_lvm_populate (guint   n_vgs,
+                       guint   n_lvs_per_vg,
+                       guint   tag_percent,
+                       guint   active_percent,
+                       guint32 seed)
+{
+  GRand *rand = g_rand_new_with_seed (seed);
+  guint i, j;
+
+  if (fake_vgs)
+    g_ptr_array_unref (fake_vgs);
+  fake_vgs = g_ptr_array_new_with_free_func ((GDestroyNotify)fake_vg_free);
+  n_active = 0;
+
+  for (i = 0; i < n_vgs; i++)
+    {
+      FakeVg *fvg = g_new0 (FakeVg, 1);
+      fvg->name = g_strdup_printf ("vg%u", i);
+      fvg->uuid = g_strdup_printf ("fake-vg-uuid-%06u", i);
+      fvg->seqno = 1;
+      fvg->pvname = g_strdup_printf ("/dev/fake%u", i);
+      fvg->tags = g_ptr_array_new_with_free_func (g_free);
+      fvg->lvs = g_ptr_array_new_with_free_func ((GDestroyNotify)fake_lv_free);
+
+      for (j = 0; j < n_lvs_per_vg; j++)
+        {
+          gs_free char *name = g_strdup_printf ("lv-%u", j);
+          FakeLv *flv = fake_lv_new (name, (guint64)g_rand_int_range (rand, 1, 1024) << 30);
+
+          if ((guint)g_rand_int_range (rand, 0, 100) < tag_percent)
+            g_ptr_array_add (flv->tags, g_strdup ("rollback_include"));
+          if ((guint)g_rand_int_range (rand, 0, 100) < active_percent)
+            flv->minor = n_active++;
+          g_ptr_array_add (fvg->lvs, flv);
+        }
+      g_ptr_array_add (fake_vgs, fvg);
+    }
+
+  g_rand_free (rand);
+}
+
+guint
+rd_bench_lvm_get_n_active (void)
+{
+  return n_active;
+}
+
+/**
+ * rd_bench_lvm_list_paths:
+ *
+ * Returns: (transfer full): "VG/LV" for every LV that is, or is not,
+ * tagged rollback_include
+ */
+GPtrArray *
+rd_bench_lvm_list_paths (gboolean tagged)
+{
+  GPtrArray *ret = g_ptr_array_new_with_free_func (g_free);
+  guint i, j;
+
+  for (i = 0; i < fake_vgs->len; i++)
+    {
+      FakeVg *fvg = fake_vgs->pdata[i];
+      for (j = 0; j < fvg->lvs->len; j++)
+        {
+          FakeLv *flv = fvg->lvs->pdata[j];
+          if (fake_lv_has_tag (flv, "rollback_include") == tagged)
+            g_ptr_array_add (ret, g_strconcat (fvg->name, "/", flv->name, NULL));
+        }
+    }
+  return ret;
+}
+
+/**
+ * rd_bench_lvm_list_vg_globs:
+ *
+ * Returns: (transfer full): A glob path matching all the LVs of each VG
+ */
+GPtrArray *
+rd_bench_lvm_list_vg_globs (void)
+{
+  GPtrArray *ret = g_ptr_array_new_with_free_func (g_free);
+  guint i;
+
+  for (i = 0; i < fake_vgs->len; i++)
+    {
+      FakeVg *fvg = fake_vgs->pdata[i];
+      g_ptr_array_add (ret, g_strconcat (fvg->name, "/*", NULL));
+    }
+  return ret;
+}
+
+/* lvm2app */
+
+lvm_t
+lvm_init (const char *system_dir)
+{
+  return g_new0 (struct lvm, 1);
+}
+
+void
+lvm_quit (lvm_t lvmh)
+{
+  pool_clear (&lvmh->pool);
+  g_free (lvmh);
+}
+
+int
+lvm_errno (lvm_t lvmh)
+{
+  return lvmh ? lvmh->errnum : EINVAL;
+}
+
+const char *
+lvm_errmsg (lvm_t lvmh)
+{
+  return g_strerror (lvm_errno (lvmh));
+}
+
+int
+lvm_config_override (lvm_t        lvmh,
+                     const char  *config_string)
+{
+  return 0;
+}
+
+int
+lvm_config_reload (lvm_t lvmh)
+{
+  return 0;
+}
+
+struct dm_list *
+lvm_list_vg_names (lvm_t lvmh)
+{
+  struct dm_list *head = new_list (&lvmh->pool);
+  guint i;
+
+  for (i = 0; i < fake_vgs->len; i++)
+    {
+      FakeVg *fvg = fake_vgs->pdata[i];
+      struct lvm_str_list *item = pool_alloc (&lvmh->pool, sizeof (struct lvm_str_list));
+      item->str = pool_strdup (&lvmh->pool, fvg->name);
+      list_append (head, &item->list);
+    }
+  return head;
+}
+
+vg_t
+lvm_vg_open (lvm_t        lvmh,
+             const char  *vgname,
+             const char  *mode,
+             uint32_t     flags)
+{
+  guint i;
+
+  for (i = 0; i < fake_vgs->len; i++)
+    {
+      FakeVg *fvg = fake_vgs->pdata[i];
+      if (strcmp (fvg->name, vgname) == 0)
+        {
+          vg_t vg = g_new0 (struct volume_group, 1);
+          vg->lvmh = lvmh;
+          vg->fvg = fvg;
+          vg->writable = strchr (mode, 'w') != NULL;
+          return vg;
+        }
+    }
+
+  lvmh->errnum = ENOENT;
+  return NULL;
+}
+
+int
+lvm_vg_close (vg_t vg)
+{
+  pool_clear (&vg->pool);
+  g_free (vg);
+  return 0;
+}
+
+int
+lvm_vg_write (vg_t vg)
+{
+  if (!vg->writable)
+    {
+      vg->lvmh->errnum = EPERM;
+      return -1;
+    }
+  vg->fvg->seqno++;
+  return 0;
+}
+
+const char *
+lvm_vg_get_name (const vg_t vg)
+{
+  return vg->fvg->name;
+}
+
+const char *
+lvm_vg_get_uuid (const vg_t vg)
+{
+  return vg->fvg->uuid;
+}
+
+uint64_t
+lvm_vg_get_seqno (const vg_t vg)
+{
+  return vg->fvg->seqno;
+}
+
+struct dm_list *
+lvm_vg_get_tags (const vg_t vg)
+{
+  return str_list_new (&vg->pool, vg->fvg->tags);
+}
+
+static lv_t
+wrap_lv (vg_t     vg,
+         FakeLv  *flv)
+{
+  lv_t lv = pool_alloc (&vg->pool, sizeof (struct logical_volume));
+  lv->vg = vg;
+  lv->flv = flv;
+  return lv;
+}
+
+struct dm_list *
+lvm_vg_list_lvs (vg_t vg)
+{
+  struct dm_list *head;
+  guint i;
+
+  /* As lvm2app does for a VG with no LVs */
+  if (vg->fvg->lvs->len == 0)
+    return NULL;
+
+  head = new_list (&vg->pool);
+
+  for (i = 0; i < vg->fvg->lvs->len; i++)
+    {
+      struct lvm_lv_list *item = pool_alloc (&vg->pool, sizeof (struct lvm_lv_list));
+      item->lv = wrap_lv (vg, vg->fvg->lvs->pdata[i]);
+      list_append (head, &item->list);
+    }
+  return head;
+}
+
+struct dm_list *
+lvm_vg_list_pvs (vg_t vg)
+{
+  struct dm_list *head = new_list (&vg->pool);
+  struct lvm_pv_list *item = pool_alloc (&vg->pool, sizeof (struct lvm_pv_list));
+  pv_t pv = pool_alloc (&vg->pool, sizeof (struct physical_volume));
+
+  pv->name = vg->fvg->pvname;
+  item->pv = pv;
+  list_append (head, &item->list);
+  return head;
+}
+
+static struct lvm_property_value
+string_property (FakePool    *pool,
+                 const char  *value)
+{
+  struct lvm_property_value prop;
+
+  memset (&prop, 0, sizeof (prop));
+  prop.is_valid = 1;
+  prop.is_string = 1;
+  prop.value.string = pool_strdup (pool, value);
+  return prop;
+}
+
+static struct lvm_property_value
+integer_property (uint64_t value)
+{
+  struct lvm_property_value prop;
+
+  memset (&prop, 0, sizeof (prop));
+  prop.is_valid = 1;
+  prop.is_integer = 1;
+  prop.value.integer = value;
+  return prop;
+}
+
+struct lvm_property_value
+lvm_vg_get_property (const vg_t   vg,
+                     const char  *name)
+{
+  struct lvm_property_value prop;
+
+  if (strcmp (name, "vg_name") == 0)
+    return string_property (&vg->pool, vg->fvg->name);
+
+  memset (&prop, 0, sizeof (prop));
+  return prop;
+}
+
+lv_t
+lvm_lv_from_name (vg_t         vg,
+                  const char  *name)
+{
+  guint i;
+
+  for (i = 0; i < vg->fvg->lvs->len; i++)
+    {
+      FakeLv *flv = vg->fvg->lvs->pdata[i];
+      if (strcmp (flv->name, name) == 0)
+        return wrap_lv (vg, flv);
+    }
+
+  vg->lvmh->errnum = ENOENT;
+  return NULL;
+}
+
+const char *
+lvm_lv_get_name (const lv_t lv)
+{
+  return lv->flv->name;
+}
+
+uint64_t
+lvm_lv_get_size (const lv_t lv)
+{
+  return lv->flv->size;
+}
+
+uint64_t
+lvm_lv_is_active (const lv_t lv)
+{
+  return lv->flv->minor >= 0;
+}
+
+struct dm_list *
+lvm_lv_get_tags (const lv_t lv)
+{
+  return str_list_new (&lv->vg->pool, lv->flv->tags);
+}
+
+int
+lvm_lv_add_tag (lv_t         lv,
+                const char  *tag)
+{
+  if (!lv->vg->writable)
+    {
+      lv->vg->lvmh->errnum = EPERM;
+      return -1;
+    }
+  if (!fake_lv_has_tag (lv->flv, tag))
+    g_ptr_array_add (lv->flv->tags, g_strdup (tag));
+  return 0;
+}
+
+int
+lvm_lv_remove_tag (lv_t         lv,
+                   const char  *tag)
+{
+  guint i;
+
+  if (!lv->vg->writable)
+    {
+      lv->vg->lvmh->errnum = EPERM;
+      return -1;
+    }
+  for (i = 0; i < lv->flv->tags->len; i++)
+    {
+      if (strcmp (lv->flv->tags->pdata[i], tag) == 0)
+        {
+          g_ptr_array_remove_index (lv->flv->tags, i);
+          break;
+        }
+    }
+  return 0;
+}
+
+struct lvm_property_value
+lvm_lv_get_property (const lv_t   lv,
+                     const char  *name)
+{
+  FakePool *pool = &lv->vg->pool;
+  struct lvm_property_value prop;
+
+  if (strcmp (name, "lv_name") == 0)
+    return string_property (pool, lv->flv->name);
+  else if (strcmp (name, "lv_size") == 0)
+    return integer_property (lv->flv->size);
+  else if (strcmp (name, "origin") == 0)
+    return string_property (pool, lv->flv->origin ? lv->flv->origin : "");
+  else if (strcmp (name, "pool_lv") == 0)
+    return string_property (pool, "");
+  else if (strcmp (name, "lv_attr") == 0)
+    return string_property (pool, lv->flv->origin ? "swi-a-s---" : "-wi-a-----");
+  else if (strcmp (name, "lv_path") == 0)
+    {
+      gs_free char *path = g_strconcat ("/dev/", lv->vg->fvg->name, "/", lv->flv->name, NULL);
+      return string_property (pool, path);
+    }
+
+  memset (&prop, 0, sizeof (prop));
+  return prop;
+}
+
+lv_t
+lvm_lv_snapshot (const lv_t    lv,
+                 const char   *snap_name,
+                 uint64_t      max_snap_size)
+{
+  FakeLv *snap;
+
+  if (!lv->vg->writable)
+    {
+      lv->vg->lvmh->errnum = EPERM;
+      return NULL;
+    }
+
+  snap = fake_lv_new (snap_name, max_snap_size);
+  snap->origin = g_strdup (lv->flv->name);
+  g_ptr_array_add (lv->vg->fvg->lvs, snap);
+  /* lvm2app commits a new snapshot straight away */
+  lv->vg->fvg->seqno++;
+  return wrap_lv (lv->vg, snap);
+}
+
+const char *
+lvm_pv_get_name (const pv_t pv)
+{
+  return pv->name;
+}
+
+/* libdevmapper */
+
+struct dm_task *
+dm_task_create (int type)
+{
+  struct dm_task *dmt = g_new0 (struct dm_task, 1);
+  dmt->type = type;
+  return dmt;
+}
+
+void
+dm_task_destroy (struct dm_task *dmt)
+{
+  g_free (dmt->names);
+  g_free (dmt);
+}
+
+int
+dm_task_set_major_minor (struct dm_task  *dmt,
+                         int              major,
+                         int              minor,
+                         int              allow_default_major_fallback)
+{
+  dmt->major = major;
+  dmt->minor = minor;
+  dmt->have_device = TRUE;
+  return 1;
+}
+
+int
+dm_task_no_flush (struct dm_task *dmt)
+{
+  return 1;
+}
+
+/* The kernel's encoding, which libdevmapper's MAJOR() and MINOR()
+ * undo.
+ */
+static uint64_t
+encode_dev (guint32 major,
+            guint32 minor)
+{
+  return (minor & 0xff) | ((guint64)major << 8) | ((guint64)(minor & ~0xff) << 12);
+}
+
+static void
+append_dm_name (GString     *buf,
+                const char  *name)
+{
+  for (; *name; name++)
+    {
+      if (*name == '-')
+        g_string_append_c (buf, '-');
+      g_string_append_c (buf, *name);
+    }
+}
+
+static void
+build_names (struct dm_task *dmt)
+{
+  GString *buf = g_string_new ("");
+  gsize last = 0;
+  guint i, j;
+
+  for (i = 0; i < fake_vgs->len; i++)
+    {
+      FakeVg *fvg = fake_vgs->pdata[i];
+      for (j = 0; j < fvg->lvs->len; j++)
+        {
+          FakeLv *flv = fvg->lvs->pdata[j];
+          struct dm_names entry;
+          gsize start = buf->len;
+
+          if (flv->minor < 0)
+            continue;
+
+          if (start > 0)
+            ((struct dm_names *)(buf->str + last))->next = start - last;
+
+          memset (&entry, 0, sizeof (entry));
+          entry.dev = encode_dev (FAKE_DM_MAJOR, flv->minor);
+          g_string_append_len (buf, (char*)&entry, sizeof (entry));
+          append_dm_name (buf, fvg->name);
+          g_string_append_c (buf, '-');
+          append_dm_name (buf, flv->name);
+          g_string_append_c (buf, '\0');
+          while (buf->len % 8)
+            g_string_append_c (buf, '\0');
+          last = start;
+        }
+    }
+
+  /* No devices is a single zeroed entry */
+  if (buf->len == 0)
+    {
+      struct dm_names empty;
+      memset (&empty, 0, sizeof (empty));
+      g_string_append_len (buf, (char*)&empty, sizeof (empty));
+    }
+
+  dmt->names = g_string_free (buf, FALSE);
+}
+
+static FakeLv *
+find_active_lv (guint32 major,
+                guint32 minor)
+{
+  guint i, j;
+
+  if (major != FAKE_DM_MAJOR)
+    return NULL;
+  for (i = 0; i < fake_vgs->len; i++)
+    {
+      FakeVg *fvg = fake_vgs->pdata[i];
+      for (j = 0; j < fvg->lvs->len; j++)
+        {
+          FakeLv *flv = fvg->lvs->pdata[j];
+          if (flv->minor >= 0 && (guint32)flv->minor == minor)
+            return flv;
+        }
+    }
+  return NULL;
+}
+
+int
+dm_task_run (struct dm_task *dmt)
+{
+  if (dmt->type == DM_DEVICE_LIST)
+    build_names (dmt);
+  else if (dmt->have_device)
+    dmt->flv = find_active_lv (dmt->major, dmt->minor);
+  else
+    return 0;
+  return 1;
+}
+
+struct dm_names *
+dm_task_get_names (struct dm_task *dmt)
+{
+  if (!dmt->names)
+    dmt->names = g_malloc0 (sizeof (struct dm_names) + 8);
+  return (struct dm_names *)dmt->names;
+}
+
+int
+dm_task_get_info (struct dm_task   *dmt,
+                  struct dm_info   *info)
+{
+  memset (info, 0, sizeof (*info));
+  info->exists = dmt->flv != NULL;
+  info->major = dmt->major;
+  info->minor = dmt->minor;
+  info->target_count = info->exists;
+  return 1;
+}
+
+void *
+dm_get_next_target (struct dm_task  *dmt,
+                    void            *next,
+                    uint64_t        *start,
+                    uint64_t        *length,
+                    char           **target_type,
+                    char           **params)
+{
+  *start = 0;
+  *length = dmt->flv ? dmt->flv->size >> 9 : 0;
+  *target_type = dmt->flv && dmt->flv->origin ? "snapshot" : "linear";
+  *params = dmt->flv && dmt->flv->origin ? "0/0 0" : "";
+  return NULL;
+}
+
+/* lvm2cmd */
+
+void
+lvm2_log_fn (lvm2_log_fn_t log_fn)
+{
+}
+
+void *
+lvm2_init (void)
+{
+  return fake_vgs;
+}
+
+int
+lvm2_run (void         *handle,
+          const char   *cmdline)
+{
+  return LVM2_COMMAND_SUCCEEDED;
+}
+
+void
+lvm2_exit (void *handle)
+{
+}
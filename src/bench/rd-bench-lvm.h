@@ -0,0 +1,43 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* An in-memory stand-in for lvm2app, libdevmapper and lvm2cmd, so the
+ * inventory and tagging code can be timed at scales no test machine
+ * has.  Active LVs get device numbers 253:0, 253:1, ...
+ */
+
+void       rd_bench_lvm_populate (guint   n_vgs,
+                                  guint   n_lvs_per_vg,
+                                  guint   tag_percent,
+                                  guint   active_percent,
+                                  guint32 seed);
+
+guint      rd_bench_lvm_get_n_active (void);
+
+GPtrArray *rd_bench_lvm_list_paths (gboolean tagged);
+GPtrArray *rd_bench_lvm_list_vg_globs (void);
+
+G_END_DECLS
@@ -0,0 +1,404 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rd.h"
+#include "rd-bench-lvm.h"
+#include "libgsystem.h"
+
+static int opt_vgs = 10;
+static int opt_lvs = 10;
+static int opt_tag_percent = 50;
+static int opt_active_percent = 90;
+static int opt_mounts = 100;
+static int opt_iterations = 20;
+static gboolean opt_no_snapshot;
+
+static GOptionEntry options[] = {
+  { "vgs", 0, 0, G_OPTION_ARG_INT, &opt_vgs, "Number of VGs (default 10)", "N" },
+  { "lvs", 0, 0, G_OPTION_ARG_INT, &opt_lvs, "LVs per VG (default 10)", "N" },
+  { "tag-percent", 0, 0, G_OPTION_ARG_INT, &opt_tag_percent, "Share of LVs tagged for rollback (default 50)", "PERCENT" },
+  { "active-percent", 0, 0, G_OPTION_ARG_INT, &opt_active_percent, "Share of LVs that are active (default 90)", "PERCENT" },
+  { "mounts", 0, 0, G_OPTION_ARG_INT, &opt_mounts, "Unrelated mountinfo entries (default 100)", "N" },
+  { "iterations", 0, 0, G_OPTION_ARG_INT, &opt_iterations, "Samples per phase (default 20)", "N" },
+  { "no-snapshot", 0, 0, G_OPTION_ARG_NONE, &opt_no_snapshot, "Skip the snapshot phase, which forks a worker per VG", NULL },
+  { NULL }
+};
+
+typedef struct {
+  const char  *name;
+  GArray      *samples;   /* gint64 microseconds */
+} Phase;
+
+static void
+add_sample (Phase   *phase,
+            gint64   start)
+{
+  gint64 elapsed = g_get_monotonic_time () - start;
+  g_array_append_val (phase->samples, elapsed);
+}
+
+static void
+discard_print (const gchar *str)
+{
+}
+
+static int
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+  gint64 va = *(const gint64*)a;
+  gint64 vb = *(const gint64*)b;
+  return va < vb ? -1 : (va > vb);
+}
+
+static double
+percentile_ms (GArray  *sorted,
+               guint    percent)
+{
+  guint idx = (sorted->len - 1) * percent / 100;
+  return g_array_index (sorted, gint64, idx) / 1000.0;
+}
+
+static void
+report_phase (Phase *phase)
+{
+  g_array_sort (phase->samples, compare_samples);
+  g_print ("  %-10s %5u %10.3f %10.3f %10.3f %10.3f\n", phase->name,
+           phase->samples->len,
+           percentile_ms (phase->samples, 50),
+           percentile_ms (phase->samples, 90),
+           percentile_ms (phase->samples, 99),
+           percentile_ms (phase->samples, 100));
+}
+
+/* Every active LV is mounted, shuffled in among @n_other entries for
+ * unrelated filesystems, as on a busy container host.
+ */
+static gboolean
+write_mountinfo (const char  *path,
+                 guint        n_active,
+                 guint        n_other,
+                 GError     **error)
+{
+  GString *buf = g_string_new ("");
+  GRand *rand = g_rand_new_with_seed (42);
+  guint n_lines = n_active + n_other;
+  guint *order = g_new (guint, n_lines);
+  gboolean ret;
+  guint i;
+
+  for (i = 0; i < n_lines; i++)
+    order[i] = i;
+  for (i = n_lines; i > 1; i--)
+    {
+      guint j = g_rand_int_range (rand, 0, i);
+      guint tmp = order[i - 1];
+      order[i - 1] = order[j];
+      order[j] = tmp;
+    }
+
+  for (i = 0; i < n_lines; i++)
+    {
+      guint n = order[i];
+      if (n < n_active)
+        g_string_append_printf (buf, "%u 1 253:%u / /srv/lv%u rw,relatime shared:%u - xfs /dev/mapper/lv%u rw\n",
+                                i + 100, n, n, i, n);
+      else
+        g_string_append_printf (buf, "%u 1 0:%u / /run/other\\040%u rw,nosuid - tmpfs tmpfs rw\n",
+                                i + 100, n, n);
+    }
+
+  ret = g_file_set_contents (path, buf->str, buf->len, error);
+  g_string_free (buf, TRUE);
+  g_rand_free (rand);
+  g_free (order);
+  return ret;
+}
+
+static gboolean
+list_one_lv (RdLvRecord   *rec,
+             gpointer      user_data,
+             GError      **error)
+{
+  GString *buf = user_data;
+
+  g_string_truncate (buf, 0);
+  g_string_append (buf, "{\"path\":");
+  rd_json_append_string (buf, rec->path);
+  g_string_append (buf, ",\"mount\":");
+  rd_json_append_string (buf, rec->mount_path);
+  g_string_append (buf, "}\n");
+  return TRUE;
+}
+
+static gboolean
+snapshot_one_vg (RdVgWorker        *worker,
+                 lvm_t              lvmh,
+                 const char        *vgname,
+                 gpointer           user_data,
+                 GVariant         **out_result,
+                 GCancellable      *cancellable,
+                 GError           **error)
+{
+  GHashTable *lvs_by_vg = user_data;
+  GPtrArray *records = g_hash_table_lookup (lvs_by_vg, vgname);
+  glvm_cleanup_vg vg_t vg = NULL;
+  guint i;
+
+  vg = lvm_vg_open (lvmh, vgname, "w", 0);
+  if (vg == NULL)
+    {
+      glvm_set_error (error, lvmh);
+      return FALSE;
+    }
+
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      gs_free char *snapname = rd_snapshot_name (rec->lvname, 0, 0);
+      lv_t lv = lvm_lv_from_name (vg, rec->lvname);
+
+      if (!lv || !lvm_lv_snapshot (lv, snapname, rec->size / 5))
+        {
+          glvm_set_error (error, lvmh);
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+static gboolean
+run_bench (const char   *mountinfo_path,
+           GError      **error)
+{
+  gboolean ret = FALSE;
+  Phase phases[] = {
+    { "mountinfo", NULL },
+    { "inventory", NULL },
+    { "list", NULL },
+    { "add", NULL },
+    { "remove", NULL },
+    { "add-glob", NULL },
+    { "remove-glob", NULL },
+    { "snapshot", NULL },
+  };
+  guint n_phases = opt_no_snapshot ? G_N_ELEMENTS (phases) - 1 : G_N_ELEMENTS (phases);
+  gs_unref_ptrarray GPtrArray *untagged = NULL;
+  gs_unref_ptrarray GPtrArray *globs = NULL;
+  static const char *const glob_sets[] = { "bench", NULL };
+  RdMountTable *mounts = NULL;
+  lvm_t lvmh = NULL;
+  GString *listbuf = g_string_new ("");
+  GPrintFunc old_print;
+  guint n_tagged = 0;
+  int i;
+  guint p;
+
+  for (p = 0; p < G_N_ELEMENTS (phases); p++)
+    phases[p].samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  untagged = rd_bench_lvm_list_paths (FALSE);
+  globs = rd_bench_lvm_list_vg_globs ();
+  /* rd_tag_lvs() reports every LV it changes */
+  old_print = g_set_print_handler (discard_print);
+
+  for (i = 0; i < opt_iterations; i++)
+    {
+      gs_unref_ptrarray GPtrArray *records = NULL;
+      gint64 start;
+
+      start = g_get_monotonic_time ();
+      mounts = rd_mount_table_new_from_file (mountinfo_path, error);
+      if (!mounts)
+        goto out;
+      add_sample (&phases[0], start);
+
+      /* A fresh handle each time, as each command invocation has */
+      start = g_get_monotonic_time ();
+      lvmh = rd_lvm_open (error);
+      if (!lvmh)
+        goto out;
+      if (!rd_inventory_scan (lvmh, mounts, &records, NULL, error))
+        goto out;
+      add_sample (&phases[1], start);
+      n_tagged = records->len;
+
+      start = g_get_monotonic_time ();
+      if (!rd_inventory_foreach (lvmh, mounts, list_one_lv, listbuf, NULL, error))
+        goto out;
+      add_sample (&phases[2], start);
+
+      /* Tag everything not yet tagged, then put it back */
+      start = g_get_monotonic_time ();
+      if (untagged->len > 0
+          && !rd_tag_lvs (lvmh, untagged->len, (char**)untagged->pdata, TRUE, NULL, error))
+        goto out;
+      add_sample (&phases[3], start);
+
+      start = g_get_monotonic_time ();
+      if (untagged->len > 0
+          && !rd_tag_lvs (lvmh, untagged->len, (char**)untagged->pdata, FALSE, NULL, error))
+        goto out;
+      add_sample (&phases[4], start);
+
+      /* Every LV again through VG globs, in a set of its own so the
+       * rollback_include tags are left as they were
+       */
+      if (!rd_sets_select (glob_sets, error))
+        goto out;
+      start = g_get_monotonic_time ();
+      if (!rd_tag_lvs (lvmh, globs->len, (char**)globs->pdata, TRUE, NULL, error))
+        goto out;
+      add_sample (&phases[5], start);
+
+      start = g_get_monotonic_time ();
+      if (!rd_tag_lvs (lvmh, globs->len, (char**)globs->pdata, FALSE, NULL, error))
+        goto out;
+      add_sample (&phases[6], start);
+      if (!rd_sets_select (NULL, error))
+        goto out;
+
+      if (!opt_no_snapshot && records->len > 0)
+        {
+          gs_unref_hashtable GHashTable *lvs_by_vg = NULL;
+          gs_unref_ptrarray GPtrArray *vgnames = NULL;
+          gs_unref_ptrarray GPtrArray *results = NULL;
+          guint j;
+
+          /* Workers are forked, so their snapshots don't accumulate */
+          start = g_get_monotonic_time ();
+          rd_inventory_group_by_vg (records, &lvs_by_vg, &vgnames);
+          if (!rd_run_vg_workers (vgnames, 0, snapshot_one_vg, NULL, lvs_by_vg,
+                                  &results, NULL, error))
+            goto out;
+          add_sample (&phases[7], start);
+
+          for (j = 0; j < results->len; j++)
+            {
+              RdVgWorkerResult *result = results->pdata[j];
+              if (result->error)
+                {
+                  g_propagate_error (error, result->error);
+                  result->error = NULL;
+                  goto out;
+                }
+            }
+        }
+
+      lvm_quit (lvmh);
+      lvmh = NULL;
+      rd_mount_table_free (mounts);
+      mounts = NULL;
+    }
+
+  g_set_print_handler (old_print);
+
+  g_print ("%d VGs x %d LVs, %u tagged, %u active, %u mountinfo lines, %d iterations\n",
+           opt_vgs, opt_lvs, n_tagged, rd_bench_lvm_get_n_active (),
+           rd_bench_lvm_get_n_active () + opt_mounts, opt_iterations);
+  g_print ("  %-10s %5s %10s %10s %10s %10s\n", "phase", "n", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (p = 0; p < n_phases; p++)
+    {
+      if (phases[p].samples->len > 0)
+        report_phase (&phases[p]);
+    }
+
+  ret = TRUE;
+ out:
+  g_set_print_handler (old_print);
+  if (lvmh)
+    lvm_quit (lvmh);
+  if (mounts)
+    rd_mount_table_free (mounts);
+  for (p = 0; p < G_N_ELEMENTS (phases); p++)
+    g_array_unref (phases[p].samples);
+  g_string_free (listbuf, TRUE);
+  return ret;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  GOptionContext *context;
+  gs_free char *tmpdir = NULL;
+  gs_free char *mountinfo_path = NULL;
+  gs_free char *cache_path = NULL;
+
+  g_type_init ();
+
+  context = g_option_context_new ("- Time roller-derby against a synthetic LVM setup");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (opt_vgs < 0 || opt_lvs < 0 || opt_mounts < 0 || opt_iterations <= 0
+      || opt_tag_percent < 0 || opt_tag_percent > 100
+      || opt_active_percent < 0 || opt_active_percent > 100)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                           "Invalid arguments");
+      goto out;
+    }
+
+  /* The stand-in replaces lvm2app, not the lvm binary */
+  rd_inventory_set_backend (RD_INVENTORY_BACKEND_LVM2APP);
+  rd_bench_lvm_populate (opt_vgs, opt_lvs, opt_tag_percent, opt_active_percent, 42);
+
+  tmpdir = g_dir_make_tmp ("rd-bench-XXXXXX", error);
+  if (!tmpdir)
+    goto out;
+  mountinfo_path = g_build_filename (tmpdir, "mountinfo", NULL);
+  /* Only the first inventory of each VG, and those after add, remove
+   * or snapshot changed it, miss the cache
+   */
+  cache_path = g_build_filename (tmpdir, "inventory", NULL);
+  rd_inventory_set_cache_path (cache_path);
+
+  if (!write_mountinfo (mountinfo_path, rd_bench_lvm_get_n_active (), opt_mounts, error))
+    goto out;
+
+  if (!run_bench (mountinfo_path, error))
+    goto out;
+
+ out:
+  if (mountinfo_path)
+    (void) unlink (mountinfo_path);
+  if (cache_path)
+    (void) unlink (cache_path);
+  if (tmpdir)
+    (void) rmdir (tmpdir);
+  if (local_error != NULL)
+    {
+      g_printerr ("%s\n", local_error->message);
+      g_error_free (local_error);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,396 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2011,2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* roller-derby-early runs from the initramfs, before the root
+ * filesystem is mounted, to roll back the selected set while nothing
+ * has its LVs open.  It is on the boot path of every boot, so it
+ * links only GLib, lvm2app and lvm2cmd: no GIO, no type system, no
+ * mountinfo, no inventory.  Unless the kernel command line asks for
+ * a rollback it exits after reading /proc/cmdline, and when it does
+ * roll back, only the VGs the command line names are read.
+ *
+ * Kernel command line:
+ *   roller_derby.rollback=[SET]@TS  Roll back SET (default "default")
+ *                                   to its snapshots taken at TS
+ *   rd.lvm.vg=VG, rd.lvm.lv=VG/LV   The VGs to look in, as for dracut
+ *   rd.lvm=0                        LVM is disabled; do nothing
+ *
+ * The timestamp makes a rollback one-shot: merging consumes the
+ * snapshots it names, so a command line that persists across boots
+ * finds nothing left to merge, rather than going back one snapshot
+ * further every boot.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <lvm2app.h>
+#include <string.h>
+
+#include "glvm-cmd.h"
+#include "rd-names.h"
+
+#define RD_EARLY_ROLLBACK_ARG "roller_derby.rollback"
+
+static char *opt_cmdline;
+static gboolean opt_dry_run;
+
+static GOptionEntry options[] = {
+  { "cmdline", 0, 0, G_OPTION_ARG_FILENAME, &opt_cmdline, "Read the kernel command line from FILE (default /proc/cmdline)", "FILE" },
+  { "dry-run", 'n', 0, G_OPTION_ARG_NONE, &opt_dry_run, "Only print which snapshots would be merged", NULL },
+  { NULL }
+};
+
+typedef struct {
+  char        *set;         /* NULL if no rollback was asked for */
+  gint64       timestamp;   /* -1 if missing or invalid */
+  GPtrArray   *vgnames;
+  gboolean     lvm_disabled;
+} EarlyConfig;
+
+static void
+add_vgname (GPtrArray    *vgnames,
+            const char   *vgname,
+            gsize         len)
+{
+  guint i;
+
+  if (len == 0)
+    return;
+  for (i = 0; i < vgnames->len; i++)
+    {
+      const char *seen = vgnames->pdata[i];
+      if (strlen (seen) == len && strncmp (seen, vgname, len) == 0)
+        return;
+    }
+  g_ptr_array_add (vgnames, g_strndup (vgname, len));
+}
+
+static gboolean
+parse_cmdline (const char    *path,
+               EarlyConfig   *config,
+               GError       **error)
+{
+  gboolean ret = FALSE;
+  char *contents = NULL;
+  char **args = NULL;
+  char **iter;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    goto out;
+
+  args = g_strsplit_set (contents, " \t\n", -1);
+  for (iter = args; *iter; iter++)
+    {
+      const char *arg = *iter;
+
+      if (strcmp (arg, RD_EARLY_ROLLBACK_ARG) == 0
+          || g_str_has_prefix (arg, RD_EARLY_ROLLBACK_ARG "="))
+        {
+          const char *value = arg + strlen (RD_EARLY_ROLLBACK_ARG);
+          const char *at = strchr (value, '@');
+          char *end = NULL;
+
+          g_free (config->set);
+          config->timestamp = -1;
+          if (*value == '=')
+            value++;
+          if (at == NULL || at == value)
+            config->set = g_strdup (RD_SET_DEFAULT);
+          else
+            config->set = g_strndup (value, at - value);
+          if (at != NULL && at[1] != '\0')
+            {
+              config->timestamp = g_ascii_strtoll (at + 1, &end, 10);
+              if (*end != '\0' || config->timestamp < 0)
+                config->timestamp = -1;
+            }
+        }
+      else if (g_str_has_prefix (arg, "rd.lvm.vg="))
+        {
+          const char *vgname = arg + strlen ("rd.lvm.vg=");
+          add_vgname (config->vgnames, vgname, strlen (vgname));
+        }
+      else if (g_str_has_prefix (arg, "rd.lvm.lv="))
+        {
+          const char *lvpath = arg + strlen ("rd.lvm.lv=");
+          const char *slash = strchr (lvpath, '/');
+          if (slash)
+            add_vgname (config->vgnames, lvpath, slash - lvpath);
+        }
+      else if (strcmp (arg, "rd.lvm=0") == 0)
+        config->lvm_disabled = TRUE;
+    }
+
+  ret = TRUE;
+ out:
+  g_free (contents);
+  g_strfreev (args);
+  return ret;
+}
+
+static const char *
+lv_get_nonempty_string (lv_t          lv,
+                        const char   *propname)
+{
+  struct lvm_property_value prop = lvm_lv_get_property (lv, propname);
+
+  if (prop.is_valid && prop.is_string
+      && prop.value.string != NULL && prop.value.string[0] != '\0')
+    return prop.value.string;
+  return NULL;
+}
+
+static gboolean
+tag_list_has_set (struct dm_list  *tags,
+                  const char      *set)
+{
+  struct lvm_str_list *tagl;
+
+  if (!tags)
+    return FALSE;
+
+  dm_list_iterate_items (tagl, tags)
+    {
+      const char *tagset = rd_tag_get_set (tagl->str);
+      if (tagset && strcmp (tagset, set) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+typedef struct {
+  char    *snapname;
+  gint64   timestamp;
+  guint    serial;
+} LatestSnapshot;
+
+static void
+latest_snapshot_free (LatestSnapshot *latest)
+{
+  g_free (latest->snapname);
+  g_free (latest);
+}
+
+/* Read @vgname once, and append "VG/SNAPSHOT" to @merge_args for the
+ * roller-derby snapshot taken at @timestamp of each LV in @set,
+ * counting them in @n_merges.  An origin whose merge is already
+ * pending, e.g. from a rollback run before the reboot, needs nothing
+ * more than activation, and one with no snapshot left from
+ * @timestamp has most likely been rolled back by an earlier boot.
+ *
+ * Returns: The number of LVs in @set that could not be rolled back
+ */
+static guint
+plan_vg_merges (lvm_t          lvmh,
+                const char    *vgname,
+                const char    *set,
+                gint64         timestamp,
+                GString       *merge_args,
+                guint         *n_merges)
+{
+  guint n_failed = 0;
+  vg_t vg;
+  gboolean whole_vg;
+  GHashTable *latest_by_origin;
+  GPtrArray *origins;
+  struct dm_list *lvs;
+  struct lvm_lv_list *lvsl;
+  guint i;
+
+  vg = lvm_vg_open (lvmh, vgname, "r", 0);
+  if (vg == NULL)
+    {
+      g_printerr ("roller-derby-early: %s: %s\n", vgname, lvm_errmsg (lvmh));
+      return 1;
+    }
+
+  /* NULL if the VG has no LVs, and so nothing to roll back.  The list
+   * is fetched once since each call allocates a new one.
+   */
+  lvs = lvm_vg_list_lvs (vg);
+  if (!lvs)
+    {
+      lvm_vg_close (vg);
+      return 0;
+    }
+
+  latest_by_origin = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)latest_snapshot_free);
+  origins = g_ptr_array_new ();
+  whole_vg = tag_list_has_set (lvm_vg_get_tags (vg), set);
+
+  dm_list_iterate_items (lvsl, lvs)
+    {
+      const char *origin = lv_get_nonempty_string (lvsl->lv, "origin");
+      const char *lvname = lvm_lv_get_name (lvsl->lv);
+      char *snap_origin = NULL;
+      gint64 ts;
+      guint serial;
+
+      if (!origin)
+        {
+          if (whole_vg || tag_list_has_set (lvm_lv_get_tags (lvsl->lv), set))
+            g_ptr_array_add (origins, lvsl->lv);
+          continue;
+        }
+
+      if (rd_snapshot_name_parse (lvname, &snap_origin, &ts, &serial)
+          && strcmp (snap_origin, origin) == 0 && ts == timestamp)
+        {
+          LatestSnapshot *latest = g_hash_table_lookup (latest_by_origin, origin);
+
+          if (!latest)
+            {
+              latest = g_new0 (LatestSnapshot, 1);
+              latest->timestamp = -1;
+              g_hash_table_insert (latest_by_origin, g_strdup (origin), latest);
+            }
+          if (latest->timestamp < 0 || serial > latest->serial)
+            {
+              g_free (latest->snapname);
+              latest->snapname = g_strdup (lvname);
+              latest->timestamp = ts;
+              latest->serial = serial;
+            }
+        }
+      g_free (snap_origin);
+    }
+
+  for (i = 0; i < origins->len; i++)
+    {
+      lv_t lv = origins->pdata[i];
+      const char *lvname = lvm_lv_get_name (lv);
+      const char *attr = lv_get_nonempty_string (lv, "lv_attr");
+      LatestSnapshot *latest = g_hash_table_lookup (latest_by_origin, lvname);
+
+      /* 'O' is an origin with a merging snapshot */
+      if (attr && attr[0] == 'O')
+        g_printerr ("roller-derby-early: Merge into %s/%s already pending\n", vgname, lvname);
+      else if (!latest)
+        g_printerr ("roller-derby-early: %s/%s: No roller-derby snapshot from %" G_GINT64_FORMAT
+                    "; already rolled back?\n", vgname, lvname, timestamp);
+      else
+        {
+          g_printerr ("roller-derby-early: %s %s/%s into %s/%s\n",
+                      opt_dry_run ? "Would merge" : "Merging",
+                      vgname, latest->snapname, vgname, lvname);
+          g_string_append_printf (merge_args, " %s/%s", vgname, latest->snapname);
+          (*n_merges)++;
+        }
+    }
+
+  g_ptr_array_unref (origins);
+  g_hash_table_unref (latest_by_origin);
+  lvm_vg_close (vg);
+  return n_failed;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int exit_status = 1;
+  GError *local_error = NULL;
+  GOptionContext *context;
+  EarlyConfig config;
+  GString *merge_args = NULL;
+  lvm_t lvmh;
+  guint n_failed = 0;
+  guint n_merges = 0;
+  guint i;
+
+  memset (&config, 0, sizeof (config));
+  config.timestamp = -1;
+  config.vgnames = g_ptr_array_new_with_free_func (g_free);
+
+  context = g_option_context_new ("- Roll back from the initramfs, as asked by the kernel command line");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &local_error))
+    goto out;
+
+  if (!parse_cmdline (opt_cmdline ? opt_cmdline : "/proc/cmdline", &config, &local_error))
+    goto out;
+
+  /* The usual boot: nothing asked for, nothing to pay for */
+  if (!config.set || config.lvm_disabled)
+    {
+      exit_status = 0;
+      goto out;
+    }
+
+  if (config.timestamp < 0)
+    {
+      g_printerr ("roller-derby-early: " RD_EARLY_ROLLBACK_ARG " needs the timestamp of the "
+                  "snapshots to merge, as [SET]@TIMESTAMP; not rolling back\n");
+      goto out;
+    }
+
+  if (config.vgnames->len == 0)
+    {
+      g_printerr ("roller-derby-early: No VGs named with rd.lvm.vg= or rd.lvm.lv=; not rolling back\n");
+      goto out;
+    }
+
+  lvmh = lvm_init (NULL);
+  if (lvmh == NULL)
+    {
+      g_printerr ("roller-derby-early: Failed to initialize lvm2app\n");
+      goto out;
+    }
+
+  merge_args = g_string_new ("lvconvert --merge --background");
+  for (i = 0; i < config.vgnames->len; i++)
+    n_failed += plan_vg_merges (lvmh, config.vgnames->pdata[i], config.set,
+                                config.timestamp, merge_args, &n_merges);
+
+  /* lvm2cmd takes the VG locks itself */
+  lvm_quit (lvmh);
+
+  /* One command for every VG.  The origins are not open yet, so the
+   * kernel starts each merge as soon as the origin is activated, and
+   * the origin can be mounted straight away.
+   */
+  if (!opt_dry_run && n_merges > 0)
+    {
+      char *errmsg = NULL;
+
+      if (!glvm_cmd_run (merge_args->str, NULL, &errmsg))
+        {
+          g_printerr ("roller-derby-early: %s\n", errmsg);
+          g_free (errmsg);
+          goto out;
+        }
+    }
+
+  if (n_failed == 0)
+    exit_status = 0;
+ out:
+  if (local_error)
+    {
+      g_printerr ("roller-derby-early: %s\n", local_error->message);
+      g_error_free (local_error);
+    }
+  if (merge_args)
+    g_string_free (merge_args, TRUE);
+  g_free (config.set);
+  g_ptr_array_unref (config.vgnames);
+  return exit_status;
+}
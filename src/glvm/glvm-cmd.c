@@ -0,0 +1,103 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2011,2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <lvm2cmd.h>
+
+#include "glvm-cmd.h"
+
+/* lvm2cmd reports through a process-wide callback; collect what it
+ * says about the current command.
+ */
+static GString *command_log;
+
+static void
+command_log_fn (int          level,
+                const char  *file,
+                int          line,
+                int          dm_errno,
+                const char  *message)
+{
+  /* The low bits are the level; 4 is log_print() and warnings, higher
+   * is verbose and debug output.
+   */
+  if ((level & 7) > 4 || !command_log)
+    return;
+
+  if (command_log->len > 0)
+    g_string_append_c (command_log, '\n');
+  g_string_append (command_log, message);
+}
+
+/**
+ * glvm_cmd_run:
+ * @cmdline: An lvm command line, e.g. "lvconvert --merge vg/snap"
+ * @out_output: (out) (allow-none): What the command printed
+ * @out_errmsg: (out) (allow-none): On failure, why
+ *
+ * Run @cmdline in-process through lvm2cmd.  This is the part of
+ * glvm_run_command() that needs nothing beyond GLib.  Not
+ * thread-safe.
+ */
+gboolean
+glvm_cmd_run (const char    *cmdline,
+              char         **out_output,
+              char         **out_errmsg)
+{
+  gboolean ret = FALSE;
+  void *handle = NULL;
+  char *errmsg = NULL;
+  int res;
+
+  command_log = g_string_new ("");
+  lvm2_log_fn (command_log_fn);
+
+  handle = lvm2_init ();
+  if (!handle)
+    {
+      errmsg = g_strdup ("Failed to initialize lvm2cmd");
+      goto out;
+    }
+
+  res = lvm2_run (handle, cmdline);
+  if (res != LVM2_COMMAND_SUCCEEDED)
+    {
+      errmsg = g_strdup_printf ("%s: %s", cmdline,
+                                command_log->len > 0 ? command_log->str : "failed");
+      goto out;
+    }
+
+  ret = TRUE;
+  if (out_output)
+    *out_output = g_strdup (command_log->str);
+ out:
+  if (handle)
+    lvm2_exit (handle);
+  lvm2_log_fn (NULL);
+  g_string_free (command_log, TRUE);
+  command_log = NULL;
+  if (out_errmsg)
+    *out_errmsg = errmsg;
+  else
+    g_free (errmsg);
+  return ret;
+}
@@ -0,0 +1,408 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "glvm.h"
+#include "libgsystem.h"
+
+/* lvm's JSON reports look like
+ *
+ *   {"report": [{"lv": [{"lv_name":"root", "lv_tags":"a,b", ...}, ...]}]}
+ *
+ * with every value a string.  Output is parsed as it is read, with
+ * only the current row held in memory, so the cost does not depend on
+ * how many LVs the system has.
+ */
+
+typedef struct {
+  gboolean   is_object;
+  char      *key;        /* Key this container is the value of, or NULL */
+} ReportFrame;
+
+typedef struct {
+  const char          *report_name;
+  GlvmReportRowFunc    func;
+  gpointer             user_data;
+
+  GString             *buf;
+  GArray              *stack;        /* ReportFrame */
+  char                *pending_key;  /* Key awaiting its value */
+  GHashTable          *row;
+  guint                row_depth;
+} ReportParser;
+
+static void
+report_parser_init (ReportParser       *parser,
+                    const char         *report_name,
+                    GlvmReportRowFunc   func,
+                    gpointer            user_data)
+{
+  memset (parser, 0, sizeof (*parser));
+  parser->report_name = report_name;
+  parser->func = func;
+  parser->user_data = user_data;
+  parser->buf = g_string_new ("");
+  parser->stack = g_array_new (FALSE, FALSE, sizeof (ReportFrame));
+}
+
+static void
+report_parser_clear (ReportParser *parser)
+{
+  guint i;
+
+  for (i = 0; i < parser->stack->len; i++)
+    g_free (g_array_index (parser->stack, ReportFrame, i).key);
+  g_array_unref (parser->stack);
+  g_string_free (parser->buf, TRUE);
+  g_free (parser->pending_key);
+  if (parser->row)
+    g_hash_table_unref (parser->row);
+}
+
+static ReportFrame *
+current_frame (ReportParser *parser)
+{
+  if (parser->stack->len == 0)
+    return NULL;
+  return &g_array_index (parser->stack, ReportFrame, parser->stack->len - 1);
+}
+
+static void
+push_container (ReportParser  *parser,
+                gboolean       is_object)
+{
+  ReportFrame *parent = current_frame (parser);
+  ReportFrame frame;
+
+  /* Rows are the objects in the array named after the report */
+  if (is_object && !parser->row && parent && !parent->is_object
+      && g_strcmp0 (parent->key, parser->report_name) == 0)
+    {
+      parser->row = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      parser->row_depth = parser->stack->len + 1;
+    }
+
+  frame.is_object = is_object;
+  frame.key = parser->pending_key;
+  parser->pending_key = NULL;
+  g_array_append_val (parser->stack, frame);
+}
+
+static gboolean
+pop_container (ReportParser  *parser,
+               gboolean       is_object,
+               GError       **error)
+{
+  ReportFrame *frame = current_frame (parser);
+
+  if (!frame || frame->is_object != is_object)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Malformed JSON report");
+      return FALSE;
+    }
+
+  if (parser->row && parser->stack->len == parser->row_depth)
+    {
+      GHashTable *row = parser->row;
+      gboolean ok;
+
+      parser->row = NULL;
+      ok = parser->func (row, parser->user_data, error);
+      g_hash_table_unref (row);
+      if (!ok)
+        return FALSE;
+    }
+
+  g_free (frame->key);
+  g_array_set_size (parser->stack, parser->stack->len - 1);
+  return TRUE;
+}
+
+/* Scalars are only kept if they are fields of a row */
+static void
+add_scalar (ReportParser  *parser,
+            char          *value)
+{
+  ReportFrame *frame = current_frame (parser);
+
+  if (frame && frame->is_object && !parser->pending_key)
+    {
+      parser->pending_key = value;
+      return;
+    }
+
+  if (parser->row && parser->stack->len == parser->row_depth && parser->pending_key)
+    {
+      g_hash_table_replace (parser->row, parser->pending_key, value);
+      parser->pending_key = NULL;
+      return;
+    }
+
+  g_clear_pointer (&parser->pending_key, g_free);
+  g_free (value);
+}
+
+/* Returns the string starting at @p (after the opening quote),
+ * unescaped, or %NULL if its closing quote has not been read yet.
+ */
+static char *
+scan_string (const char   *p,
+             const char   *end,
+             const char  **out_next)
+{
+  GString *str = g_string_new ("");
+
+  while (p < end)
+    {
+      if (*p == '"')
+        {
+          *out_next = p + 1;
+          return g_string_free (str, FALSE);
+        }
+      else if (*p != '\\')
+        g_string_append_c (str, *p++);
+      else if (p + 1 >= end)
+        break;
+      else
+        {
+          char c = p[1];
+          p += 2;
+          switch (c)
+            {
+            case 'b': g_string_append_c (str, '\b'); break;
+            case 'f': g_string_append_c (str, '\f'); break;
+            case 'n': g_string_append_c (str, '\n'); break;
+            case 'r': g_string_append_c (str, '\r'); break;
+            case 't': g_string_append_c (str, '\t'); break;
+            case 'u':
+              {
+                char hex[5];
+                if (p + 4 > end)
+                  goto incomplete;
+                memcpy (hex, p, 4);
+                hex[4] = '\0';
+                g_string_append_unichar (str, (gunichar)g_ascii_strtoull (hex, NULL, 16));
+                p += 4;
+              }
+              break;
+            default: g_string_append_c (str, c); break;
+            }
+        }
+    }
+
+ incomplete:
+  g_string_free (str, TRUE);
+  return NULL;
+}
+
+/* Consume every complete token in the buffer; a token cut off at the
+ * end of the buffer is left for the next read, unless @at_eof.
+ */
+static gboolean
+report_parser_process (ReportParser  *parser,
+                       gboolean       at_eof,
+                       GError       **error)
+{
+  const char *p = parser->buf->str;
+  const char *end = p + parser->buf->len;
+
+  while (p < end)
+    {
+      switch (*p)
+        {
+        case ' ': case '\t': case '\n': case '\r': case ',': case ':':
+          p++;
+          break;
+        case '{':
+        case '[':
+          push_container (parser, *p == '{');
+          p++;
+          break;
+        case '}':
+        case ']':
+          if (!pop_container (parser, *p == '}', error))
+            return FALSE;
+          p++;
+          break;
+        case '"':
+          {
+            const char *next;
+            char *value = scan_string (p + 1, end, &next);
+            if (!value)
+              goto out;
+            add_scalar (parser, value);
+            p = next;
+          }
+          break;
+        default:
+          {
+            /* Numbers, true, false, null */
+            const char *start = p;
+            while (p < end && (g_ascii_isalnum (*p) || *p == '+' || *p == '-' || *p == '.'))
+              p++;
+            if (p == start)
+              {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Unexpected '%c' in JSON report", *p);
+                return FALSE;
+              }
+            if (p == end && !at_eof)
+              {
+                p = start;
+                goto out;
+              }
+            add_scalar (parser, g_strndup (start, p - start));
+          }
+          break;
+        }
+    }
+
+ out:
+  g_string_erase (parser->buf, 0, p - parser->buf->str);
+  if (at_eof && (parser->buf->len > 0 || parser->stack->len > 0))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Truncated JSON report");
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+ * glvm_report_run:
+ * @command: Reporting command, e.g. "lvs" or "pvs"
+ * @report_name: Which report in the output holds the rows, e.g. "lv"
+ * @fields: Fields to report
+ * @config: (allow-none): Configuration to pass with --config
+ * @func: Called with each row, mapping field name to value
+ *
+ * Run one lvm reporting command with JSON output, streaming each row
+ * to @func as soon as it has been read.  Sizes are in bytes.
+ */
+gboolean
+glvm_report_run (const char          *command,
+                 const char          *report_name,
+                 const char *const   *fields,
+                 const char          *config,
+                 GlvmReportRowFunc    func,
+                 gpointer             user_data,
+                 GCancellable        *cancellable,
+                 GError             **error)
+{
+  gboolean ret = FALSE;
+  gs_free char *fields_str = g_strjoinv (",", (char**)fields);
+  GPtrArray *argv = g_ptr_array_new ();
+  ReportParser parser;
+  GPid pid = 0;
+  int out_fd = -1;
+  int estatus;
+  GlvmTimer timer;
+
+  GLVM_TRACE_BEGIN (timer, lvm_report, command);
+
+  g_ptr_array_add (argv, "lvm");
+  g_ptr_array_add (argv, (char*)command);
+  g_ptr_array_add (argv, "--reportformat");
+  g_ptr_array_add (argv, "json");
+  g_ptr_array_add (argv, "--units");
+  g_ptr_array_add (argv, "b");
+  g_ptr_array_add (argv, "--nosuffix");
+  g_ptr_array_add (argv, "-o");
+  g_ptr_array_add (argv, fields_str);
+  if (config)
+    {
+      g_ptr_array_add (argv, "--config");
+      g_ptr_array_add (argv, (char*)config);
+    }
+  g_ptr_array_add (argv, NULL);
+
+  report_parser_init (&parser, report_name, func, user_data);
+
+  if (!g_spawn_async_with_pipes (NULL, (char**)argv->pdata, NULL,
+                                 G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                 NULL, NULL, &pid, NULL, &out_fd, NULL, error))
+    goto out;
+
+  while (TRUE)
+    {
+      char buf[65536];
+      ssize_t bytes_read;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      bytes_read = read (out_fd, buf, sizeof (buf));
+      if (bytes_read == -1)
+        {
+          int errsv = errno;
+          if (errsv == EINTR)
+            continue;
+          g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                               g_strerror (errsv));
+          goto out;
+        }
+      else if (bytes_read == 0)
+        break;
+
+      g_string_append_len (parser.buf, buf, bytes_read);
+      if (!report_parser_process (&parser, FALSE, error))
+        goto out;
+    }
+
+  (void) close (out_fd);
+  out_fd = -1;
+
+  while (waitpid (pid, &estatus, 0) == -1 && errno == EINTR)
+    ;
+  pid = 0;
+  if (!g_spawn_check_exit_status (estatus, error))
+    {
+      g_prefix_error (error, "lvm %s: ", command);
+      goto out;
+    }
+
+  if (!report_parser_process (&parser, TRUE, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (out_fd != -1)
+    (void) close (out_fd);
+  if (pid != 0)
+    {
+      /* Stopped early; don't leave it blocked writing to us */
+      (void) kill (pid, SIGTERM);
+      while (waitpid (pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+    }
+  report_parser_clear (&parser);
+  g_ptr_array_free (argv, TRUE);
+  GLVM_TRACE_END (timer, lvm_report, command);
+  return ret;
+}
@@ -0,0 +1,140 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "glvm.h"
+
+/* Phases are few and named by string literals, so a small array
+ * searched linearly is enough, and keeps them in first-use order for
+ * printing.
+ */
+#define GLVM_MAX_PHASES 32
+
+typedef struct {
+  const char  *phase;
+  guint        count;
+  gint64       total_usec;
+  gint64       max_usec;
+} GlvmPhaseTiming;
+
+static gboolean timings_enabled;
+static GlvmPhaseTiming timings[GLVM_MAX_PHASES];
+static guint n_timings;
+
+/**
+ * glvm_timings_enable:
+ *
+ * Start accumulating per-phase timings in this process.  Until this is
+ * called, timers cost one branch.
+ */
+void
+glvm_timings_enable (void)
+{
+  timings_enabled = TRUE;
+}
+
+void
+glvm_timer_start (GlvmTimer    *timer,
+                  const char   *phase)
+{
+  timer->phase = phase;
+  timer->start = timings_enabled ? g_get_monotonic_time () : 0;
+}
+
+/**
+ * glvm_timings_add:
+ *
+ * Account @usec to @phase, e.g. for time measured in another process.
+ * @phase must stay valid for the life of the process.
+ */
+void
+glvm_timings_add (const char   *phase,
+                  gint64        usec)
+{
+  GlvmPhaseTiming *t = NULL;
+  guint i;
+
+  if (!timings_enabled)
+    return;
+
+  for (i = 0; i < n_timings; i++)
+    {
+      if (strcmp (timings[i].phase, phase) == 0)
+        {
+          t = &timings[i];
+          break;
+        }
+    }
+  if (!t)
+    {
+      if (n_timings == GLVM_MAX_PHASES)
+        return;
+      t = &timings[n_timings++];
+      t->phase = phase;
+    }
+
+  t->count++;
+  t->total_usec += usec;
+  t->max_usec = MAX (t->max_usec, usec);
+}
+
+void
+glvm_timer_stop (GlvmTimer    *timer)
+{
+  gint64 elapsed;
+
+  if (timer->start == 0)
+    return;
+
+  elapsed = g_get_monotonic_time () - timer->start;
+  timer->start = 0;
+  glvm_timings_add (timer->phase, elapsed);
+}
+
+/**
+ * glvm_timings_print:
+ *
+ * Print the accumulated timings to stderr, one line per phase.  Phases
+ * nest (e.g. vg_lock_wait includes the lvm_vg_open retries), so times are
+ * inclusive and do not sum to the total.
+ */
+void
+glvm_timings_print (void)
+{
+  guint i;
+
+  if (!timings_enabled)
+    return;
+
+  g_printerr ("%-20s %8s %12s %12s %12s\n",
+              "phase", "count", "total ms", "avg ms", "max ms");
+  for (i = 0; i < n_timings; i++)
+    {
+      GlvmPhaseTiming *t = &timings[i];
+      g_printerr ("%-20s %8u %12.3f %12.3f %12.3f\n",
+                  t->phase, t->count,
+                  t->total_usec / 1000.0,
+                  t->total_usec / 1000.0 / t->count,
+                  t->max_usec / 1000.0);
+    }
+}
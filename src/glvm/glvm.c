@@ -23,11 +23,11 @@
 #include <gio/gio.h>
 #include <libdevmapper.h>
 #include <lvm2app.h>
-#include <lvm2cmd.h>
 #include <string.h>
 #include <errno.h>
 
 #include "glvm.h"
+#include "glvm-cmd.h"
 #include "libgsystem.h"
 
 void
@@ -71,66 +71,215 @@ glvm_split_lvpath (const char *qualified_name,
   return ret;
 }
 
-gboolean
-glvm_lookup_lv (vg_t            vg,
-                const char     *lvname,
-                lv_t           *out_lv,
-                GCancellable   *cancellable,
-                GError        **error)
+/* Bounds for the jittered exponential backoff on a busy VG lock */
+#define GLVM_LOCK_BACKOFF_MIN_USEC (10 * 1000)
+#define GLVM_LOCK_BACKOFF_MAX_USEC (1000 * 1000)
+
+static gint64 lock_timeout = -1;
+static gint64 lock_wait_total;
+
+/**
+ * glvm_set_lock_timeout:
+ * @timeout_usec: Longest time glvm_vg_open() keeps retrying a busy VG
+ *   lock, or -1 for no limit (the default)
+ */
+void
+glvm_set_lock_timeout (gint64 timeout_usec)
 {
-  gboolean ret = FALSE;
-  lv_t ret_lv = lvm_lv_from_name (vg, lvname);
+  lock_timeout = timeout_usec;
+}
+
+/**
+ * glvm_get_lock_wait:
+ *
+ * Returns: Total time this process has spent in glvm_vg_open() waiting
+ * for busy VG locks since the last glvm_reset_lock_wait()
+ */
+gint64
+glvm_get_lock_wait (void)
+{
+  return lock_wait_total;
+}
+
+void
+glvm_reset_lock_wait (void)
+{
+  lock_wait_total = 0;
+}
 
-  if (ret_lv == NULL)
+/* With wait_for_locks = 0, lvm reports a busy lock as a failure to get
+ * it, and does not set a distinctive errno, so its exact wording is
+ * matched.  The error messages lvm2app keeps are joined by newlines,
+ * and the system call that failed is logged before it, as
+ * "FILE: CALL failed: STRERROR".  Only a flock that would have blocked
+ * means another command holds the lock; failing to open the lock file,
+ * e.g. with EACCES or on a read-only /run/lock, is not worth retrying.
+ */
+#define LVM_LOCK_BUSY_MSG "Can't get lock for "
+#define LVM_FLOCK_FAILED_MSG "flock failed: "
+
+static gboolean
+lock_is_busy (lvm_t lvmh)
+{
+  const char *msg = lvm_errmsg (lvmh);
+  const char *flock_error;
+
+  if (!msg || strstr (msg, LVM_LOCK_BUSY_MSG) == NULL)
+    return FALSE;
+
+  flock_error = strstr (msg, LVM_FLOCK_FAILED_MSG);
+  if (flock_error == NULL)
+    return FALSE;
+  flock_error += strlen (LVM_FLOCK_FAILED_MSG);
+  return g_str_has_prefix (flock_error, g_strerror (EWOULDBLOCK));
+}
+
+static gboolean
+sleep_cancellable (gint64          usec,
+                   GCancellable   *cancellable,
+                   GError        **error)
+{
+  GPollFD pollfd = { -1, G_IO_IN, 0 };
+
+  if (cancellable && g_cancellable_make_pollfd (cancellable, &pollfd))
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
-                   "No such LV '%s/%s'", lvm_vg_get_name (vg), lvname);
-      goto out;
+      (void) g_poll (&pollfd, 1, usec / 1000);
+      g_cancellable_release_fd (cancellable);
     }
+  else
+    g_usleep (usec);
 
-  ret = TRUE;
-  *out_lv = ret_lv;
- out:
-  return ret;
+  return !g_cancellable_set_error_if_cancelled (cancellable, error);
 }
 
-gboolean
-glvm_open_vg_lv (lvm_t           lvmh,
-                 const char     *path,
-                 const char     *mode,
-                 int             flags,
-                 vg_t           *out_vg,
-                 lv_t           *out_lv,
-                 GCancellable   *cancellable,
-                 GError        **error)
+/**
+ * glvm_vg_open:
+ * @out_wait_usec: (out) (allow-none): Time spent waiting for the lock
+ *
+ * Open @vgname, retrying with jittered exponential backoff while its
+ * lock is held by another command, for up to the time given to
+ * glvm_set_lock_timeout().  If the lock is still busy after that, or
+ * at once with %GLVM_VG_OPEN_FLAGS_NO_WAIT, fail with
+ * %G_IO_ERROR_BUSY.  @lvmh must have been configured with
+ * %GLVM_LOCK_NOWAIT_CONFIG; otherwise lvm itself waits for the lock,
+ * without a bound.
+ *
+ * Time spent waiting shows up as the vg_lock_wait phase of the
+ * timings and tracepoints.
+ */
+vg_t
+glvm_vg_open (lvm_t              lvmh,
+              const char        *vgname,
+              const char        *mode,
+              GlvmVgOpenFlags    flags,
+              gint64            *out_wait_usec,
+              GCancellable      *cancellable,
+              GError           **error)
 {
-  gboolean ret = FALSE;
-  lv_t ret_lv = NULL;
-  glvm_cleanup_vg vg_t ret_vg = NULL;
-  gs_free char *vgname = NULL;
-  gs_free char *lvname = NULL;
+  vg_t ret = NULL;
+  gint64 backoff = GLVM_LOCK_BACKOFF_MIN_USEC;
+  gint64 wait_start = 0;
+  GlvmTimer timer;
+  GlvmTimer wait_timer;
 
-  if (!glvm_split_lvpath (path, &vgname, &lvname, error))
-    goto out;
-
-  ret_vg = lvm_vg_open (lvmh, vgname, mode, flags);
-  if (ret_vg == NULL)
+  while (TRUE)
     {
-      glvm_set_error (error, lvmh);
-      goto out;
+      gint64 now;
+      gint64 delay;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      GLVM_TRACE_BEGIN (timer, lvm_vg_open, vgname);
+      ret = lvm_vg_open (lvmh, vgname, mode, 0);
+      GLVM_TRACE_END (timer, lvm_vg_open, vgname);
+      if (ret)
+        break;
+
+      if (!lock_is_busy (lvmh))
+        {
+          glvm_set_error (error, lvmh);
+          goto out;
+        }
+
+      now = g_get_monotonic_time ();
+      if (wait_start == 0)
+        {
+          wait_start = now;
+          GLVM_TRACE_BEGIN (wait_timer, vg_lock_wait, vgname);
+        }
+
+      if ((flags & GLVM_VG_OPEN_FLAGS_NO_WAIT)
+          || (lock_timeout >= 0 && now - wait_start >= lock_timeout))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                       "VG %s is locked by another command", vgname);
+          goto out;
+        }
+
+      /* Sleep between half and all of the backoff, so that waiters
+       * started together do not retry in lockstep.
+       */
+      delay = backoff / 2 + g_random_int_range (0, backoff / 2 + 1);
+      if (lock_timeout >= 0)
+        delay = MIN (delay, wait_start + lock_timeout - now);
+      if (!sleep_cancellable (delay, cancellable, error))
+        goto out;
+      backoff = MIN (backoff * 2, GLVM_LOCK_BACKOFF_MAX_USEC);
     }
 
-  if (!glvm_lookup_lv (ret_vg, lvname, &ret_lv,
-                       cancellable, error))
-    goto out;
-  
-  ret = TRUE;
-  gs_transfer_out_value (out_vg, &ret_vg);
-  gs_transfer_out_value (out_lv, &ret_lv);
  out:
+  if (wait_start != 0)
+    {
+      gint64 waited = g_get_monotonic_time () - wait_start;
+
+      GLVM_TRACE_END (wait_timer, vg_lock_wait, vgname);
+      lock_wait_total += waited;
+      if (out_wait_usec)
+        *out_wait_usec = waited;
+    }
+  else if (out_wait_usec)
+    *out_wait_usec = 0;
   return ret;
 }
 
+static gboolean
+check_property (struct lvm_property_value  *propval,
+                const char                 *propname,
+                GlvmPropType                type,
+                GError                    **error)
+{
+  if (!propval->is_valid)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid LVM property '%s'", propname);
+      return FALSE;
+    }
+
+  switch (type)
+    {
+    case GLVM_PROP_STRING:
+    case GLVM_PROP_STRING_BORROWED:
+      if (!propval->is_string)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                       "LVM property '%s' is not a string", propname);
+          return FALSE;
+        }
+      break;
+    case GLVM_PROP_UINT64:
+      if (!propval->is_integer)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                       "LVM property '%s' is not an integer", propname);
+          return FALSE;
+        }
+      break;
+    }
+
+  return TRUE;
+}
+
 gboolean
 glvm_get_uint64_property (lv_t                  lv,
                           const char           *propname,
@@ -139,20 +288,13 @@ glvm_get_uint64_property (lv_t                  lv,
 {
   gboolean ret = FALSE;
   struct lvm_property_value propval;
+  GlvmTimer timer;
 
+  GLVM_TRACE_BEGIN (timer, lv_property, propname);
   propval = lvm_lv_get_property (lv, propname);
-  if (!propval.is_valid)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
-                   "Invalid LVM property '%s'", propname);
-      goto out;
-    }
-  if (!propval.is_integer)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
-                   "LVM property '%s' is not an integer", propname);
-      goto out;
-    }
+  GLVM_TRACE_END (timer, lv_property, propname);
+  if (!check_property (&propval, propname, GLVM_PROP_UINT64, error))
+    goto out;
 
   ret = TRUE;
   *out_value = propval.value.integer;
@@ -168,62 +310,355 @@ glvm_get_string_property (lv_t                  lv,
 {
   gboolean ret = FALSE;
   struct lvm_property_value propval;
+  GlvmTimer timer;
 
+  GLVM_TRACE_BEGIN (timer, lv_property, propname);
   propval = lvm_lv_get_property (lv, propname);
-  if (!propval.is_valid)
+  GLVM_TRACE_END (timer, lv_property, propname);
+  if (!check_property (&propval, propname, GLVM_PROP_STRING, error))
+    goto out;
+
+  ret = TRUE;
+  *out_value = g_strdup (propval.value.string);
+ out:
+  return ret;
+}
+
+static gboolean
+get_properties (lv_t                  lv,
+                const GlvmPropSpec   *specs,
+                guint                 n_specs,
+                gpointer              dest,
+                GError              **field_errors,
+                GError              **error)
+{
+  guint i;
+  guint n_failed = 0;
+  GError *first_error = NULL;
+
+  for (i = 0; i < n_specs; i++)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
-                   "Invalid LVM property '%s'", propname);
+      const GlvmPropSpec *spec = &specs[i];
+      struct lvm_property_value propval = lvm_lv_get_property (lv, spec->name);
+      gpointer slot = G_STRUCT_MEMBER_P (dest, spec->offset);
+      GError *local_error = NULL;
+      const char *str;
+
+      if (!propval.is_valid && (spec->flags & GLVM_PROP_FLAGS_OPTIONAL))
+        continue;
+
+      if (!check_property (&propval, spec->name, spec->type, &local_error))
+        {
+          n_failed++;
+          if (field_errors)
+            field_errors[i] = local_error;
+          else if (!first_error)
+            first_error = local_error;
+          else
+            g_error_free (local_error);
+          continue;
+        }
+
+      switch (spec->type)
+        {
+        case GLVM_PROP_STRING:
+        case GLVM_PROP_STRING_BORROWED:
+          str = propval.value.string;
+          if (str && !*str && (spec->flags & GLVM_PROP_FLAGS_EMPTY_IS_NULL))
+            str = NULL;
+          if (spec->type == GLVM_PROP_STRING)
+            *(char**)slot = g_strdup (str);
+          else
+            *(const char**)slot = str;
+          break;
+        case GLVM_PROP_UINT64:
+          *(guint64*)slot = propval.value.integer;
+          break;
+        }
+    }
+
+  if (n_failed == 0)
+    return TRUE;
+
+  if (first_error)
+    g_propagate_error (error, first_error);
+  else
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                 "Failed to get %u of %u LVM properties", n_failed, n_specs);
+  return FALSE;
+}
+
+/**
+ * glvm_lv_get_properties:
+ * @specs: Properties to fetch, and where in @dest to store each
+ * @dest: Caller's struct; each slot is written according to its type
+ * @field_errors: (allow-none): Array of @n_specs %NULL-initialized
+ *   errors, set for each property that could not be fetched
+ *
+ * Fetch a set of properties of @lv in one call.  Every property is
+ * attempted even if an earlier one failed.
+ *
+ * Returns: %TRUE if every non-optional property was fetched
+ */
+gboolean
+glvm_lv_get_properties (lv_t                  lv,
+                        const GlvmPropSpec   *specs,
+                        guint                 n_specs,
+                        gpointer              dest,
+                        GError              **field_errors,
+                        GError              **error)
+{
+  gboolean ret;
+  GlvmTimer timer;
+
+  GLVM_TRACE_BEGIN (timer, lv_properties, NULL);
+  ret = get_properties (lv, specs, n_specs, dest,
+                        field_errors, error);
+  GLVM_TRACE_END (timer, lv_properties, NULL);
+  return ret;
+}
+
+/**
+ * glvm_run_command:
+ * @cmdline: An lvm command line, e.g. "lvconvert --merge vg/snap"
+ * @out_output: (out) (allow-none): What the command printed
+ *
+ * Run @cmdline in-process through lvm2cmd, for operations lvm2app
+ * does not expose.  The command's messages become the error message
+ * on failure.  Not thread-safe.
+ */
+gboolean
+glvm_run_command (const char    *cmdline,
+                  char         **out_output,
+                  GError       **error)
+{
+  gboolean ret;
+  char *errmsg = NULL;
+  GlvmTimer timer;
+
+  GLVM_TRACE_BEGIN (timer, lvm_command, cmdline);
+  ret = glvm_cmd_run (cmdline, out_output, &errmsg);
+  GLVM_TRACE_END (timer, lvm_command, cmdline);
+
+  if (!ret)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, errmsg);
+      g_free (errmsg);
+    }
+  return ret;
+}
+
+/**
+ * glvm_dm_get_status:
+ * @out_target_type: (out): Type of the device's first target, e.g. "snapshot-merge"
+ * @out_params: (out): That target's status line
+ *
+ * Read a device-mapper device's status directly from the kernel, which
+ * unlike LVM reporting takes no locks and reads no metadata.
+ */
+gboolean
+glvm_dm_get_status (guint32       major,
+                    guint32       minor,
+                    char        **out_target_type,
+                    char        **out_params,
+                    GError      **error)
+{
+  gboolean ret = FALSE;
+  struct dm_task *dmt;
+  struct dm_info info;
+  uint64_t start, length;
+  char *target_type = NULL;
+  char *params = NULL;
+  GlvmTimer timer;
+
+  GLVM_TRACE_BEGIN (timer, dm_status, NULL);
+
+  dmt = dm_task_create (DM_DEVICE_STATUS);
+  if (!dmt)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Failed to create device-mapper task");
       goto out;
     }
-  if (!propval.is_string)
+
+  if (!dm_task_set_major_minor (dmt, major, minor, 0)
+      || !dm_task_no_flush (dmt)
+      || !dm_task_run (dmt)
+      || !dm_task_get_info (dmt, &info))
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
-                   "LVM property '%s' is not a string", propname);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to query device-mapper status of %u:%u", major, minor);
+      goto out;
+    }
+
+  if (!info.exists)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "No device-mapper device %u:%u", major, minor);
       goto out;
     }
 
+  (void) dm_get_next_target (dmt, NULL, &start, &length, &target_type, &params);
+
   ret = TRUE;
-  *out_value = g_strdup (propval.value.string);
+  *out_target_type = g_strdup (target_type ? target_type : "");
+  *out_params = g_strdup (params ? params : "");
  out:
+  if (dmt)
+    dm_task_destroy (dmt);
+  GLVM_TRACE_END (timer, dm_status, NULL);
   return ret;
 }
 
+void
+glvm_dm_device_free (GlvmDmDevice *dev)
+{
+  g_free (dev->name);
+  g_free (dev);
+}
+
+/**
+ * glvm_dm_list_devices:
+ * @out_devices: (out) (element-type GlvmDmDevice): All device-mapper devices
+ *
+ * One ioctl for the names and numbers of every device-mapper device.
+ */
 gboolean
-glvm_get_lv_majmin (lv_t        lv,
-                    gint       *out_major,
-                    gint       *out_minor,
-                    GError    **error)
+glvm_dm_list_devices (GPtrArray   **out_devices,
+                      GError      **error)
 {
   gboolean ret = FALSE;
-  gs_free char *path = NULL;
-  struct stat stbuf;
-  int res;
+  struct dm_task *dmt;
+  struct dm_names *names;
+  gs_unref_ptrarray GPtrArray *ret_devices = NULL;
+  GlvmTimer timer;
 
-  if (!glvm_get_string_property (lv, "lv_path", &path, error))
-    goto out;
+  GLVM_TRACE_BEGIN (timer, dm_list, NULL);
 
-  do
-    res = stat (path, &stbuf);
-  while (res == -1 && errno == EINTR);
-  if (res < 0)
+  dmt = dm_task_create (DM_DEVICE_LIST);
+  if (!dmt || !dm_task_run (dmt))
     {
-      int errsv = errno;
-      g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
-                           g_strerror (errsv));
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Failed to list device-mapper devices");
       goto out;
     }
-  
-  if (!S_ISBLK (stbuf.st_mode))
+
+  ret_devices = g_ptr_array_new_with_free_func ((GDestroyNotify)glvm_dm_device_free);
+
+  names = dm_task_get_names (dmt);
+  /* An empty list is a single entry with dev == 0 */
+  if (names && names->dev)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
-                   "Not a device: %s", path);
-      goto out;
+      while (TRUE)
+        {
+          GlvmDmDevice *dev = g_new0 (GlvmDmDevice, 1);
+          dev->name = g_strdup (names->name);
+          dev->major = MAJOR (names->dev);
+          dev->minor = MINOR (names->dev);
+          g_ptr_array_add (ret_devices, dev);
+
+          if (!names->next)
+            break;
+          names = (struct dm_names *)((char*)names + names->next);
+        }
     }
-  
+
   ret = TRUE;
-  *out_major = major (stbuf.st_rdev);
-  *out_minor = minor (stbuf.st_rdev);
+  gs_transfer_out_value (out_devices, &ret_devices);
  out:
+  if (dmt)
+    dm_task_destroy (dmt);
+  GLVM_TRACE_END (timer, dm_list, NULL);
   return ret;
 }
+
+/* Copy up to @end, undoubling the '-' LVM doubles in names */
+static char *
+dm_unescape (const char *start,
+             const char *end)
+{
+  GString *buf = g_string_sized_new (end - start);
+
+  while (start < end)
+    {
+      g_string_append_c (buf, *start);
+      start += (start[0] == '-' && start[1] == '-') ? 2 : 1;
+    }
+  return g_string_free (buf, FALSE);
+}
+
+/* Next single '-' at or after @p, or the end of the string */
+static const char *
+dm_next_separator (const char *p)
+{
+  while (*p)
+    {
+      if (p[0] == '-')
+        {
+          if (p[1] != '-')
+            return p;
+          p++;
+        }
+      p++;
+    }
+  return p;
+}
+
+static void
+dm_append_escaped (GString     *buf,
+                   const char  *name)
+{
+  for (; *name; name++)
+    {
+      if (*name == '-')
+        g_string_append_c (buf, '-');
+      g_string_append_c (buf, *name);
+    }
+}
+
+/**
+ * glvm_dm_build_name:
+ *
+ * Returns: The device-mapper name LVM gives to active LV @vgname/@lvname
+ */
+char *
+glvm_dm_build_name (const char   *vgname,
+                    const char   *lvname)
+{
+  GString *buf = g_string_new ("");
+
+  dm_append_escaped (buf, vgname);
+  g_string_append_c (buf, '-');
+  dm_append_escaped (buf, lvname);
+  return g_string_free (buf, FALSE);
+}
+
+/**
+ * glvm_dm_split_name:
+ * @out_layer: (out): Internal layer such as "cow" or "real", or %NULL
+ *
+ * Decode an LVM device-mapper name, "VG-LV[-LAYER]" with any '-'
+ * within the names doubled.
+ *
+ * Returns: %FALSE if @dmname is not of that form
+ */
+gboolean
+glvm_dm_split_name (const char    *dmname,
+                    char         **out_vgname,
+                    char         **out_lvname,
+                    char         **out_layer)
+{
+  const char *vg_end = dm_next_separator (dmname);
+  const char *lv_end;
+
+  if (*vg_end == '\0' || vg_end == dmname)
+    return FALSE;
+  lv_end = dm_next_separator (vg_end + 1);
+  if (lv_end == vg_end + 1)
+    return FALSE;
+
+  *out_vgname = dm_unescape (dmname, vg_end);
+  *out_lvname = dm_unescape (vg_end + 1, lv_end);
+  *out_layer = *lv_end ? g_strdup (lv_end + 1) : NULL;
+  return TRUE;
+}
@@ -22,6 +22,9 @@
 
 #include <gio/gio.h>
 #include <lvm2app.h>
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
 
 G_BEGIN_DECLS
 
@@ -36,20 +39,30 @@ gboolean glvm_split_lvpath (const char *qualified_name,
 			    char      **out_lvname,
 			    GError    **error);
 
-gboolean glvm_lookup_lv (vg_t           vg,
-			 const char    *lvname,
-			 lv_t          *out_lv,
-			 GCancellable  *cancellable,
-			 GError       **error);
-
-gboolean glvm_open_vg_lv (lvm_t           lvmh,
-			  const char     *path,
-			  const char     *mode,
-			  int             flags,
-			  vg_t           *out_vg,
-			  lv_t           *out_lv,
-			  GCancellable   *cancellable,
-			  GError        **error);
+/* lvm_vg_open() only fails on a busy VG lock, rather than blocking in
+ * the kernel, on handles with this configuration; glvm_vg_open() then
+ * retries with backoff.
+ */
+#define GLVM_LOCK_NOWAIT_CONFIG "global { wait_for_locks = 0 }"
+
+typedef enum {
+  GLVM_VG_OPEN_FLAGS_NONE = 0,
+  GLVM_VG_OPEN_FLAGS_NO_WAIT = (1 << 0)   /* Fail with G_IO_ERROR_BUSY at once if the lock is busy */
+} GlvmVgOpenFlags;
+
+void     glvm_set_lock_timeout (gint64 timeout_usec);
+
+gint64   glvm_get_lock_wait (void);
+
+void     glvm_reset_lock_wait (void);
+
+vg_t     glvm_vg_open (lvm_t              lvmh,
+		       const char        *vgname,
+		       const char        *mode,
+		       GlvmVgOpenFlags    flags,
+		       gint64            *out_wait_usec,
+		       GCancellable      *cancellable,
+		       GError           **error);
 
 gboolean glvm_get_string_property (lv_t                  lv,
 				   const char           *propname,
@@ -61,9 +74,113 @@ gboolean glvm_get_uint64_property (lv_t                  lv,
 				   guint64              *out_value,
 				   GError              **error);
 
-gboolean glvm_get_lv_majmin (lv_t        lv,
-			    gint       *out_major,
-			    gint       *out_minor,
-			    GError    **error);
+typedef enum {
+  GLVM_PROP_STRING,           /* char *, newly allocated */
+  GLVM_PROP_STRING_BORROWED,  /* const char *, valid until the VG is closed */
+  GLVM_PROP_UINT64            /* guint64 */
+} GlvmPropType;
+
+typedef enum {
+  GLVM_PROP_FLAGS_NONE = 0,
+  GLVM_PROP_FLAGS_OPTIONAL = (1 << 0),       /* Unknown property leaves the slot untouched */
+  GLVM_PROP_FLAGS_EMPTY_IS_NULL = (1 << 1)   /* Empty string is stored as NULL */
+} GlvmPropFlags;
+
+typedef struct {
+  const char     *name;
+  GlvmPropType    type;
+  GlvmPropFlags   flags;
+  gsize           offset;
+} GlvmPropSpec;
+
+gboolean glvm_lv_get_properties (lv_t                  lv,
+				 const GlvmPropSpec   *specs,
+				 guint                 n_specs,
+				 gpointer              dest,
+				 GError              **field_errors,
+				 GError              **error);
+
+gboolean glvm_run_command (const char    *cmdline,
+			   char         **out_output,
+			   GError       **error);
+
+gboolean glvm_dm_get_status (guint32       major,
+			     guint32       minor,
+			     char        **out_target_type,
+			     char        **out_params,
+			     GError      **error);
+
+typedef struct {
+  char     *name;
+  guint32   major;
+  guint32   minor;
+} GlvmDmDevice;
+
+void     glvm_dm_device_free (GlvmDmDevice *dev);
+
+gboolean glvm_dm_list_devices (GPtrArray   **out_devices,
+			       GError      **error);
+
+char    *glvm_dm_build_name (const char   *vgname,
+			     const char   *lvname);
+
+gboolean glvm_dm_split_name (const char    *dmname,
+			     char         **out_vgname,
+			     char         **out_lvname,
+			     char         **out_layer);
+
+typedef gboolean (*GlvmReportRowFunc) (GHashTable   *row,
+				       gpointer      user_data,
+				       GError      **error);
+
+gboolean glvm_report_run (const char          *command,
+			  const char          *report_name,
+			  const char *const   *fields,
+			  const char          *config,
+			  GlvmReportRowFunc    func,
+			  gpointer             user_data,
+			  GCancellable        *cancellable,
+			  GError             **error);
+
+/* Static tracepoints: each traced operation fires glvm:NAME__entry and
+ * glvm:NAME__return, with @detail (a string, possibly NULL) as the
+ * argument, e.g.
+ *   bpftrace -e 'usdt:/usr/bin/roller-derby:glvm:lvm_vg_open__entry { printf("%s\n", str(arg0)); }'
+ * The same points feed the --timings breakdown.
+ */
+#ifdef HAVE_SYS_SDT_H
+#define GLVM_PROBE(name, detail) DTRACE_PROBE1 (glvm, name, detail)
+#else
+#define GLVM_PROBE(name, detail) G_STMT_START { (void) (detail); } G_STMT_END
+#endif
+
+typedef struct {
+  const char  *phase;
+  gint64       start;
+} GlvmTimer;
+
+void glvm_timings_enable (void);
+
+void glvm_timer_start (GlvmTimer    *timer,
+		       const char   *phase);
+
+void glvm_timer_stop (GlvmTimer    *timer);
+
+void glvm_timings_add (const char   *phase,
+		       gint64        usec);
+
+void glvm_timings_print (void);
+
+#define GLVM_TRACE_BEGIN(timer, name, detail)           \
+  G_STMT_START {                                        \
+    GLVM_PROBE (name##__entry, detail);                 \
+    glvm_timer_start (&(timer), #name);                 \
+  } G_STMT_END
+
+#define GLVM_TRACE_END(timer, name, detail)             \
+  G_STMT_START {                                        \
+    glvm_timer_stop (&(timer));                         \
+    GLVM_PROBE (name##__return, detail);                \
+  } G_STMT_END
 
 G_END_DECLS
@@ -31,8 +31,29 @@ static gboolean handle_opt_version (const gchar    *option_name,
 				    gpointer        data,
 				    GError        **error);
 
+static gboolean opt_no_daemon;
+static char **opt_pvs;
+static gboolean opt_scan_all;
+static gboolean opt_scan_remembered;
+static char *opt_backend;
+static gboolean opt_timings;
+static char **opt_sets;
+static int opt_scan_jobs = RD_INVENTORY_DEFAULT_SCAN_JOBS;
+static int opt_lock_timeout = RD_DEFAULT_LOCK_TIMEOUT_SECS;
+static int opt_worker_timeout = RD_DEFAULT_WORKER_TIMEOUT_SECS;
+
 static GOptionEntry app_options[] = {
   { "version", 0, 0, G_OPTION_ARG_CALLBACK, handle_opt_version, "Show version", NULL },
+  { "no-daemon", 0, 0, G_OPTION_ARG_NONE, &opt_no_daemon, "Do not forward to a running roller-derby daemon", NULL },
+  { "pv", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_pvs, "Only scan DEVICE for LVM metadata (may be given multiple times)", "DEVICE" },
+  { "backend", 0, 0, G_OPTION_ARG_STRING, &opt_backend, "Read the inventory with BACKEND: report (default) or lvm2app", "BACKEND" },
+  { "scan-all", 0, 0, G_OPTION_ARG_NONE, &opt_scan_all, "Scan all block devices, even for the VGs named by add or remove", NULL },
+  { "scan-remembered", 0, 0, G_OPTION_ARG_NONE, &opt_scan_remembered, "Only scan the devices recorded as backing rollback VGs by add, remove and --scan-all runs; misses VGs tagged by other tools since then", NULL },
+  { "scan-jobs", 0, 0, G_OPTION_ARG_INT, &opt_scan_jobs, "With the lvm2app backend, open up to N VGs at once (0 for no limit, default 4)", "N" },
+  { "lock-timeout", 0, 0, G_OPTION_ARG_INT, &opt_lock_timeout, "Give up on a VG locked by another command after SECS (default 60, -1 to wait forever)", "SECS" },
+  { "worker-timeout", 0, 0, G_OPTION_ARG_INT, &opt_worker_timeout, "Kill the worker for a VG that is still running after SECS (default 600, -1 for no limit)", "SECS" },
+  { "set", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_sets, "Work on rollback set NAME, tagged rollback_include.NAME; \"default\" (the default) is plain rollback_include.  May be given multiple times", "NAME" },
+  { "timings", 0, 0, G_OPTION_ARG_NONE, &opt_timings, "Print time spent in each LVM and mount table phase (implies --no-daemon)", NULL },
   { NULL }
 };
 
@@ -40,69 +61,178 @@ struct _RdApp {
   GCancellable *cancellable;
 
   lvm_t lvmh;
-  GHashTable  *mountdata;
+  gboolean lvmh_stale;
+  gboolean scan_configured;
+  gboolean scan_scoped;
+  char **scan_vgs;
+  RdMountTable *mountdata;
+  GPtrArray   *inventory;
+  GPtrArray   *selected;
   GOptionGroup *optgroup;
 };
 
 static RdBuiltin builtins[] = {
-  { "list", rd_builtin_list, 0 },
+  { "list", rd_builtin_list, RD_BUILTIN_FLAG_READONLY | RD_BUILTIN_FLAG_INVENTORY },
   { "add", rd_builtin_add, 0 },
   { "remove", rd_builtin_remove, 0 },
+  { "snapshot", rd_builtin_snapshot, RD_BUILTIN_FLAG_INVENTORY },
+  { "rollback", rd_builtin_rollback, RD_BUILTIN_FLAG_INVENTORY },
+  { "prune", rd_builtin_prune, RD_BUILTIN_FLAG_INVENTORY },
+  { "plan", rd_builtin_plan, RD_BUILTIN_FLAG_READONLY | RD_BUILTIN_FLAG_LOCAL },
+  { "apply", rd_builtin_apply, RD_BUILTIN_FLAG_LOCAL },
+  { "monitor", rd_builtin_monitor, RD_BUILTIN_FLAG_LOCAL },
+  { "daemon", rd_builtin_daemon, RD_BUILTIN_FLAG_LOCAL },
 #if 0
   { "add-vg", rd_builtin_add_vg, 0 },
   { "remove-vg", rd_builtin_remove_vg, 0 },
-  { "snapshot", rd_builtin_snapshot, 0 },
 #endif
   { NULL }
 };
 
 static RdApp *app;
 
-static char **
-parse_file_lines (GFile           *path,
-                  GError         **error)
+/* Decide which devices LVM may scan, once, before the first lvm2app
+ * handle or report.  A scope of named VGs is exact, so it is used
+ * whenever their PVs are known.  The scope of all remembered VGs is
+ * not: a VG only gets remembered by a scan that finds rollback LVs in
+ * it, so one tagged directly with lvchange, or on a newly attached
+ * disk, would go unseen.  That scope is only used if asked for.
+ */
+static void
+configure_scan (RdApp *self)
 {
-  gs_free char *contents;
-  
-  contents = gs_file_load_contents_utf8 (path, NULL, error);
-  if (!contents)
-    return NULL;
-
-  return g_strsplit (contents, "\n", -1);
+  gs_strfreev char **pvs = NULL;
+
+  if (self->scan_configured)
+    return;
+  self->scan_configured = TRUE;
+
+  if (opt_pvs)
+    rd_scan_set_pvs ((const char *const*)opt_pvs);
+  else if (self->scan_scoped && !opt_scan_all
+           && (self->scan_vgs || opt_scan_remembered)
+           && rd_scan_lookup_pvs ((const char *const*)self->scan_vgs, &pvs))
+    rd_scan_set_pvs ((const char *const*)pvs);
 }
 
-static GHashTable *
-parse_mounts_indexed_by_majmin (GError           **error)
+/**
+ * rd_app_get_lvmh:
+ *
+ * Returns: (transfer none): The LVM handle, initialized on first use,
+ * and rescanned on the first use after rd_app_invalidate().
+ * If a scan scope was set, and the PVs backing it are known, only
+ * those devices may be scanned; see configure_scan().
+ */
+lvm_t
+rd_app_get_lvmh (RdApp *self)
 {
-  gs_unref_object GFile *mountinfo = g_file_new_for_path ("/proc/self/mountinfo");
-  GHashTable *ret;
-  char **lines;
-  char **iter;
-
-  lines = parse_file_lines (mountinfo, error);
-  if (!lines)
-    return NULL;
-
-  ret = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_strfreev);
-
-  for (iter = lines; *iter; iter++)
+  if (!self->lvmh)
     {
-      char **components = g_strsplit (*iter, " ", -1);
-      if (g_strv_length (components) < 8)
+      GError *local_error = NULL;
+
+      configure_scan (self);
+      self->lvmh = rd_lvm_open (&local_error);
+      if (local_error)
         {
-          g_strfreev (components);
-          continue;
+          g_printerr ("%s\n", local_error->message);
+          exit (1);
         }
-      g_hash_table_insert (ret, g_strdup (components[2]), components);
     }
+  else if (self->lvmh_stale)
+    (void) lvm_scan (self->lvmh);
+  self->lvmh_stale = FALSE;
 
-  return ret;
+  return self->lvmh;
 }
 
-lvm_t
-rd_app_get_lvmh (RdApp *app)
+/* The report backend runs lvm itself and needs no handle */
+static lvm_t
+get_inventory_lvmh (RdApp *self)
 {
-  return app->lvmh;
+  configure_scan (self);
+  if (rd_inventory_get_backend () == RD_INVENTORY_BACKEND_LVM2APP)
+    return rd_app_get_lvmh (self);
+  return NULL;
+}
+
+/**
+ * rd_app_set_scan_scope:
+ * @vgnames: (allow-none): VGs the builtin will use, or %NULL for all
+ * VGs known to contain rollback LVs
+ *
+ * A %NULL scope only applies with --scan-remembered.  Has no effect
+ * once LVM has been used, e.g. for requests served by the daemon.
+ */
+void
+rd_app_set_scan_scope (RdApp              *self,
+                       const char *const  *vgnames)
+{
+  if (self->scan_configured)
+    return;
+
+  self->scan_scoped = TRUE;
+  g_strfreev (self->scan_vgs);
+  self->scan_vgs = g_strdupv ((char**)vgnames);
+}
+
+/**
+ * rd_app_remember_vgs:
+ *
+ * Record the PVs backing @vgnames for use by later scoped scans; if
+ * @replace, forget all other VGs.  A scoped scan only saw some VGs,
+ * so it never forgets the others.  Failure only costs a slower scan
+ * next time, so it is not reported.
+ */
+void
+rd_app_remember_vgs (RdApp              *self,
+                     const char *const  *vgnames,
+                     gboolean            replace)
+{
+  if (!self->scan_configured)
+    return;
+
+  (void) rd_scan_remember_vgs (self->lvmh, vgnames,
+                               replace && !rd_scan_is_scoped (), NULL);
+}
+
+/* Refreshing what is remembered costs another pass over LVM, and only
+ * --scan-remembered reads it, so inventory runs only do so when asked
+ * to with either scan option; add and remove always record their VGs.
+ */
+static void
+remember_record_vgs (RdApp        *self,
+                     GHashTable   *vgnames)
+{
+  gs_unref_ptrarray GPtrArray *strv = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer key;
+
+  if (!(opt_scan_all || opt_scan_remembered))
+    return;
+
+  g_hash_table_iter_init (&iter, vgnames);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (strv, key);
+  g_ptr_array_add (strv, NULL);
+
+  rd_app_remember_vgs (self, (const char *const*)strv->pdata, TRUE);
+}
+
+/* Global options may also follow the builtin name, so --set is
+ * applied whenever a context including them is parsed.
+ */
+static gboolean
+post_parse_options (GOptionContext  *context,
+                    GOptionGroup    *group,
+                    gpointer         data,
+                    GError         **error)
+{
+  RdApp *self = data;
+
+  if (!rd_sets_select ((const char *const*)opt_sets, error))
+    return FALSE;
+  g_clear_pointer (&self->selected, g_ptr_array_unref);
+  return TRUE;
 }
 
 GOptionGroup *
@@ -112,19 +242,21 @@ rd_app_get_options (RdApp *app)
     {
       app->optgroup = g_option_group_new ("roller-derby",
                                           "Options for roller-derby",
-                                          "Show all roller-derby options", NULL, NULL);
+                                          "Show all roller-derby options", app, NULL);
       g_option_group_add_entries (app->optgroup, app_options);
+      g_option_group_set_parse_hooks (app->optgroup, NULL, post_parse_options);
     }
   return app->optgroup;
 }
 
-GHashTable *
+RdMountTable *
 rd_app_get_mounts (RdApp   *self)
 {
   if (!self->mountdata)
     {
       GError *local_error = NULL;
-      self->mountdata = parse_mounts_indexed_by_majmin (&local_error);
+      self->mountdata = rd_mount_table_new_from_file ("/proc/self/mountinfo",
+                                                      &local_error);
       if (local_error)
         {
           g_printerr ("Internal Error: %s\n", local_error->message);
@@ -135,6 +267,131 @@ rd_app_get_mounts (RdApp   *self)
   return self->mountdata;
 }
 
+/**
+ * rd_app_get_inventory:
+ *
+ * Returns: (transfer none): The #RdLvRecord set for all LVs in the
+ * selected rollback sets.  LVs in every set are scanned on first use
+ * and cached for the lifetime of @self, so a daemon's inventory serves
+ * requests for any set.
+ */
+GPtrArray *
+rd_app_get_inventory (RdApp         *self,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  guint i;
+
+  if (!self->inventory)
+    {
+      gs_unref_hashtable GHashTable *vgnames = g_hash_table_new (g_str_hash, g_str_equal);
+
+      if (!rd_inventory_scan (get_inventory_lvmh (self), rd_app_get_mounts (self),
+                              &self->inventory, cancellable, error))
+        return NULL;
+
+      for (i = 0; i < self->inventory->len; i++)
+        {
+          RdLvRecord *rec = self->inventory->pdata[i];
+          g_hash_table_add (vgnames, rec->vgname);
+        }
+      remember_record_vgs (self, vgnames);
+      g_clear_pointer (&self->selected, g_ptr_array_unref);
+    }
+
+  if (!self->selected)
+    {
+      self->selected = g_ptr_array_new ();
+      for (i = 0; i < self->inventory->len; i++)
+        {
+          RdLvRecord *rec = self->inventory->pdata[i];
+          if (rd_sets_is_selected (rec->sets))
+            g_ptr_array_add (self->selected, rec);
+        }
+    }
+
+  return self->selected;
+}
+
+typedef struct {
+  RdLvRecordFunc   func;
+  gpointer         user_data;
+  GHashTable      *vgnames;
+} ForeachData;
+
+static gboolean
+foreach_collect_vgname (RdLvRecord   *rec,
+                        gpointer      user_data,
+                        GError      **error)
+{
+  ForeachData *data = user_data;
+
+  if (!g_hash_table_contains (data->vgnames, rec->vgname))
+    g_hash_table_add (data->vgnames, g_strdup (rec->vgname));
+  if (!rd_sets_is_selected (rec->sets))
+    return TRUE;
+  return data->func (rec, data->user_data, error);
+}
+
+/**
+ * rd_app_foreach_lv:
+ *
+ * Call @func for every LV in the selected rollback sets.  Uses the cached
+ * inventory if there is one; otherwise records are streamed from the
+ * scan as they are built, without being cached.
+ */
+gboolean
+rd_app_foreach_lv (RdApp           *self,
+                   RdLvRecordFunc   func,
+                   gpointer         user_data,
+                   GCancellable    *cancellable,
+                   GError         **error)
+{
+  guint i;
+
+  if (!self->inventory)
+    {
+      gs_unref_hashtable GHashTable *vgnames =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      ForeachData data = { func, user_data, vgnames };
+
+      if (!rd_inventory_foreach (get_inventory_lvmh (self), rd_app_get_mounts (self),
+                                 foreach_collect_vgname, &data, cancellable, error))
+        return FALSE;
+
+      remember_record_vgs (self, vgnames);
+      return TRUE;
+    }
+
+  for (i = 0; i < self->inventory->len; i++)
+    {
+      RdLvRecord *rec = self->inventory->pdata[i];
+      if (!rd_sets_is_selected (rec->sets))
+        continue;
+      if (!func (rec, user_data, error))
+        return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+ * rd_app_invalidate:
+ *
+ * Drop the cached inventory, and if @mounts is %TRUE the mount table,
+ * so they are rebuilt on next use.  The LVM handle's view of devices
+ * is refreshed too, e.g. for a PV added since the daemon started.
+ */
+void
+rd_app_invalidate (RdApp     *self,
+                   gboolean   mounts)
+{
+  g_clear_pointer (&self->selected, g_ptr_array_unref);
+  g_clear_pointer (&self->inventory, g_ptr_array_unref);
+  self->lvmh_stale = TRUE;
+  if (mounts)
+    g_clear_pointer (&self->mountdata, rd_mount_table_free);
+}
+
 static void
 usage (void) G_GNUC_NORETURN;
 
@@ -152,6 +409,124 @@ usage (void)
   exit (1);
 }
 
+RdBuiltin *
+rd_app_lookup_builtin (const char *name)
+{
+  RdBuiltin *biter = builtins;
+
+  while (biter->name && strcmp (name, biter->name) != 0)
+    biter++;
+
+  return biter->name ? biter : NULL;
+}
+
+/**
+ * rd_app_parse_builtin:
+ *
+ * Parse the global options out of @argv, and find the builtin named
+ * by the first remaining argument.  Exits with a usage message if
+ * there is none.
+ */
+RdBuiltin *
+rd_app_parse_builtin (RdApp          *self,
+                      int            *argc,
+                      char         ***argv,
+                      GError        **error)
+{
+  GOptionContext *context;
+  RdBuiltin *builtin;
+
+  context = g_option_context_new ("Manage LVM rollback state");
+  g_option_context_add_group (context, rd_app_get_options (self));
+  /* Builtin options are parsed by the builtin */
+  g_option_context_set_ignore_unknown_options (context, TRUE);
+
+  if (!g_option_context_parse (context, argc, argv, error))
+    return NULL;
+
+  if (*argc < 2)
+    usage ();
+
+  builtin = rd_app_lookup_builtin ((*argv)[1]);
+  if (!builtin)
+    usage ();
+
+  return builtin;
+}
+
+/**
+ * rd_app_reset_options:
+ *
+ * Put the global option variables back to their defaults, for the
+ * daemon to parse each request's options from scratch.
+ */
+void
+rd_app_reset_options (RdApp *self)
+{
+  opt_no_daemon = FALSE;
+  g_clear_pointer (&opt_pvs, g_strfreev);
+  opt_scan_all = FALSE;
+  opt_scan_remembered = FALSE;
+  g_clear_pointer (&opt_backend, g_free);
+  opt_timings = FALSE;
+  g_clear_pointer (&opt_sets, g_strfreev);
+  opt_scan_jobs = RD_INVENTORY_DEFAULT_SCAN_JOBS;
+  opt_lock_timeout = RD_DEFAULT_LOCK_TIMEOUT_SECS;
+  opt_worker_timeout = RD_DEFAULT_WORKER_TIMEOUT_SECS;
+}
+
+/**
+ * rd_app_apply_options:
+ *
+ * Check the global options parsed by rd_app_parse_builtin(), and pass
+ * them on to the inventory, glvm and worker settings they control.
+ */
+gboolean
+rd_app_apply_options (RdApp    *self,
+                      GError  **error)
+{
+  gboolean ret = FALSE;
+
+  if (opt_backend == NULL || strcmp (opt_backend, "report") == 0)
+    rd_inventory_set_backend (RD_INVENTORY_BACKEND_REPORT);
+  else if (strcmp (opt_backend, "lvm2app") == 0)
+    rd_inventory_set_backend (RD_INVENTORY_BACKEND_LVM2APP);
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unknown backend '%s'", opt_backend);
+      goto out;
+    }
+
+  if (opt_scan_jobs < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --scan-jobs %d", opt_scan_jobs);
+      goto out;
+    }
+  rd_inventory_set_scan_jobs (opt_scan_jobs);
+
+  if (opt_lock_timeout < -1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --lock-timeout %d", opt_lock_timeout);
+      goto out;
+    }
+  glvm_set_lock_timeout (opt_lock_timeout < 0 ? -1 : (gint64)opt_lock_timeout * G_USEC_PER_SEC);
+
+  if (opt_worker_timeout < -1 || opt_worker_timeout == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --worker-timeout %d", opt_worker_timeout);
+      goto out;
+    }
+  rd_set_vg_worker_timeout (opt_worker_timeout < 0 ? -1 : (gint64)opt_worker_timeout * G_USEC_PER_SEC);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 handle_opt_version (const gchar    *option_name,
                     const gchar    *value,
@@ -170,10 +545,10 @@ main (int    argc,
   GError *local_error = NULL;
   GError **error = &local_error;
   RdApp appstruct;
-  gs_unref_ptrarray GPtrArray *names = NULL;
-  GOptionContext *context;
-  RdBuiltin *biter = builtins;
-  const char *builtin_name;
+  RdBuiltin *biter;
+  GlvmTimer timer = { NULL, 0 };
+  gs_strfreev char **orig_argv = g_strdupv (argv);
+  int orig_argc = argc;
 
   /* http://bugzilla.gnome.org/show_bug.cgi?id=526454 */
   g_setenv ("GIO_USE_VFS", "local", TRUE);
@@ -183,37 +558,56 @@ main (int    argc,
   memset (&appstruct, 0, sizeof (appstruct));
   app = &appstruct;
 
-  context = g_option_context_new ("Manage LVM rollback state");
-  g_option_context_add_group (context, rd_app_get_options (app));
-
-  if (!g_option_context_parse (context, &argc, &argv, error))
+  biter = rd_app_parse_builtin (app, &argc, &argv, error);
+  if (!biter)
     goto out;
 
-  if (argc < 2)
-    usage ();
-
-  builtin_name = argv[1];
-  while (biter->name && strcmp (builtin_name, biter->name) != 0)
-    biter++;
-
-  if (!biter->name)
-    usage ();
-
-  app->lvmh = lvm_init (NULL);
-  if (!app->lvmh)
+  /* If a daemon is running, it has a warm lvm handle and inventory;
+   * hand it the original command line and relay its output.
+   */
+  if (!(opt_no_daemon || opt_timings || (biter->flags & RD_BUILTIN_FLAG_LOCAL)))
     {
-      glvm_set_error (error, app->lvmh);
-      goto out;
+      int exit_status;
+      if (rd_daemon_client_run (orig_argc - 1, orig_argv + 1, &exit_status))
+        return exit_status;
     }
 
-  if (!biter->func (argc - 2, argv + 2, app, cancellable, error))
+  if (!rd_app_apply_options (app, error))
+    goto out;
+
+  /* Builtins working on the whole inventory only need the devices
+   * backing VGs that have rollback LVs, which --scan-remembered trusts
+   * the last full scan for; no devices are scanned at all until a
+   * builtin asks for the LVM handle.
+   */
+  if (biter->flags & RD_BUILTIN_FLAG_INVENTORY)
+    rd_app_set_scan_scope (app, NULL);
+  /* ...and read-only ones need not wait for VG locks */
+  if (biter->flags & RD_BUILTIN_FLAG_READONLY)
+    rd_scan_set_readonly (TRUE);
+
+  if (opt_timings)
+    glvm_timings_enable ();
+
+  glvm_timer_start (&timer, biter->name);
+  if (!biter->func (argc - 1, argv + 1, app, cancellable, error))
     goto out;
   
  out:
+  if (opt_timings)
+    {
+      glvm_timer_stop (&timer);
+      glvm_timings_print ();
+    }
   if (app->lvmh)
     lvm_quit (app->lvmh);
+  if (app->selected)
+    g_ptr_array_unref (app->selected);
+  if (app->inventory)
+    g_ptr_array_unref (app->inventory);
   if (app->mountdata)
-    g_hash_table_unref (app->mountdata);
+    rd_mount_table_free (app->mountdata);
+  g_strfreev (app->scan_vgs);
   if (local_error != NULL)
     {
       g_printerr ("%s\n", local_error->message);
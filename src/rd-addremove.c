@@ -26,43 +26,292 @@
 #include "rd.h"
 #include "libgsystem.h"
 
-gboolean
-rd_tag_one_lv (lvm_t              lvmh,
-               const char        *path,
-               gboolean           do_tag,
-               GCancellable      *cancellable,
-               GError           **error)
+static gboolean
+lvname_is_pattern (const char *lvname)
 {
-  gboolean ret = FALSE;
-  gs_free char *vgname = NULL;
-  gs_free char *lvname = NULL;
+  return strpbrk (lvname, "*?") != NULL;
+}
+
+static void
+report_lv_error (guint        *n_failed,
+                 const char   *vgname,
+                 const char   *lvname,
+                 const char   *message)
+{
+  g_printerr ("%s/%s: %s\n", vgname, lvname, message);
+  (*n_failed)++;
+}
+
+static void
+tag_one_lv (lvm_t               lvmh,
+            const char         *vgname,
+            lv_t                lv,
+            const char *const  *tags,
+            gboolean            do_tag,
+            GHashTable         *seen,
+            GPtrArray          *changed,
+            guint              *n_failed)
+{
+  const char *name = lvm_lv_get_name (lv);
+  const char *const *iter;
+  int res = 0;
+
+  if (g_hash_table_contains (seen, name))
+    return;
+  g_hash_table_add (seen, (char*)name);
+
+  /* One tag per selected rollback set */
+  for (iter = tags; *iter && res != -1; iter++)
+    {
+      if (do_tag)
+        res = lvm_lv_add_tag (lv, *iter);
+      else
+        res = lvm_lv_remove_tag (lv, *iter);
+    }
+
+  if (res == -1)
+    report_lv_error (n_failed, vgname, name, g_strerror (lvm_errno (lvmh)));
+  else
+    g_ptr_array_add (changed, (char*)name);
+}
+
+/*
+ * Apply the tag change to every LV in @vgname matched by one of
+ * @lvnames, then commit the VG metadata once.  Failures are reported
+ * per LV and counted in @n_failed; only a failure to open or write the
+ * VG affects more than one LV.
+ *
+ * Returns: %FALSE if @open_flags has %GLVM_VG_OPEN_FLAGS_NO_WAIT and
+ * the VG lock was busy, in which case nothing was done or reported
+ */
+static gboolean
+tag_lvs_in_vg (lvm_t               lvmh,
+               const char         *vgname,
+               GPtrArray          *lvnames,
+               const char *const  *tags,
+               gboolean            do_tag,
+               GlvmVgOpenFlags     open_flags,
+               GCancellable       *cancellable,
+               guint              *n_failed)
+{
+  guint i;
   glvm_cleanup_vg vg_t vg = NULL;
-  lv_t lv;
+  gs_unref_ptrarray GPtrArray *changed = g_ptr_array_new ();
+  gs_unref_hashtable GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+  GError *local_error = NULL;
+  gint64 lock_wait;
+  GlvmTimer timer;
+  int res;
 
-  if (!glvm_open_vg_lv (lvmh, path, "w", 0, &vg, &lv,
-                        cancellable, error))
-    goto out;
+  vg = glvm_vg_open (lvmh, vgname, "w", open_flags, &lock_wait,
+                     cancellable, &local_error);
+  if (vg == NULL)
+    {
+      if ((open_flags & GLVM_VG_OPEN_FLAGS_NO_WAIT)
+          && g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_BUSY))
+        {
+          g_error_free (local_error);
+          return FALSE;
+        }
+      for (i = 0; i < lvnames->len; i++)
+        report_lv_error (n_failed, vgname, lvnames->pdata[i], local_error->message);
+      g_error_free (local_error);
+      return TRUE;
+    }
+
+  if (lock_wait > 0)
+    g_print ("Waited %.1f ms for the lock on VG %s\n", lock_wait / 1000.0, vgname);
 
-  if (do_tag)
+  for (i = 0; i < lvnames->len; i++)
     {
-      if (lvm_lv_add_tag (lv, "rollback_include") == -1)
+      const char *lvname = lvnames->pdata[i];
+
+      if (lvname_is_pattern (lvname))
+        {
+          GPatternSpec *pattern = g_pattern_spec_new (lvname);
+          struct dm_list *lvs = lvm_vg_list_lvs (vg);
+          struct lvm_lv_list *lvsl;
+          gboolean matched = FALSE;
+
+          /* NULL for a VG with no LVs.  The list must be fetched once:
+           * the iteration macro evaluates its head on every test, and
+           * each call allocates a new list.
+           */
+          if (lvs)
+            {
+              dm_list_iterate_items (lvsl, lvs)
+                {
+                  if (!g_pattern_match_string (pattern, lvm_lv_get_name (lvsl->lv))
+                      || !rd_lv_is_selectable (lvsl->lv))
+                    continue;
+                  matched = TRUE;
+                  tag_one_lv (lvmh, vgname, lvsl->lv, tags, do_tag,
+                              seen, changed, n_failed);
+                }
+            }
+          g_pattern_spec_free (pattern);
+
+          if (!matched)
+            report_lv_error (n_failed, vgname, lvname, "No matching LVs");
+        }
+      else
         {
-          glvm_set_error (error, lvmh);
-          goto out;
+          lv_t lv = lvm_lv_from_name (vg, lvname);
+
+          if (lv == NULL)
+            report_lv_error (n_failed, vgname, lvname, "No such LV");
+          else
+            tag_one_lv (lvmh, vgname, lv, tags, do_tag,
+                        seen, changed, n_failed);
         }
     }
-  else
+
+  if (changed->len == 0)
+    return TRUE;
+
+  GLVM_TRACE_BEGIN (timer, lvm_vg_write, vgname);
+  res = lvm_vg_write (vg);
+  GLVM_TRACE_END (timer, lvm_vg_write, vgname);
+  if (res == -1)
+    {
+      const char *msg = g_strerror (lvm_errno (lvmh));
+      for (i = 0; i < changed->len; i++)
+        report_lv_error (n_failed, vgname, changed->pdata[i], msg);
+      return TRUE;
+    }
+
+  for (i = 0; i < changed->len; i++)
+    {
+      if (do_tag)
+        g_print ("Added %s/%s to rollback\n", vgname, (char*)changed->pdata[i]);
+      else
+        g_print ("Removed %s/%s from rollback\n", vgname, (char*)changed->pdata[i]);
+    }
+  return TRUE;
+}
+
+/**
+ * rd_lvpaths_get_vgnames:
+ *
+ * Returns: (transfer full): The distinct VG names in @paths, skipping
+ * invalid ones (rd_tag_lvs() reports those).
+ */
+char **
+rd_lvpaths_get_vgnames (int      n_paths,
+                        char   **paths)
+{
+  GPtrArray *ret = g_ptr_array_new ();
+  int i;
+  guint j;
+
+  for (i = 0; i < n_paths; i++)
     {
-      if (lvm_lv_remove_tag (lv, "rollback_include") == -1)
+      const char *slash = strchr (paths[i], '/');
+      gboolean seen = FALSE;
+
+      if (!slash)
+        continue;
+
+      for (j = 0; j < ret->len && !seen; j++)
         {
-          glvm_set_error (error, lvmh);
-          goto out;
+          const char *vgname = ret->pdata[j];
+          seen = strlen (vgname) == (gsize)(slash - paths[i])
+            && strncmp (vgname, paths[i], slash - paths[i]) == 0;
         }
+      if (!seen)
+        g_ptr_array_add (ret, g_strndup (paths[i], slash - paths[i]));
     }
- 
-  if (lvm_vg_write (vg) == -1)
+  g_ptr_array_add (ret, NULL);
+
+  return (char**)g_ptr_array_free (ret, FALSE);
+}
+
+/**
+ * rd_tag_lvs:
+ *
+ * Add or remove the tags of the selected rollback sets (see
+ * rd_sets_select()) on every LV named in @paths, which are of the
+ * form VGNAME/LVNAME; LVNAME may be a glob such as "*".
+ * Targets are grouped by VG so each VG is opened and written exactly
+ * once.  VGs whose lock is free are done first; those held by another
+ * command are then waited for in turn, per glvm_vg_open().  A failure
+ * on one LV is reported and does not stop the rest of the batch; if
+ * anything failed, %FALSE is returned at the end.
+ */
+gboolean
+rd_tag_lvs (lvm_t              lvmh,
+            int                n_paths,
+            char             **paths,
+            gboolean           do_tag,
+            GCancellable      *cancellable,
+            GError           **error)
+{
+  gboolean ret = FALSE;
+  int i;
+  guint n_failed = 0;
+  gs_strfreev char **tags = rd_sets_get_tags ();
+  gs_unref_ptrarray GPtrArray *vg_order = g_ptr_array_new ();
+  gs_unref_ptrarray GPtrArray *busy = g_ptr_array_new ();
+  gs_unref_hashtable GHashTable *vg_targets =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                           (GDestroyNotify)g_ptr_array_unref);
+
+  for (i = 0; i < n_paths; i++)
+    {
+      GError *local_error = NULL;
+      char *vgname;
+      char *lvname;
+      GPtrArray *lvnames;
+
+      if (!glvm_split_lvpath (paths[i], &vgname, &lvname, &local_error))
+        {
+          g_printerr ("%s\n", local_error->message);
+          g_error_free (local_error);
+          n_failed++;
+          continue;
+        }
+
+      lvnames = g_hash_table_lookup (vg_targets, vgname);
+      if (!lvnames)
+        {
+          lvnames = g_ptr_array_new_with_free_func (g_free);
+          g_hash_table_insert (vg_targets, vgname, lvnames);
+          g_ptr_array_add (vg_order, vgname);
+        }
+      else
+        g_free (vgname);
+      g_ptr_array_add (lvnames, lvname);
+    }
+
+  for (i = 0; i < vg_order->len; i++)
+    {
+      const char *vgname = vg_order->pdata[i];
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      if (!tag_lvs_in_vg (lvmh, vgname, g_hash_table_lookup (vg_targets, vgname),
+                          (const char *const*)tags, do_tag, GLVM_VG_OPEN_FLAGS_NO_WAIT,
+                          cancellable, &n_failed))
+        g_ptr_array_add (busy, (char*)vgname);
+    }
+
+  for (i = 0; i < busy->len; i++)
+    {
+      const char *vgname = busy->pdata[i];
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      (void) tag_lvs_in_vg (lvmh, vgname, g_hash_table_lookup (vg_targets, vgname),
+                            (const char *const*)tags, do_tag, GLVM_VG_OPEN_FLAGS_NONE,
+                            cancellable, &n_failed);
+    }
+
+  if (n_failed > 0)
     {
-      glvm_set_error (error, lvmh);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to update %u LV(s)", n_failed);
       goto out;
     }
 
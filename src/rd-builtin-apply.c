@@ -0,0 +1,380 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+typedef struct {
+  GHashTable  *plans_by_vg;     /* VG name -> its element of the plan */
+} ApplyData;
+
+static gboolean
+is_tag_op (const char *kind)
+{
+  return strcmp (kind, RD_PLAN_OP_TAG) == 0 || strcmp (kind, RD_PLAN_OP_UNTAG) == 0;
+}
+
+/* Run @cmdline, which acts on every op in @indices, recording its
+ * failure against each of them.
+ */
+static void
+run_batch (GString     *cmdline,
+           GArray      *indices,
+           char       **errmsgs)
+{
+  GError *local_error = NULL;
+  guint i;
+
+  if (indices->len == 0)
+    return;
+
+  if (!glvm_run_command (cmdline->str, NULL, &local_error))
+    {
+      for (i = 0; i < indices->len; i++)
+        errmsgs[g_array_index (indices, guint, i)] = g_strdup (local_error->message);
+      g_error_free (local_error);
+    }
+}
+
+/* Runs in a worker process, one per VG.  Tag changes and snapshots
+ * are made with the VG open once: each lvm_lv_snapshot() commits the
+ * metadata, taking pending tag changes with it, so an explicit
+ * lvm_vg_write() is only needed when there are tag changes and no
+ * snapshot.  Removals and merges then each run as one command for
+ * the whole VG.  Nothing is done if the VG has changed since the
+ * plan was made.
+ *
+ * Returns (as): an error message for each operation of the VG's plan,
+ * in order; empty on success.
+ */
+static gboolean
+apply_vg (RdVgWorker        *worker,
+          lvm_t              lvmh,
+          const char        *vgname,
+          gpointer           user_data,
+          GVariant         **out_result,
+          GCancellable      *cancellable,
+          GError           **error)
+{
+  gboolean ret = FALSE;
+  ApplyData *data = user_data;
+  GVariant *vg_plan = g_hash_table_lookup (data->plans_by_vg, vgname);
+  gs_unref_variant GVariant *ops = NULL;
+  glvm_cleanup_vg vg_t vg = NULL;
+  GArray *uncommitted = g_array_new (FALSE, FALSE, sizeof (guint));
+  GArray *removes = g_array_new (FALSE, FALSE, sizeof (guint));
+  GArray *merges = g_array_new (FALSE, FALSE, sizeof (guint));
+  GString *remove_cmd = g_string_new ("lvremove --force");
+  GString *merge_cmd = g_string_new ("lvconvert --merge --background");
+  char **errmsgs = NULL;
+  guint n_ops;
+  guint n_metadata = 0;
+  guint64 seqno;
+  GVariantIter iter;
+  const char *kind;
+  const char *lvname;
+  const char *arg;
+  guint64 size;
+  GlvmTimer timer;
+  guint i;
+
+  g_variant_get (vg_plan, "(&st@a" RD_PLAN_OP_TYPE ")", NULL, &seqno, &ops);
+  n_ops = g_variant_n_children (ops);
+  errmsgs = g_new0 (char *, n_ops + 1);
+
+  g_variant_iter_init (&iter, ops);
+  while (g_variant_iter_next (&iter, "(&s&s&st)", &kind, &lvname, &arg, &size))
+    {
+      if (is_tag_op (kind) || strcmp (kind, RD_PLAN_OP_SNAPSHOT) == 0)
+        n_metadata++;
+      else if (strcmp (kind, RD_PLAN_OP_REMOVE) != 0
+               && strcmp (kind, RD_PLAN_OP_MERGE) != 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Unknown operation '%s' in plan", kind);
+          goto out;
+        }
+    }
+
+  /* Even with nothing to change through lvm2app, the VG is opened to
+   * check that the plan still applies.
+   */
+  vg = glvm_vg_open (lvmh, vgname, n_metadata > 0 ? "w" : "r",
+                     GLVM_VG_OPEN_FLAGS_NONE, NULL, cancellable, error);
+  if (vg == NULL)
+    goto out;
+
+  if (lvm_vg_get_seqno (vg) != seqno)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Changed since the plan was made (seqno %" G_GUINT64_FORMAT
+                   ", planned %" G_GUINT64_FORMAT "); make a new plan",
+                   (guint64)lvm_vg_get_seqno (vg), seqno);
+      goto out;
+    }
+
+  i = 0;
+  g_variant_iter_init (&iter, ops);
+  while (g_variant_iter_next (&iter, "(&s&s&st)", &kind, &lvname, &arg, &size))
+    {
+      lv_t lv = NULL;
+
+      if (strcmp (kind, RD_PLAN_OP_REMOVE) == 0)
+        {
+          g_string_append_printf (remove_cmd, " %s/%s", vgname, lvname);
+          g_array_append_val (removes, i);
+        }
+      else if (strcmp (kind, RD_PLAN_OP_MERGE) == 0)
+        {
+          g_string_append_printf (merge_cmd, " %s/%s", vgname, lvname);
+          g_array_append_val (merges, i);
+        }
+      else if ((lv = lvm_lv_from_name (vg, lvname)) == NULL)
+        errmsgs[i] = g_strdup ("No such LV");
+      else if (strcmp (kind, RD_PLAN_OP_SNAPSHOT) == 0)
+        {
+          if (lvm_lv_snapshot (lv, arg, size) == NULL)
+            errmsgs[i] = g_strdup (g_strerror (lvm_errno (lvmh)));
+          else
+            g_array_set_size (uncommitted, 0);
+        }
+      else
+        {
+          int res;
+
+          if (strcmp (kind, RD_PLAN_OP_TAG) == 0)
+            res = lvm_lv_add_tag (lv, arg);
+          else
+            res = lvm_lv_remove_tag (lv, arg);
+          if (res == -1)
+            errmsgs[i] = g_strdup (g_strerror (lvm_errno (lvmh)));
+          else
+            g_array_append_val (uncommitted, i);
+        }
+      i++;
+    }
+
+  if (uncommitted->len > 0)
+    {
+      int res;
+
+      GLVM_TRACE_BEGIN (timer, lvm_vg_write, vgname);
+      res = lvm_vg_write (vg);
+      GLVM_TRACE_END (timer, lvm_vg_write, vgname);
+      if (res == -1)
+        {
+          for (i = 0; i < uncommitted->len; i++)
+            errmsgs[g_array_index (uncommitted, guint, i)] =
+              g_strdup (g_strerror (lvm_errno (lvmh)));
+        }
+    }
+
+  /* lvremove and lvconvert take the VG lock themselves */
+  lvm_vg_close (vg);
+  vg = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+  run_batch (remove_cmd, removes, errmsgs);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+  run_batch (merge_cmd, merges, errmsgs);
+
+  for (i = 0; i < n_ops; i++)
+    {
+      if (!errmsgs[i])
+        errmsgs[i] = g_strdup ("");
+    }
+
+  ret = TRUE;
+  *out_result = g_variant_new_strv ((const char *const*)errmsgs, n_ops);
+ out:
+  g_strfreev (errmsgs);
+  g_array_unref (uncommitted);
+  g_array_unref (removes);
+  g_array_unref (merges);
+  g_string_free (remove_cmd, TRUE);
+  g_string_free (merge_cmd, TRUE);
+  return ret;
+}
+
+static void
+print_op (const char   *vgname,
+          const char   *kind,
+          const char   *lvname,
+          const char   *arg)
+{
+  if (strcmp (kind, RD_PLAN_OP_TAG) == 0)
+    g_print ("Added %s/%s to rollback (%s)\n", vgname, lvname, arg);
+  else if (strcmp (kind, RD_PLAN_OP_UNTAG) == 0)
+    g_print ("Removed %s/%s from rollback (%s)\n", vgname, lvname, arg);
+  else if (strcmp (kind, RD_PLAN_OP_SNAPSHOT) == 0)
+    g_print ("Created snapshot %s/%s of %s/%s\n", vgname, arg, vgname, lvname);
+  else if (strcmp (kind, RD_PLAN_OP_REMOVE) == 0)
+    g_print ("Removed %s/%s (snapshot of %s)\n", vgname, lvname, arg);
+  else if (strcmp (kind, RD_PLAN_OP_MERGE) == 0)
+    g_print ("Started merge of %s/%s into %s/%s\n", vgname, lvname, vgname, arg);
+}
+
+gboolean
+rd_builtin_apply (int             argc,
+                  char          **argv,
+                  RdApp          *app,
+                  GCancellable   *cancellable,
+                  GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  ApplyData data;
+  gs_unref_variant GVariant *plan = NULL;
+  gs_unref_variant GVariant *vgs = NULL;
+  gs_unref_hashtable GHashTable *plans_by_vg = NULL;
+  gs_unref_ptrarray GPtrArray *vgnames = g_ptr_array_new ();
+  gs_unref_ptrarray GPtrArray *tagged_vgnames = g_ptr_array_new ();
+  gs_unref_ptrarray GPtrArray *results = NULL;
+  RdPlanCost cost;
+  guint n_done = 0;
+  guint n_failed = 0;
+  gint64 start;
+  gsize i;
+
+  context = g_option_context_new ("FILE - Carry out a plan saved by plan");
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc != 2)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                           "Must specify FILE");
+      goto out;
+    }
+
+  plan = rd_plan_load (argv[1], error);
+  if (!plan)
+    goto out;
+
+  memset (&cost, 0, sizeof (cost));
+  plans_by_vg = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify)g_variant_unref);
+  vgs = g_variant_get_child_value (plan, 2);
+  for (i = 0; i < g_variant_n_children (vgs); i++)
+    {
+      GVariant *vg_plan = g_variant_get_child_value (vgs, i);
+      const char *vgname;
+
+      g_variant_get_child (vg_plan, 0, "&s", &vgname);
+      if (g_hash_table_lookup (plans_by_vg, vgname))
+        {
+          g_variant_unref (vg_plan);
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "%s: VG %s appears more than once", argv[1], vgname);
+          goto out;
+        }
+      g_hash_table_insert (plans_by_vg, (char*)vgname, vg_plan);
+      g_ptr_array_add (vgnames, (char*)vgname);
+      rd_plan_add_vg_cost (vg_plan, &cost);
+    }
+  g_ptr_array_add (vgnames, NULL);
+
+  if (cost.n_ops == 0)
+    {
+      g_print ("Nothing to do\n");
+      ret = TRUE;
+      goto out;
+    }
+
+  /* Only the devices backing the plan's VGs need scanning */
+  rd_app_set_scan_scope (app, (const char *const*)vgnames->pdata);
+  (void) rd_app_get_lvmh (app);
+  g_ptr_array_set_size (vgnames, vgnames->len - 1);
+
+  data.plans_by_vg = plans_by_vg;
+  start = g_get_monotonic_time ();
+  if (!rd_run_vg_workers (vgnames, 0, apply_vg, NULL, &data,
+                          &results, cancellable, error))
+    goto out;
+
+  for (i = 0; i < results->len; i++)
+    {
+      RdVgWorkerResult *result = results->pdata[i];
+      GVariant *vg_plan = g_hash_table_lookup (plans_by_vg, result->vgname);
+      gs_unref_variant GVariant *ops = g_variant_get_child_value (vg_plan, 2);
+      gs_free const char **errmsgs = NULL;
+      gboolean tagged = FALSE;
+      GVariantIter iter;
+      const char *kind;
+      const char *lvname;
+      const char *arg;
+      guint j = 0;
+
+      if (result->error)
+        {
+          g_printerr ("%s: %s\n", result->vgname, result->error->message);
+          n_failed += g_variant_n_children (ops);
+          continue;
+        }
+
+      errmsgs = g_variant_get_strv (result->result, NULL);
+      g_variant_iter_init (&iter, ops);
+      while (g_variant_iter_next (&iter, "(&s&s&st)", &kind, &lvname, &arg, NULL))
+        {
+          const char *errmsg = errmsgs[j++];
+
+          if (*errmsg)
+            {
+              g_printerr ("%s/%s: %s\n", result->vgname, lvname, errmsg);
+              n_failed++;
+              continue;
+            }
+          print_op (result->vgname, kind, lvname, arg);
+          tagged |= strcmp (kind, RD_PLAN_OP_TAG) == 0;
+          n_done++;
+        }
+      if (tagged)
+        g_ptr_array_add (tagged_vgnames, result->vgname);
+    }
+
+  /* As for add, so later scoped scans find newly tagged VGs */
+  g_ptr_array_add (tagged_vgnames, NULL);
+  rd_app_remember_vgs (app, (const char *const*)tagged_vgnames->pdata, FALSE);
+
+  if (n_failed > 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed %u of %u operation(s)", n_failed, cost.n_ops);
+      goto out;
+    }
+
+  g_print ("Applied %u operation(s) across %u VG(s) in %.1f s\n", n_done, vgnames->len,
+           (g_get_monotonic_time () - start) / (double)G_USEC_PER_SEC);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
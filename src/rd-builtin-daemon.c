@@ -0,0 +1,788 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+#define RD_DAEMON_SOCKET_DIR "/run/roller-derby"
+#define RD_DAEMON_SOCKET_PATH RD_DAEMON_SOCKET_DIR "/daemon.sock"
+
+/* Both directions use frames of a one-byte channel, a 32-bit
+ * big-endian length, and that many bytes of payload.  The client sends
+ * one RD_FRAME_ARG per argument and then RD_FRAME_RUN; the daemon
+ * replies with any number of RD_FRAME_STDOUT/RD_FRAME_STDERR frames,
+ * then RD_FRAME_EXIT whose payload is the one-byte exit status.
+ */
+#define RD_FRAME_ARG     'a'
+#define RD_FRAME_RUN     'r'
+#define RD_FRAME_STDOUT  'o'
+#define RD_FRAME_STDERR  'e'
+#define RD_FRAME_EXIT    'x'
+
+#define RD_DAEMON_MAX_ARG_LEN 4096
+#define RD_DAEMON_MAX_ARGS    4096
+#define RD_DAEMON_TIMEOUT_SECS 10
+
+/* lvm rewrites a VG's metadata backup here after every change, made
+ * by any command, unless backups are disabled in lvm.conf.
+ */
+#define LVM_BACKUP_DIR "/etc/lvm/backup"
+
+static int opt_inventory_ttl = 10;
+
+static GOptionEntry options[] = {
+  { "inventory-ttl", 0, 0, G_OPTION_ARG_INT, &opt_inventory_ttl, "Rescan the inventory if older than SECS (default 10), in case other LVM commands changed tags without leaving a metadata backup", "SECS" },
+  { NULL }
+};
+
+/* Where g_print() goes in a daemon request handler */
+static int client_fd = -1;
+
+/* Written to from the SIGCHLD handler, to wake up the main loop */
+static int sigchld_pipe[2] = { -1, -1 };
+
+/* A connection whose request has not all arrived yet.  Requests are
+ * read without blocking, so a slow client only holds up itself, and
+ * is dropped after RD_DAEMON_TIMEOUT_SECS.
+ */
+typedef struct {
+  int          fd;
+  GByteArray  *buf;
+  gint64       deadline;
+} PendingClient;
+
+static gboolean
+write_all (int            fd,
+           const guint8  *buf,
+           gsize          len)
+{
+  while (len > 0)
+    {
+      ssize_t res = write (fd, buf, len);
+      if (res == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      buf += res;
+      len -= res;
+    }
+  return TRUE;
+}
+
+static gboolean
+read_all (int       fd,
+          guint8   *buf,
+          gsize     len)
+{
+  while (len > 0)
+    {
+      ssize_t res = read (fd, buf, len);
+      if (res == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      else if (res == 0)
+        return FALSE;
+      buf += res;
+      len -= res;
+    }
+  return TRUE;
+}
+
+static gboolean
+write_frame (int            fd,
+             char           channel,
+             const void    *data,
+             guint32        len)
+{
+  guint8 header[5];
+  guint32 belen = htonl (len);
+
+  header[0] = channel;
+  memcpy (header + 1, &belen, 4);
+  return write_all (fd, header, sizeof (header))
+    && write_all (fd, data, len);
+}
+
+/* Returns a newly allocated, NUL-terminated payload */
+static gboolean
+read_frame (int            fd,
+            char          *out_channel,
+            char         **out_data,
+            guint32       *out_len,
+            guint32        max_len)
+{
+  guint8 header[5];
+  guint32 len;
+  char *data;
+
+  if (!read_all (fd, header, sizeof (header)))
+    return FALSE;
+  memcpy (&len, header + 1, 4);
+  len = ntohl (len);
+  if (len > max_len)
+    return FALSE;
+
+  data = g_malloc (len + 1);
+  if (!read_all (fd, (guint8*)data, len))
+    {
+      g_free (data);
+      return FALSE;
+    }
+  data[len] = '\0';
+
+  *out_channel = header[0];
+  *out_data = data;
+  *out_len = len;
+  return TRUE;
+}
+
+static void
+set_unix_address (struct sockaddr_un *addr)
+{
+  memset (addr, 0, sizeof (*addr));
+  addr->sun_family = AF_UNIX;
+  strncpy (addr->sun_path, RD_DAEMON_SOCKET_PATH, sizeof (addr->sun_path) - 1);
+}
+
+/**
+ * rd_daemon_client_run:
+ * @argv: Command line, without the program name
+ * @out_exit_status: (out): Exit status of the command in the daemon
+ *
+ * If a daemon is listening, run the command there, relaying its output
+ * to our stdout and stderr.
+ *
+ * Returns: %FALSE if there is no daemon and the command should be run
+ * locally
+ */
+gboolean
+rd_daemon_client_run (int      argc,
+                      char   **argv,
+                      int     *out_exit_status)
+{
+  struct sockaddr_un addr;
+  int fd;
+  int i;
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return FALSE;
+
+  set_unix_address (&addr);
+  if (connect (fd, (struct sockaddr*)&addr, sizeof (addr)) == -1)
+    {
+      (void) close (fd);
+      return FALSE;
+    }
+
+  for (i = 0; i < argc; i++)
+    {
+      if (!write_frame (fd, RD_FRAME_ARG, argv[i], strlen (argv[i])))
+        goto lost;
+    }
+  if (!write_frame (fd, RD_FRAME_RUN, NULL, 0))
+    goto lost;
+
+  while (TRUE)
+    {
+      char channel;
+      char *data;
+      guint32 len;
+
+      if (!read_frame (fd, &channel, &data, &len, G_MAXUINT32 - 1))
+        goto lost;
+
+      switch (channel)
+        {
+        case RD_FRAME_STDOUT:
+          fwrite (data, 1, len, stdout);
+          fflush (stdout);
+          break;
+        case RD_FRAME_STDERR:
+          fwrite (data, 1, len, stderr);
+          break;
+        case RD_FRAME_EXIT:
+          *out_exit_status = len == 1 ? (guint8)data[0] : 1;
+          g_free (data);
+          (void) close (fd);
+          return TRUE;
+        }
+      g_free (data);
+    }
+
+ lost:
+  /* We may already have relayed output, so don't fall back to running
+   * locally and risk doing the work twice.
+   */
+  g_printerr ("Lost connection to roller-derby daemon\n");
+  (void) close (fd);
+  *out_exit_status = 1;
+  return TRUE;
+}
+
+static void
+print_to_client (const char *str)
+{
+  (void) write_frame (client_fd, RD_FRAME_STDOUT, str, strlen (str));
+}
+
+static void
+printerr_to_client (const char *str)
+{
+  (void) write_frame (client_fd, RD_FRAME_STDERR, str, strlen (str));
+}
+
+static void
+pending_client_free (PendingClient *client)
+{
+  (void) close (client->fd);
+  g_byte_array_unref (client->buf);
+  g_free (client);
+}
+
+/* Returns %FALSE once the client has hung up */
+static gboolean
+read_pending (PendingClient *client)
+{
+  guint8 buf[4096];
+  ssize_t res;
+
+  res = read (client->fd, buf, sizeof (buf));
+  if (res == -1)
+    return errno == EINTR || errno == EAGAIN;
+  else if (res == 0)
+    return FALSE;
+
+  g_byte_array_append (client->buf, buf, res);
+  return TRUE;
+}
+
+/* Returns the request's arguments once @buf holds all of it; until
+ * then %NULL, with @out_invalid set if it never will.
+ */
+static GPtrArray *
+parse_request (GByteArray   *buf,
+               gboolean     *out_invalid)
+{
+  GPtrArray *args = g_ptr_array_new_with_free_func (g_free);
+  gsize pos = 0;
+
+  *out_invalid = FALSE;
+  g_ptr_array_add (args, g_strdup ("roller-derby"));
+
+  while (TRUE)
+    {
+      char channel;
+      guint32 len;
+
+      if (buf->len - pos < 5)
+        goto out;
+      channel = buf->data[pos];
+      memcpy (&len, buf->data + pos + 1, 4);
+      len = ntohl (len);
+      if (len > RD_DAEMON_MAX_ARG_LEN)
+        break;
+      if (buf->len - pos - 5 < len)
+        goto out;
+      pos += 5;
+
+      if (channel == RD_FRAME_RUN)
+        {
+          g_ptr_array_add (args, NULL);
+          return args;
+        }
+      else if (channel != RD_FRAME_ARG || args->len >= RD_DAEMON_MAX_ARGS)
+        break;
+
+      g_ptr_array_add (args, g_strndup ((char*)buf->data + pos, len));
+      pos += len;
+    }
+
+  *out_invalid = TRUE;
+ out:
+  g_ptr_array_unref (args);
+  return NULL;
+}
+
+/* Whatever exits the request process, e.g. usage(), the client still
+ * gets its exit status.
+ */
+static void
+send_exit_status (int        status,
+                  gpointer   user_data)
+{
+  guint8 byte = status;
+
+  (void) write_frame (client_fd, RD_FRAME_EXIT, &byte, 1);
+}
+
+/* Runs in a child process forked per request, so the builtin sees a
+ * private copy of the warm state and of its own option variables.
+ */
+static void
+run_request (RdApp       *app,
+             int          fd,
+             GPtrArray   *args) G_GNUC_NORETURN;
+
+static void
+run_request (RdApp       *app,
+             int          fd,
+             GPtrArray   *args)
+{
+  GError *local_error = NULL;
+  int argc = args->len - 1;
+  char **argv = (char**)args->pdata;
+  RdBuiltin *builtin;
+  guint8 status = 0;
+
+  (void) signal (SIGCHLD, SIG_DFL);
+  (void) close (sigchld_pipe[0]);
+  (void) close (sigchld_pipe[1]);
+
+  client_fd = fd;
+  g_set_print_handler (print_to_client);
+  g_set_printerr_handler (printerr_to_client);
+  (void) on_exit (send_exit_status, NULL);
+
+  /* Not the daemon's own command line */
+  rd_app_reset_options (app);
+  builtin = rd_app_parse_builtin (app, &argc, &argv, &local_error);
+  if (builtin && (builtin->flags & RD_BUILTIN_FLAG_LOCAL))
+    g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "Builtin '%s' cannot be run through the daemon", builtin->name);
+  else if (builtin && rd_app_apply_options (app, &local_error))
+    (void) builtin->func (argc - 1, argv + 1, app, NULL, &local_error);
+
+  if (local_error)
+    {
+      g_printerr ("%s\n", local_error->message);
+      status = 1;
+    }
+
+  (void) write_frame (fd, RD_FRAME_EXIT, &status, 1);
+  _exit (0);
+}
+
+static void
+fail_request (int           fd,
+              const char   *message)
+{
+  guint8 status = 1;
+  gs_free char *msg = g_strconcat (message, "\n", NULL);
+
+  (void) write_frame (fd, RD_FRAME_STDERR, msg, strlen (msg));
+  (void) write_frame (fd, RD_FRAME_EXIT, &status, 1);
+}
+
+/* Start running @args in a child process, recording it in @children
+ * with whether it may change LVM.
+ */
+static void
+handle_request (RdApp        *app,
+                int           fd,
+                GPtrArray    *args,
+                GHashTable   *children)
+{
+  GError *local_error = NULL;
+  RdBuiltin *builtin = NULL;
+  guint i;
+  pid_t pid;
+
+  for (i = 1; i < args->len - 1 && !builtin; i++)
+    {
+      const char *arg = args->pdata[i];
+      if (arg[0] != '-')
+        builtin = rd_app_lookup_builtin (arg);
+    }
+
+  /* Warm the cache here rather than in the child, so the next request
+   * gets it too.
+   */
+  if (builtin && (builtin->flags & RD_BUILTIN_FLAG_INVENTORY))
+    {
+      if (!rd_app_get_inventory (app, NULL, &local_error))
+        {
+          fail_request (fd, local_error->message);
+          g_clear_error (&local_error);
+          return;
+        }
+    }
+
+  fflush (stdout);
+  fflush (stderr);
+  pid = fork ();
+  if (pid == -1)
+    {
+      gs_free char *msg = g_strconcat ("fork: ", g_strerror (errno), NULL);
+      g_printerr ("%s\n", msg);
+      fail_request (fd, msg);
+      return;
+    }
+  else if (pid == 0)
+    run_request (app, fd, args);
+
+  g_hash_table_insert (children, GINT_TO_POINTER (pid),
+                       GINT_TO_POINTER (!builtin || !(builtin->flags & RD_BUILTIN_FLAG_READONLY)));
+}
+
+static void
+handle_sigchld (int signum)
+{
+  int errsv = errno;
+
+  (void) write (sigchld_pipe[1], "", 1);
+  errno = errsv;
+}
+
+/* Requests are reaped as they finish rather than waited for, so they
+ * run concurrently.  Only our own children are waited for, leaving
+ * any other process to whoever forked it.
+ *
+ * Returns: %TRUE if a request that may have changed LVM finished
+ */
+static gboolean
+reap_children (GHashTable *children)
+{
+  gboolean changed = FALSE;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  char buf[64];
+
+  while (read (sigchld_pipe[0], buf, sizeof (buf)) > 0)
+    ;
+
+  g_hash_table_iter_init (&iter, children);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (waitpid (GPOINTER_TO_INT (key), NULL, WNOHANG) <= 0)
+        continue;
+      changed |= GPOINTER_TO_INT (value);
+      g_hash_table_iter_remove (&iter);
+    }
+  return changed;
+}
+
+static gboolean
+listen_on_socket (int       *out_fd,
+                  GError   **error)
+{
+  gboolean ret = FALSE;
+  struct sockaddr_un addr;
+  int fd = -1;
+
+  if (g_mkdir_with_parents (RD_DAEMON_SOCKET_DIR, 0755) == -1)
+    goto errno_out;
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    goto errno_out;
+
+  set_unix_address (&addr);
+  (void) unlink (addr.sun_path);
+  if (bind (fd, (struct sockaddr*)&addr, sizeof (addr)) == -1)
+    goto errno_out;
+  /* Only root may drive LVM through us */
+  if (chmod (addr.sun_path, 0600) == -1)
+    goto errno_out;
+  if (listen (fd, 16) == -1)
+    goto errno_out;
+
+  ret = TRUE;
+  *out_fd = fd;
+  fd = -1;
+  goto out;
+
+ errno_out:
+  {
+    int errsv = errno;
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                 "%s: %s", RD_DAEMON_SOCKET_PATH, g_strerror (errsv));
+  }
+ out:
+  if (fd != -1)
+    (void) close (fd);
+  return ret;
+}
+
+/* The kernel flags an open mountinfo with POLLPRI whenever the mount
+ * table changes.
+ */
+static gboolean
+mounts_changed (int mountinfo_fd)
+{
+  struct pollfd pfd = { mountinfo_fd, POLLPRI, 0 };
+
+  return poll (&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR));
+}
+
+/* Catches metadata changes made by other LVM commands */
+static gboolean
+lvm_backup_changed (struct timespec *last_mtime)
+{
+  struct stat stbuf;
+
+  if (stat (LVM_BACKUP_DIR, &stbuf) == -1)
+    return FALSE;
+  if (stbuf.st_mtim.tv_sec == last_mtime->tv_sec
+      && stbuf.st_mtim.tv_nsec == last_mtime->tv_nsec)
+    return FALSE;
+
+  *last_mtime = stbuf.st_mtim;
+  return TRUE;
+}
+
+/* Load the inventory and the LVM handle, so request processes inherit
+ * them rather than each scanning on their own.  The report backend
+ * builds the inventory without a handle, so ask for it separately.
+ */
+static gboolean
+warm_up (RdApp          *app,
+         GCancellable   *cancellable,
+         GError        **error)
+{
+  if (!rd_app_get_inventory (app, cancellable, error))
+    return FALSE;
+  (void) rd_app_get_lvmh (app);
+  return TRUE;
+}
+
+static void
+rewarm (RdApp          *app,
+        GCancellable   *cancellable)
+{
+  GError *local_error = NULL;
+
+  if (!warm_up (app, cancellable, &local_error))
+    {
+      g_printerr ("%s\n", local_error->message);
+      g_clear_error (&local_error);
+    }
+}
+
+static void
+set_nonblocking (int        fd,
+                 gboolean   nonblocking)
+{
+  int flags = fcntl (fd, F_GETFL);
+
+  (void) fcntl (fd, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+gboolean
+rd_builtin_daemon (int             argc,
+                   char          **argv,
+                   RdApp          *app,
+                   GCancellable   *cancellable,
+                   GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  int listen_fd = -1;
+  int mountinfo_fd = -1;
+  gint64 inventory_time = 0;
+  struct timespec backup_mtime = { 0, 0 };
+  struct sigaction sa;
+  gs_unref_ptrarray GPtrArray *pending =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)pending_client_free);
+  gs_unref_hashtable GHashTable *children = g_hash_table_new (NULL, NULL);
+  gs_unref_array GArray *pollfds = g_array_new (FALSE, FALSE, sizeof (struct pollfd));
+
+  context = g_option_context_new ("Serve requests over " RD_DAEMON_SOCKET_PATH);
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
+
+  mountinfo_fd = open ("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+  if (mountinfo_fd == -1)
+    goto errno_out;
+  (void) mounts_changed (mountinfo_fd);
+  (void) lvm_backup_changed (&backup_mtime);
+
+  if (pipe2 (sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    goto errno_out;
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = handle_sigchld;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  if (sigaction (SIGCHLD, &sa, NULL) == -1)
+    goto errno_out;
+
+  if (!listen_on_socket (&listen_fd, error))
+    goto out;
+
+  /* Warm up before accepting anything */
+  if (!warm_up (app, cancellable, error))
+    goto out;
+  inventory_time = g_get_monotonic_time ();
+
+  g_print ("Listening on %s\n", RD_DAEMON_SOCKET_PATH);
+
+  while (!g_cancellable_is_cancelled (cancellable))
+    {
+      struct pollfd pfd = { -1, POLLIN, 0 };
+      gint64 now = g_get_monotonic_time ();
+      gint64 timeout = -1;
+      guint i;
+
+      g_array_set_size (pollfds, 0);
+      pfd.fd = listen_fd;
+      g_array_append_val (pollfds, pfd);
+      pfd.fd = sigchld_pipe[0];
+      g_array_append_val (pollfds, pfd);
+      for (i = 0; i < pending->len; i++)
+        {
+          PendingClient *client = pending->pdata[i];
+          gint64 remaining = MAX (client->deadline - now, 0) / 1000 + 1;
+
+          pfd.fd = client->fd;
+          g_array_append_val (pollfds, pfd);
+          if (timeout < 0 || remaining < timeout)
+            timeout = remaining;
+        }
+
+      if (poll ((struct pollfd*)pollfds->data, pollfds->len, (int)timeout) == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          goto errno_out;
+        }
+      now = g_get_monotonic_time ();
+
+      if (g_array_index (pollfds, struct pollfd, 1).revents
+          && reap_children (children))
+        {
+          rd_app_invalidate (app, FALSE);
+          rewarm (app, cancellable);
+          inventory_time = now;
+        }
+
+      /* Backwards, so finished clients can be removed as we go */
+      for (i = pending->len; i > 0; i--)
+        {
+          PendingClient *client = pending->pdata[i - 1];
+          gs_unref_ptrarray GPtrArray *args = NULL;
+          gboolean invalid = FALSE;
+
+          if (g_array_index (pollfds, struct pollfd, i + 1).revents)
+            {
+              if (!read_pending (client))
+                invalid = TRUE;
+              else
+                args = parse_request (client->buf, &invalid);
+            }
+          else if (now >= client->deadline)
+            invalid = TRUE;
+
+          if (!(args || invalid))
+            continue;
+
+          if (args)
+            {
+              /* Other LVM commands can change tags behind our back */
+              if (mounts_changed (mountinfo_fd))
+                {
+                  rd_app_invalidate (app, TRUE);
+                  rewarm (app, cancellable);
+                  inventory_time = now;
+                }
+              else if (lvm_backup_changed (&backup_mtime)
+                       || now - inventory_time > (gint64)opt_inventory_ttl * G_USEC_PER_SEC)
+                {
+                  rd_app_invalidate (app, FALSE);
+                  rewarm (app, cancellable);
+                  inventory_time = now;
+                }
+
+              set_nonblocking (client->fd, FALSE);
+              handle_request (app, client->fd, args, children);
+            }
+          g_ptr_array_remove_index_fast (pending, i - 1);
+        }
+
+      if (g_array_index (pollfds, struct pollfd, 0).revents)
+        {
+          PendingClient *client;
+          int fd;
+
+          fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+          if (fd == -1)
+            {
+              if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+                continue;
+              goto errno_out;
+            }
+
+          client = g_new0 (PendingClient, 1);
+          client->fd = fd;
+          client->buf = g_byte_array_new ();
+          client->deadline = now + RD_DAEMON_TIMEOUT_SECS * G_USEC_PER_SEC;
+          g_ptr_array_add (pending, client);
+        }
+    }
+
+  ret = TRUE;
+  goto out;
+
+ errno_out:
+  {
+    int errsv = errno;
+    g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                         g_strerror (errsv));
+  }
+ out:
+  if (listen_fd != -1)
+    {
+      (void) close (listen_fd);
+      (void) unlink (RD_DAEMON_SOCKET_PATH);
+    }
+  if (mountinfo_fd != -1)
+    (void) close (mountinfo_fd);
+  return ret;
+}
@@ -26,147 +26,108 @@
 #include "rd-main.h"
 #include "libgsystem.h"
 
+static gboolean opt_json;
+static gboolean opt_ndjson;
+
+static GOptionEntry options[] = {
+  { "json", 0, 0, G_OPTION_ARG_NONE, &opt_json, "Output a JSON array, one element per LV", NULL },
+  { "ndjson", 0, 0, G_OPTION_ARG_NONE, &opt_ndjson, "Output one JSON object per line, per LV", NULL },
+  { NULL }
+};
+
+typedef struct {
+  GString  *buf;
+  guint     n_records;
+} ListData;
+
 static void
-lookup_mount (GHashTable   *mountcache,
-              gint          major,
-              gint          minor,
-              char        **path,
-              char        **filesystem)
+append_json_record (GString        *buf,
+                    RdLvRecord     *rec)
 {
-  gs_free char *key = g_strdup_printf ("%d:%d", major, minor);
-  char **lines = g_hash_table_lookup (mountcache, key);
-
-  if (!lines)
-    *path = *filesystem = NULL;
+  char **iter;
+
+  g_string_append (buf, "{\"vg\":");
+  rd_json_append_string (buf, rec->vgname);
+  g_string_append (buf, ",\"lv\":");
+  rd_json_append_string (buf, rec->lvname);
+  g_string_append (buf, ",\"path\":");
+  rd_json_append_string (buf, rec->path);
+  if (rec->major >= 0)
+    g_string_append_printf (buf, ",\"major\":%d,\"minor\":%d", rec->major, rec->minor);
   else
+    g_string_append (buf, ",\"major\":null,\"minor\":null");
+  g_string_append_printf (buf, ",\"size\":%" G_GUINT64_FORMAT, rec->size);
+  g_string_append (buf, ",\"pool\":");
+  rd_json_append_string (buf, rec->pool_lv);
+  g_string_append_printf (buf, ",\"thin\":%s", rec->thin ? "true" : "false");
+  g_string_append (buf, ",\"mount\":");
+  rd_json_append_string (buf, rec->mount_path);
+  g_string_append (buf, ",\"fs\":");
+  rd_json_append_string (buf, rec->mount_fs);
+  g_string_append (buf, ",\"tags\":[");
+  for (iter = rec->tags; *iter; iter++)
     {
-      *path = lines[4];
-      *filesystem = lines[8];
+      if (iter != rec->tags)
+        g_string_append_c (buf, ',');
+      rd_json_append_string (buf, *iter);
     }
-}
-
-static gboolean
-tag_list_includes_rollback (struct dm_list    *tags)
-{
-  struct lvm_str_list *tagl;
-
-  dm_list_iterate_items (tagl, tags)
+  g_string_append (buf, "],\"sets\":[");
+  for (iter = rec->sets; iter && *iter; iter++)
     {
-      const char *tag = tagl->str;
-      if (strcmp (tag, "rollback_include") == 0)
-        {
-          return TRUE;
-        }
+      if (iter != rec->sets)
+        g_string_append_c (buf, ',');
+      rd_json_append_string (buf, *iter);
     }
-  return FALSE;
+  g_string_append (buf, "]}");
 }
 
+/* Each record is written and flushed as soon as it is scanned, so a
+ * consumer can start before the scan finishes.
+ */
 static gboolean
-list_lvs_to_snapshot (lvm_t              lvmh,
-                      GPtrArray        **out_lv_names,
-                      GCancellable      *cancellable,
-                      GError           **error)
+print_one_lv_json (RdLvRecord     *rec,
+                   gpointer        user_data,
+                   GError        **error)
 {
-  gboolean ret = FALSE;
-  gs_unref_ptrarray GPtrArray *ret_lv_names = NULL;
-  struct dm_list *vgnames = NULL;
-  struct lvm_str_list *strl;
-
-  ret_lv_names = g_ptr_array_new_with_free_func (g_free);
-  
-  vgnames = lvm_list_vg_names (lvmh);
-  dm_list_iterate_items (strl, vgnames)
-    {
-      struct dm_list *tags;
-      struct dm_list *lvs;
-      struct lvm_lv_list *lvsl;
-      gboolean include_entire_vg = FALSE;
-      const char *vgname = strl->str;
-      vg_t vg = lvm_vg_open (lvmh, vgname, "r", 0);
-
-      if (vg == NULL)
-        {
-          glvm_set_error (error, lvmh);
-          goto out;
-        }
-
-      tags = lvm_vg_get_tags (vg);
-      include_entire_vg = tag_list_includes_rollback (tags);
-
-      lvs = lvm_vg_list_lvs (vg);
-      dm_list_iterate_items (lvsl, lvs)
-        {
-          lv_t lv = lvsl->lv;
-          gboolean matches;
-          const char *lvname = lvm_lv_get_name (lv);
-          
-          if (include_entire_vg)
-            {
-              matches = TRUE;
-            }
-          else
-            {
-              tags = lvm_lv_get_tags (lv);
-              matches = tag_list_includes_rollback (tags);
-            }
-
-          if (matches)
-            g_ptr_array_add (ret_lv_names, g_strdup_printf ("%s/%s", vgname, lvname));
-        }
-      
-      if (lvm_vg_close (vg) == -1)
-        {
-          glvm_set_error (error, lvmh);
-          goto out;
-        }
-    }
-
-  ret = TRUE;
- out:
-  gs_transfer_out_value (out_lv_names, &ret_lv_names);
-  return ret;
+  ListData *data = user_data;
+
+  g_string_truncate (data->buf, 0);
+  if (opt_json)
+    g_string_append (data->buf, data->n_records == 0 ? "[\n" : ",\n");
+  append_json_record (data->buf, rec);
+  if (opt_ndjson)
+    g_string_append_c (data->buf, '\n');
+
+  g_print ("%s", data->buf->str);
+  fflush (stdout);
+  data->n_records++;
+  return TRUE;
 }
 
 static gboolean
-print_one_lv_status (RdApp          *app,
-                     const char     *path,
-                     GCancellable   *cancellable,
+print_one_lv_status (RdLvRecord     *rec,
+                     gpointer        user_data,
                      GError        **error)
 {
-  gboolean ret = FALSE;
-  lvm_t lvmh;
-  GHashTable *mountcache;
-  lv_t lv = NULL;
-  int major, minor;
-  char *mount_path;
-  char *mount_fs;
-  glvm_cleanup_vg vg_t vg = NULL;
-
-  lvmh = rd_app_get_lvmh (app);
-  mountcache = rd_app_get_mounts (app);
-          
-  if (!glvm_open_vg_lv (lvmh, path, "r", 0, &vg, &lv,
-                        cancellable, error))
-    goto out;
+  ListData *data = user_data;
+  gs_free char *sets = NULL;
 
-  if (!glvm_get_lv_majmin (lv, &major, &minor, error))
-    goto out;
-
-  g_print ("%s\n", path);
+  data->n_records++;
+  g_print ("%s\n", rec->path);
+  if (rec->sets)
+    {
+      sets = g_strjoinv (", ", rec->sets);
+      g_print ("  sets: %s\n", sets);
+    }
 
-  lookup_mount (mountcache, major, minor, &mount_path, &mount_fs);
-  if (mount_path == NULL)
+  if (rec->mount_path == NULL)
     g_print ("  (not mounted)\n");
   else
     {
-      g_print ("  mounted: %s\n", mount_path);
-      g_print ("  fs: %s\n", mount_fs);
+      g_print ("  mounted: %s\n", rec->mount_path);
+      g_print ("  fs: %s\n", rec->mount_fs);
     }
-
-
-  ret = TRUE;
- out:
-  return ret;
+  return TRUE;
 }
 
 gboolean
@@ -177,36 +138,54 @@ rd_builtin_list (int             argc,
                  GError        **error)
 {
   gboolean ret = FALSE;
-  guint i;
-  gs_unref_ptrarray GPtrArray *names = NULL;
   GOptionContext *context;
+  ListData data = { NULL, 0 };
 
   context = g_option_context_new ("List current rollback state");
+  g_option_context_add_main_entries (context, options, NULL);
   g_option_context_add_group (context, rd_app_get_options (app));
 
   if (!g_option_context_parse (context, &argc, &argv, error))
     goto out;
 
-  if (!list_lvs_to_snapshot (rd_app_get_lvmh (app), &names, cancellable, error))
-    goto out;
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
 
-  if (names->len > 0)
+  if (opt_json && opt_ndjson)
     {
-      for (i = 0; i < names->len; i++)
-        {
-          const char *path = names->pdata[i];
-          
-          if (!print_one_lv_status (app, path,
-                                    cancellable, error))
-            goto out;
-        }
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                           "--json and --ndjson are mutually exclusive");
+      goto out;
     }
-  else
+
+  if (opt_json || opt_ndjson)
+    {
+      data.buf = g_string_new ("");
+      if (!rd_app_foreach_lv (app, print_one_lv_json, &data,
+                              cancellable, error))
+        goto out;
+      if (opt_json)
+        g_print (data.n_records == 0 ? "[]\n" : "\n]\n");
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!rd_app_foreach_lv (app, print_one_lv_status, &data,
+                          cancellable, error))
+    goto out;
+
+  if (data.n_records == 0)
     {
-      g_print ("No LVs tagged with 'rollback_include'; use --tag or --tag-vg to add them\n");
+      g_print ("No LVs in the selected rollback sets; use add to select them\n");
     }
 
   ret = TRUE;
  out:
+  if (data.buf)
+    g_string_free (data.buf, TRUE);
   return ret;
 }
@@ -0,0 +1,254 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+static int opt_interval = 10;
+static int opt_warn = 80;
+static int opt_extend = 0;
+static int opt_extend_by = 20;
+static gboolean opt_once;
+
+static GOptionEntry options[] = {
+  { "interval", 0, 0, G_OPTION_ARG_INT, &opt_interval, "Check every SECS seconds (default 10)", "SECS" },
+  { "warn", 0, 0, G_OPTION_ARG_INT, &opt_warn, "Warn when a snapshot is more than PERCENT full (default 80)", "PERCENT" },
+  { "extend", 0, 0, G_OPTION_ARG_INT, &opt_extend, "Extend a snapshot when it is more than PERCENT full (default never)", "PERCENT" },
+  { "extend-by", 0, 0, G_OPTION_ARG_INT, &opt_extend_by, "Grow snapshots by PERCENT of their size when extending (default 20)", "PERCENT" },
+  { "once", 0, 0, G_OPTION_ARG_NONE, &opt_once, "Print the usage of every snapshot and exit", NULL },
+  { NULL }
+};
+
+typedef enum {
+  SNAPSHOT_OK,
+  SNAPSHOT_WARNED,
+  SNAPSHOT_INVALID
+} SnapshotState;
+
+/* Keyed by "VG/LV"; what we last reported, so each threshold crossing
+ * is reported once rather than on every sweep.
+ */
+typedef struct {
+  GHashTable  *states;
+} MonitorData;
+
+static gboolean
+extend_snapshot (const char  *path,
+                 guint64      total_sectors,
+                 GError     **error)
+{
+  guint64 extra = MAX (total_sectors / 100 * opt_extend_by, 1);
+  gs_free char *cmdline = NULL;
+
+  cmdline = g_strdup_printf ("lvextend --size +%" G_GUINT64_FORMAT "s %s",
+                             extra, path);
+  if (!glvm_run_command (cmdline, NULL, error))
+    return FALSE;
+
+  g_print ("Extended %s by %" G_GUINT64_FORMAT " sectors\n", path, extra);
+  return TRUE;
+}
+
+/* A classic snapshot's status is "<allocated>/<total> <metadata>" in
+ * sectors, or "Invalid" once it has overflowed.
+ */
+static gboolean
+check_snapshot (MonitorData   *data,
+                GlvmDmDevice  *dev,
+                const char    *path,
+                GError       **error)
+{
+  gboolean ret = FALSE;
+  gs_free char *target_type = NULL;
+  gs_free char *params = NULL;
+  SnapshotState last_state;
+  SnapshotState state;
+  guint64 allocated, total, metadata;
+  double percent;
+
+  if (!glvm_dm_get_status (dev->major, dev->minor, &target_type, &params, error))
+    goto out;
+
+  /* Thin snapshots share their pool's space; only classic snapshots
+   * can fill up on their own.
+   */
+  if (strcmp (target_type, "snapshot") != 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  last_state = GPOINTER_TO_INT (g_hash_table_lookup (data->states, path));
+
+  if (sscanf (params, "%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+              &allocated, &total, &metadata) != 3 || total == 0)
+    {
+      if (opt_once || last_state != SNAPSHOT_INVALID)
+        g_printerr ("Snapshot %s is invalid (%s); it can no longer be used for rollback\n",
+                    path, params);
+      g_hash_table_insert (data->states, g_strdup (path), GINT_TO_POINTER (SNAPSHOT_INVALID));
+      ret = TRUE;
+      goto out;
+    }
+
+  percent = 100.0 * allocated / total;
+
+  if (opt_once)
+    g_print ("%s %.1f%%\n", path, percent);
+
+  if (opt_extend > 0 && percent >= opt_extend)
+    {
+      if (!extend_snapshot (path, total, error))
+        goto out;
+      state = SNAPSHOT_OK;
+    }
+  else if (percent >= opt_warn)
+    {
+      if (!opt_once && last_state != SNAPSHOT_WARNED)
+        g_printerr ("Snapshot %s is %.1f%% full\n", path, percent);
+      state = SNAPSHOT_WARNED;
+    }
+  else
+    state = SNAPSHOT_OK;
+
+  g_hash_table_insert (data->states, g_strdup (path), GINT_TO_POINTER (state));
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* One DM_DEVICE_LIST, then one DM_DEVICE_STATUS per roller-derby
+ * snapshot.  LVM itself is only touched to extend a snapshot.
+ */
+static gboolean
+sweep (MonitorData    *data,
+       guint          *out_n_failed,
+       GError        **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_ptrarray GPtrArray *devices = NULL;
+  guint i;
+
+  if (!glvm_dm_list_devices (&devices, error))
+    goto out;
+
+  for (i = 0; i < devices->len; i++)
+    {
+      GlvmDmDevice *dev = devices->pdata[i];
+      GError *local_error = NULL;
+      gs_free char *vgname = NULL;
+      gs_free char *lvname = NULL;
+      gs_free char *layer = NULL;
+      gs_free char *origin = NULL;
+      gs_free char *path = NULL;
+      gint64 ts;
+
+      if (!glvm_dm_split_name (dev->name, &vgname, &lvname, &layer))
+        continue;
+      if (layer != NULL)
+        continue;
+      if (!rd_snapshot_name_parse (lvname, &origin, &ts, NULL))
+        continue;
+
+      path = g_strconcat (vgname, "/", lvname, NULL);
+      if (!check_snapshot (data, dev, path, &local_error))
+        {
+          g_printerr ("%s: %s\n", path, local_error->message);
+          g_error_free (local_error);
+          (*out_n_failed)++;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+gboolean
+rd_builtin_monitor (int             argc,
+                    char          **argv,
+                    RdApp          *app,
+                    GCancellable   *cancellable,
+                    GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  MonitorData data;
+  gs_unref_hashtable GHashTable *states = NULL;
+  guint n_failed = 0;
+
+  context = g_option_context_new ("Watch roller-derby snapshots fill up");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
+
+  if (opt_interval <= 0 || opt_warn <= 0 || opt_warn > 100
+      || opt_extend < 0 || opt_extend > 100
+      || opt_extend_by <= 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                           "Invalid --interval, --warn, --extend or --extend-by");
+      goto out;
+    }
+
+  states = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  data.states = states;
+
+  while (TRUE)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      if (!sweep (&data, &n_failed, error))
+        goto out;
+
+      if (opt_once)
+        break;
+
+      g_usleep ((gulong)opt_interval * G_USEC_PER_SEC);
+    }
+
+  if (n_failed > 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to check %u snapshot(s)", n_failed);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -0,0 +1,633 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+static char **opt_add;
+static char **opt_remove;
+static gboolean opt_snapshot;
+static int opt_size_percent = 20;
+static gboolean opt_prune;
+static int opt_keep = -1;
+static char *opt_max_age;
+static gboolean opt_rollback;
+static char *opt_output;
+
+static GOptionEntry options[] = {
+  { "add", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_add, "Add LVPATH to rollback first; LVPATH may be VG/* or another glob", "LVPATH" },
+  { "remove", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_remove, "Remove LVPATH from rollback first", "LVPATH" },
+  { "snapshot", 0, 0, G_OPTION_ARG_NONE, &opt_snapshot, "Snapshot the LVs in rollback", NULL },
+  { "size-percent", 0, 0, G_OPTION_ARG_INT, &opt_size_percent, "Size classic snapshots at PERCENT of their origin (default 20)", "PERCENT" },
+  { "prune", 0, 0, G_OPTION_ARG_NONE, &opt_prune, "Remove snapshots past their retention policy", NULL },
+  { "keep", 0, 0, G_OPTION_ARG_INT, &opt_keep, "With --prune, keep the newest N snapshots of LVs with no " RD_KEEP_TAG " tag", "N" },
+  { "max-age", 0, 0, G_OPTION_ARG_STRING, &opt_max_age, "With --prune, remove snapshots older than AGE of LVs with no " RD_MAX_AGE_TAG " tag", "AGE" },
+  { "rollback", 0, 0, G_OPTION_ARG_NONE, &opt_rollback, "Merge each LV's latest snapshot back into it", NULL },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Save the plan to FILE for apply", "FILE" },
+  { NULL }
+};
+
+typedef struct {
+  GHashTable         *lvs_by_vg;      /* Selected records; may lack a VG */
+  GHashTable         *add_by_vg;      /* VG name -> GPtrArray of LV names */
+  GHashTable         *remove_by_vg;
+  char              **tags;
+  RdRetentionPolicy   defaults;
+  gint64              now;
+} PlanData;
+
+/* An LV that will be in rollback once the tag changes are made */
+typedef struct {
+  char      *lvname;
+  guint64    size;
+  gboolean   thin;
+  char     **tags;
+} PlannedLv;
+
+typedef struct {
+  guint64      lv_size;
+  const char  *origin;
+  const char  *lv_attr;
+} LvProps;
+
+static const GlvmPropSpec lv_props[] = {
+  { "lv_size", GLVM_PROP_UINT64, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (LvProps, lv_size) },
+  { "origin", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_EMPTY_IS_NULL, G_STRUCT_OFFSET (LvProps, origin) },
+  { "lv_attr", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (LvProps, lv_attr) },
+};
+
+static void
+planned_lv_free (PlannedLv *plv)
+{
+  g_free (plv->lvname);
+  g_strfreev (plv->tags);
+  g_free (plv);
+}
+
+static void
+add_planned_lv (GPtrArray    *members,
+                const char   *lvname,
+                guint64       size,
+                gboolean      thin,
+                char        **tags)
+{
+  PlannedLv *plv = g_new0 (PlannedLv, 1);
+
+  plv->lvname = g_strdup (lvname);
+  plv->size = size;
+  plv->thin = thin;
+  plv->tags = tags;
+  g_ptr_array_add (members, plv);
+}
+
+static PlannedLv *
+find_planned_lv (GPtrArray    *members,
+                 const char   *lvname)
+{
+  guint i;
+
+  for (i = 0; i < members->len; i++)
+    {
+      PlannedLv *plv = members->pdata[i];
+      if (strcmp (plv->lvname, lvname) == 0)
+        return plv;
+    }
+  return NULL;
+}
+
+static char **
+lv_get_tags (lv_t lv)
+{
+  GPtrArray *ret = g_ptr_array_new ();
+  struct dm_list *tags = lvm_lv_get_tags (lv);
+  struct lvm_str_list *tagl;
+
+  /* NULL when the LV has no tags.  Like every list lvm2app returns, it
+   * is allocated afresh on each call, so it is fetched once rather
+   * than given to the iteration macro, which evaluates it per test.
+   */
+  if (tags)
+    {
+      dm_list_iterate_items (tagl, tags)
+        g_ptr_array_add (ret, g_strdup (tagl->str));
+    }
+  g_ptr_array_add (ret, NULL);
+
+  return (char**)g_ptr_array_free (ret, FALSE);
+}
+
+/* Append to @out_lvs every LV of @vg matched by @lvname, which may be
+ * a glob as for add and remove.
+ */
+static gboolean
+match_lvs (vg_t           vg,
+           const char    *lvname,
+           GPtrArray     *out_lvs,
+           GError       **error)
+{
+  if (strpbrk (lvname, "*?") != NULL)
+    {
+      GPatternSpec *pattern = g_pattern_spec_new (lvname);
+      struct dm_list *lvs = lvm_vg_list_lvs (vg);
+      struct lvm_lv_list *lvsl;
+      guint n_matched = 0;
+
+      /* NULL for a VG with no LVs */
+      if (lvs)
+        {
+          dm_list_iterate_items (lvsl, lvs)
+            {
+              if (!g_pattern_match_string (pattern, lvm_lv_get_name (lvsl->lv))
+                  || !rd_lv_is_selectable (lvsl->lv))
+                continue;
+              g_ptr_array_add (out_lvs, lvsl->lv);
+              n_matched++;
+            }
+        }
+      g_pattern_spec_free (pattern);
+
+      if (n_matched == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "%s/%s: No matching LVs", lvm_vg_get_name (vg), lvname);
+          return FALSE;
+        }
+    }
+  else
+    {
+      lv_t lv = lvm_lv_from_name (vg, lvname);
+
+      if (lv == NULL)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "%s/%s: No such LV", lvm_vg_get_name (vg), lvname);
+          return FALSE;
+        }
+      g_ptr_array_add (out_lvs, lv);
+    }
+  return TRUE;
+}
+
+static gboolean
+matched_lvs_for_vg (vg_t           vg,
+                    GPtrArray     *lvnames,
+                    GPtrArray    **out_lvs,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_ptrarray GPtrArray *lvs = g_ptr_array_new ();
+  guint i;
+
+  for (i = 0; lvnames && i < lvnames->len; i++)
+    {
+      if (!match_lvs (vg, lvnames->pdata[i], lvs, error))
+        goto out;
+    }
+
+  ret = TRUE;
+  gs_transfer_out_value (out_lvs, &lvs);
+ out:
+  return ret;
+}
+
+static gboolean
+lv_has_tag (lv_t          lv,
+            const char   *tag)
+{
+  struct dm_list *tags = lvm_lv_get_tags (lv);
+  struct lvm_str_list *tagl;
+
+  if (!tags)
+    return FALSE;
+
+  dm_list_iterate_items (tagl, tags)
+    {
+      if (strcmp (tagl->str, tag) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/* Runs in a worker process, one per VG.  Works out which LVs will be
+ * in rollback after the requested adds and removes, then what to do
+ * to them, without changing anything.
+ *
+ * Returns (ta(ssst)): the VG's metadata sequence number, and the
+ * operations as in %RD_PLAN_VG_TYPE.
+ */
+static gboolean
+plan_vg (RdVgWorker        *worker,
+         lvm_t              lvmh,
+         const char        *vgname,
+         gpointer           user_data,
+         GVariant         **out_result,
+         GCancellable      *cancellable,
+         GError           **error)
+{
+  gboolean ret = FALSE;
+  PlanData *data = user_data;
+  GPtrArray *records = g_hash_table_lookup (data->lvs_by_vg, vgname);
+  glvm_cleanup_vg vg_t vg = NULL;
+  gs_unref_ptrarray GPtrArray *members =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)planned_lv_free);
+  gs_unref_ptrarray GPtrArray *add_lvs = NULL;
+  gs_unref_ptrarray GPtrArray *remove_lvs = NULL;
+  gs_unref_hashtable GHashTable *seen = g_hash_table_new (NULL, NULL);
+  gs_unref_hashtable GHashTable *snaps_by_lv = NULL;
+  RdRetentionPolicy vg_policy = data->defaults;
+  GVariantBuilder builder;
+  guint64 seqno;
+  char **tag;
+  guint i, j;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" RD_PLAN_OP_TYPE));
+
+  vg = glvm_vg_open (lvmh, vgname, "r", GLVM_VG_OPEN_FLAGS_NONE, NULL,
+                     cancellable, error);
+  if (vg == NULL)
+    goto out;
+  seqno = lvm_vg_get_seqno (vg);
+
+  if (!matched_lvs_for_vg (vg, g_hash_table_lookup (data->add_by_vg, vgname), &add_lvs, error))
+    goto out;
+  if (!matched_lvs_for_vg (vg, g_hash_table_lookup (data->remove_by_vg, vgname), &remove_lvs, error))
+    goto out;
+
+  for (i = 0; records && i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      add_planned_lv (members, rec->lvname, rec->size, rec->thin,
+                      g_strdupv (rec->tags));
+    }
+
+  for (i = 0; i < add_lvs->len; i++)
+    {
+      lv_t lv = add_lvs->pdata[i];
+      const char *lvname = lvm_lv_get_name (lv);
+      LvProps props = { 0, NULL, NULL };
+
+      if (g_hash_table_contains (seen, lv))
+        continue;
+      g_hash_table_add (seen, lv);
+
+      for (tag = data->tags; *tag; tag++)
+        {
+          if (!lv_has_tag (lv, *tag))
+            g_variant_builder_add (&builder, RD_PLAN_OP_TYPE, RD_PLAN_OP_TAG,
+                                   lvname, *tag, (guint64)0);
+        }
+
+      if (!glvm_lv_get_properties (lv, lv_props, G_N_ELEMENTS (lv_props),
+                                   &props, NULL, error))
+        goto out;
+      /* As in the inventory, snapshots are never snapshotted themselves */
+      if (!props.origin && !find_planned_lv (members, lvname))
+        add_planned_lv (members, lvname, props.lv_size, rd_lv_attr_is_thin (props.lv_attr),
+                        lv_get_tags (lv));
+    }
+
+  for (i = 0; i < remove_lvs->len; i++)
+    {
+      lv_t lv = remove_lvs->pdata[i];
+      const char *lvname = lvm_lv_get_name (lv);
+      PlannedLv *plv;
+
+      if (g_hash_table_contains (seen, lv))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                       "%s/%s: Both added and removed", vgname, lvname);
+          goto out;
+        }
+      g_hash_table_add (seen, lv);
+
+      for (tag = data->tags; *tag; tag++)
+        {
+          if (lv_has_tag (lv, *tag))
+            g_variant_builder_add (&builder, RD_PLAN_OP_TYPE, RD_PLAN_OP_UNTAG,
+                                   lvname, *tag, (guint64)0);
+        }
+
+      plv = find_planned_lv (members, lvname);
+      if (plv)
+        g_ptr_array_remove (members, plv);
+    }
+
+  /* Snapshots are named for the time the plan was made, not applied,
+   * so that the plan says exactly which LVs apply will create.
+   */
+  for (i = 0; opt_snapshot && i < members->len; i++)
+    {
+      PlannedLv *plv = members->pdata[i];
+      gs_free char *snapname = rd_vg_new_snapshot_name (vg, plv->lvname, data->now);
+      guint64 size = 0;
+
+      /* As for snapshot, a thick snapshot takes at least an extent */
+      if (!plv->thin)
+        size = MAX (plv->size / 100 * opt_size_percent, lvm_vg_get_extent_size (vg));
+
+      g_variant_builder_add (&builder, RD_PLAN_OP_TYPE, RD_PLAN_OP_SNAPSHOT,
+                             plv->lvname, snapname, size);
+    }
+
+  if (opt_prune || opt_rollback)
+    {
+      gs_unref_ptrarray GPtrArray *lvnames = g_ptr_array_new ();
+
+      for (i = 0; i < members->len; i++)
+        g_ptr_array_add (lvnames, ((PlannedLv*)members->pdata[i])->lvname);
+      g_ptr_array_add (lvnames, NULL);
+
+      if (!rd_vg_list_snapshots (vg, (const char *const*)lvnames->pdata, &snaps_by_lv, error))
+        goto out;
+    }
+
+  if (opt_prune && !rd_retention_policy_update_from_vg (&vg_policy, vg, error))
+    goto out;
+
+  for (i = 0; opt_prune && i < members->len; i++)
+    {
+      PlannedLv *plv = members->pdata[i];
+      GPtrArray *snaps = g_hash_table_lookup (snaps_by_lv, plv->lvname);
+      RdRetentionPolicy policy = vg_policy;
+      /* A snapshot planned above will be the newest */
+      guint rank = opt_snapshot ? 1 : 0;
+
+      for (tag = plv->tags; tag && *tag; tag++)
+        {
+          if (!rd_retention_policy_update (&policy, *tag, error))
+            {
+              g_prefix_error (error, "%s/%s: ", vgname, plv->lvname);
+              goto out;
+            }
+        }
+
+      for (j = 0; j < snaps->len; j++)
+        {
+          RdSnapshotInfo *snap = snaps->pdata[j];
+
+          if (rd_retention_is_expired (&policy, rank + j, data->now - snap->timestamp))
+            g_variant_builder_add (&builder, RD_PLAN_OP_TYPE, RD_PLAN_OP_REMOVE,
+                                   snap->name, plv->lvname, snap->cow_size);
+        }
+    }
+
+  for (i = 0; opt_rollback && i < members->len; i++)
+    {
+      PlannedLv *plv = members->pdata[i];
+      GPtrArray *snaps = g_hash_table_lookup (snaps_by_lv, plv->lvname);
+      RdSnapshotInfo *latest;
+
+      if (snaps->len == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "%s/%s: No roller-derby snapshot found", vgname, plv->lvname);
+          goto out;
+        }
+      latest = snaps->pdata[0];
+      g_variant_builder_add (&builder, RD_PLAN_OP_TYPE, RD_PLAN_OP_MERGE,
+                             latest->name, plv->lvname, (guint64)0);
+    }
+
+  ret = TRUE;
+  *out_result = g_variant_new ("(t@a" RD_PLAN_OP_TYPE ")", seqno,
+                               g_variant_builder_end (&builder));
+ out:
+  if (!ret)
+    g_variant_builder_clear (&builder);
+  return ret;
+}
+
+static gboolean
+strv_contains (const char *const  *strv,
+               guint               len,
+               const char         *str)
+{
+  guint i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (strcmp (strv[i], str) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/* Group VG/LV paths by VG, adding each new VG to @vgnames */
+static gboolean
+group_lvpaths (char          **paths,
+               GHashTable     *out_by_vg,
+               GPtrArray      *vgnames,
+               GError        **error)
+{
+  char **iter;
+
+  for (iter = paths; iter && *iter; iter++)
+    {
+      char *vgname;
+      char *lvname;
+      GPtrArray *lvnames;
+
+      if (!glvm_split_lvpath (*iter, &vgname, &lvname, error))
+        return FALSE;
+
+      lvnames = g_hash_table_lookup (out_by_vg, vgname);
+      if (!lvnames)
+        {
+          lvnames = g_ptr_array_new_with_free_func (g_free);
+          g_hash_table_insert (out_by_vg, g_strdup (vgname), lvnames);
+        }
+      g_ptr_array_add (lvnames, lvname);
+
+      if (!strv_contains ((const char *const*)vgnames->pdata, vgnames->len, vgname))
+        g_ptr_array_add (vgnames, vgname);
+      else
+        g_free (vgname);
+    }
+  return TRUE;
+}
+
+gboolean
+rd_builtin_plan (int             argc,
+                 char          **argv,
+                 RdApp          *app,
+                 GCancellable   *cancellable,
+                 GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  GPtrArray *records;
+  PlanData data;
+  gs_unref_hashtable GHashTable *lvs_by_vg = NULL;
+  gs_unref_hashtable GHashTable *add_by_vg = NULL;
+  gs_unref_hashtable GHashTable *remove_by_vg = NULL;
+  gs_unref_ptrarray GPtrArray *vgnames = NULL;
+  gs_unref_ptrarray GPtrArray *lvpath_vgnames = g_ptr_array_new_with_free_func (g_free);
+  gs_unref_ptrarray GPtrArray *results = NULL;
+  gs_unref_variant GVariant *plan = NULL;
+  gs_strfreev char **tags = NULL;
+  GVariantBuilder builder;
+  guint n_failed = 0;
+  guint i;
+
+  context = g_option_context_new ("- Compute the operations for a request, and their cost");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
+
+  if (opt_keep != -1 || opt_max_age)
+    opt_prune = TRUE;
+  if (!(opt_add || opt_remove || opt_snapshot || opt_prune || opt_rollback))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                           "Nothing to plan; use --add, --remove, --snapshot, --prune or --rollback");
+      goto out;
+    }
+  /* A merge consumes the snapshot; combining it with taking or
+   * removing snapshots of the same LVs has no sensible order.
+   */
+  if (opt_rollback && (opt_snapshot || opt_prune))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                           "--rollback cannot be combined with --snapshot or --prune");
+      goto out;
+    }
+  if (opt_size_percent <= 0 || opt_size_percent > 100)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --size-percent %d", opt_size_percent);
+      goto out;
+    }
+
+  memset (&data, 0, sizeof (data));
+  data.defaults.keep = opt_keep;
+  data.defaults.max_age = -1;
+  if (opt_keep < -1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --keep %d", opt_keep);
+      goto out;
+    }
+  if (opt_max_age && !rd_parse_age (opt_max_age, &data.defaults.max_age))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --max-age '%s'", opt_max_age);
+      goto out;
+    }
+  data.now = g_get_real_time () / G_USEC_PER_SEC;
+
+  add_by_vg = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                     (GDestroyNotify)g_ptr_array_unref);
+  remove_by_vg = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify)g_ptr_array_unref);
+  if (!group_lvpaths (opt_add, add_by_vg, lvpath_vgnames, error))
+    goto out;
+  if (!group_lvpaths (opt_remove, remove_by_vg, lvpath_vgnames, error))
+    goto out;
+
+  /* Without adds or removes, only VGs already in rollback matter, as
+   * for the inventory builtins; LVs being added may be anywhere.
+   */
+  if (lvpath_vgnames->len == 0)
+    rd_app_set_scan_scope (app, NULL);
+
+  records = rd_app_get_inventory (app, cancellable, error);
+  if (!records)
+    goto out;
+
+  rd_inventory_group_by_vg (records, &lvs_by_vg, &vgnames);
+  for (i = 0; i < lvpath_vgnames->len; i++)
+    {
+      const char *vgname = lvpath_vgnames->pdata[i];
+      if (!g_hash_table_lookup (lvs_by_vg, vgname))
+        g_ptr_array_add (vgnames, (char*)vgname);
+    }
+
+  tags = rd_sets_get_tags ();
+  data.lvs_by_vg = lvs_by_vg;
+  data.add_by_vg = add_by_vg;
+  data.remove_by_vg = remove_by_vg;
+  data.tags = tags;
+
+  if (!rd_run_vg_workers (vgnames, 0, plan_vg, NULL, &data,
+                          &results, cancellable, error))
+    goto out;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" RD_PLAN_VG_TYPE));
+  for (i = 0; i < results->len; i++)
+    {
+      RdVgWorkerResult *result = results->pdata[i];
+      gs_unref_variant GVariant *ops = NULL;
+      guint64 seqno;
+
+      if (result->error)
+        {
+          g_printerr ("%s: %s\n", result->vgname, result->error->message);
+          n_failed++;
+          continue;
+        }
+
+      g_variant_get (result->result, "(t@a" RD_PLAN_OP_TYPE ")", &seqno, &ops);
+      if (g_variant_n_children (ops) == 0)
+        continue;
+      g_variant_builder_add (&builder, "(st@a" RD_PLAN_OP_TYPE ")",
+                             result->vgname, seqno, ops);
+    }
+
+  if (n_failed > 0)
+    {
+      g_variant_builder_clear (&builder);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to plan %u VG(s)", n_failed);
+      goto out;
+    }
+
+  plan = g_variant_new ("(ux@a" RD_PLAN_VG_TYPE ")", (guint32)RD_PLAN_VERSION,
+                        data.now, g_variant_builder_end (&builder));
+  g_variant_ref_sink (plan);
+
+  rd_plan_print (plan);
+
+  if (opt_output)
+    {
+      if (!rd_plan_save (plan, opt_output, error))
+        goto out;
+      g_print ("Saved plan to %s; run \"roller-derby apply %s\" to carry it out\n",
+               opt_output, opt_output);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -0,0 +1,264 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+static int opt_keep = -1;
+static char *opt_max_age;
+static gboolean opt_dry_run;
+
+static GOptionEntry options[] = {
+  { "keep", 0, 0, G_OPTION_ARG_INT, &opt_keep, "Keep the newest N snapshots of LVs with no " RD_KEEP_TAG " tag", "N" },
+  { "max-age", 0, 0, G_OPTION_ARG_STRING, &opt_max_age, "Remove snapshots older than AGE (e.g. 3600, 12h, 7d) of LVs with no " RD_MAX_AGE_TAG " tag", "AGE" },
+  { "dry-run", 'n', 0, G_OPTION_ARG_NONE, &opt_dry_run, "Only print which snapshots would be removed", NULL },
+  { NULL }
+};
+
+typedef struct {
+  GHashTable         *lvs_by_vg;
+  RdRetentionPolicy   defaults;
+  gint64              now;
+  gboolean            dry_run;
+} PruneData;
+
+/* Runs in a worker process, one per VG.  Finds the roller-derby
+ * snapshots of each record, and removes the expired ones of every
+ * origin with a single lvremove: one VG lock, one metadata read and
+ * one device scan for the whole VG.
+ *
+ * Returns (a(ss)s): origin and name of each expired snapshot, and an
+ * error message which is empty if they were all removed.
+ */
+static gboolean
+prune_vg (RdVgWorker        *worker,
+          lvm_t              lvmh,
+          const char        *vgname,
+          gpointer           user_data,
+          GVariant         **out_result,
+          GCancellable      *cancellable,
+          GError           **error)
+{
+  gboolean ret = FALSE;
+  PruneData *data = user_data;
+  GPtrArray *records = g_hash_table_lookup (data->lvs_by_vg, vgname);
+  glvm_cleanup_vg vg_t vg = NULL;
+  gs_unref_hashtable GHashTable *snaps_by_lv = NULL;
+  gs_unref_ptrarray GPtrArray *lvnames = g_ptr_array_new ();
+  RdRetentionPolicy vg_policy = data->defaults;
+  GString *cmdline = NULL;
+  GError *local_error = NULL;
+  GVariantBuilder builder;
+  guint n_expired = 0;
+  guint i, j;
+
+  vg = glvm_vg_open (lvmh, vgname, "r", GLVM_VG_OPEN_FLAGS_NONE, NULL,
+                     cancellable, error);
+  if (vg == NULL)
+    goto out;
+
+  if (!rd_retention_policy_update_from_vg (&vg_policy, vg, error))
+    goto out;
+
+  for (i = 0; i < records->len; i++)
+    g_ptr_array_add (lvnames, ((RdLvRecord*)records->pdata[i])->lvname);
+  g_ptr_array_add (lvnames, NULL);
+
+  if (!rd_vg_list_snapshots (vg, (const char *const*)lvnames->pdata, &snaps_by_lv, error))
+    goto out;
+
+  /* lvremove takes the VG lock itself */
+  lvm_vg_close (vg);
+  vg = NULL;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+  cmdline = g_string_new ("lvremove --force");
+
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      GPtrArray *snaps = g_hash_table_lookup (snaps_by_lv, rec->lvname);
+      RdRetentionPolicy policy = vg_policy;
+      char **tag;
+
+      for (tag = rec->tags; tag && *tag; tag++)
+        {
+          if (!rd_retention_policy_update (&policy, *tag, &local_error))
+            break;
+        }
+      if (local_error)
+        {
+          g_printerr ("%s: %s\n", rec->path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      for (j = 0; j < snaps->len; j++)
+        {
+          RdSnapshotInfo *snap = snaps->pdata[j];
+
+          if (!rd_retention_is_expired (&policy, j, data->now - snap->timestamp))
+            continue;
+
+          g_variant_builder_add (&builder, "(ss)", rec->lvname, snap->name);
+          g_string_append_printf (cmdline, " %s/%s", vgname, snap->name);
+          n_expired++;
+        }
+    }
+
+  if (n_expired > 0 && !data->dry_run)
+    (void) glvm_run_command (cmdline->str, NULL, &local_error);
+
+  ret = TRUE;
+  *out_result = g_variant_new ("(@a(ss)s)", g_variant_builder_end (&builder),
+                               local_error ? local_error->message : "");
+ out:
+  g_clear_error (&local_error);
+  if (cmdline)
+    g_string_free (cmdline, TRUE);
+  return ret;
+}
+
+gboolean
+rd_builtin_prune (int             argc,
+                  char          **argv,
+                  RdApp          *app,
+                  GCancellable   *cancellable,
+                  GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  GPtrArray *records;
+  PruneData data;
+  gs_unref_hashtable GHashTable *lvs_by_vg = NULL;
+  gs_unref_ptrarray GPtrArray *vgnames = NULL;
+  gs_unref_ptrarray GPtrArray *results = NULL;
+  guint n_removed = 0;
+  guint n_failed = 0;
+  guint i;
+
+  context = g_option_context_new ("Remove snapshots past their retention policy");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
+
+  memset (&data, 0, sizeof (data));
+  data.defaults.keep = opt_keep;
+  data.defaults.max_age = -1;
+  if (opt_keep < -1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --keep %d", opt_keep);
+      goto out;
+    }
+  if (opt_max_age && !rd_parse_age (opt_max_age, &data.defaults.max_age))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --max-age '%s'", opt_max_age);
+      goto out;
+    }
+  data.now = g_get_real_time () / G_USEC_PER_SEC;
+  data.dry_run = opt_dry_run;
+
+  records = rd_app_get_inventory (app, cancellable, error);
+  if (!records)
+    goto out;
+
+  if (records->len == 0)
+    {
+      g_print ("No LVs in the selected rollback sets; use add to select them\n");
+      ret = TRUE;
+      goto out;
+    }
+
+  rd_inventory_group_by_vg (records, &lvs_by_vg, &vgnames);
+  data.lvs_by_vg = lvs_by_vg;
+
+  if (!rd_run_vg_workers (vgnames, 0, prune_vg, NULL, &data,
+                          &results, cancellable, error))
+    goto out;
+
+  for (i = 0; i < results->len; i++)
+    {
+      RdVgWorkerResult *result = results->pdata[i];
+      gs_unref_variant GVariant *expired = NULL;
+      const char *errmsg;
+      GVariantIter iter;
+      const char *lvname;
+      const char *snapname;
+
+      if (result->error)
+        {
+          g_printerr ("%s: %s\n", result->vgname, result->error->message);
+          n_failed++;
+          continue;
+        }
+
+      g_variant_get (result->result, "(@a(ss)&s)", &expired, &errmsg);
+      g_variant_iter_init (&iter, expired);
+      while (g_variant_iter_loop (&iter, "(&s&s)", &lvname, &snapname))
+        {
+          if (opt_dry_run)
+            g_print ("Would remove %s/%s (snapshot of %s)\n", result->vgname, snapname, lvname);
+          else if (!*errmsg)
+            g_print ("Removed %s/%s (snapshot of %s)\n", result->vgname, snapname, lvname);
+        }
+
+      /* lvremove stops at the first failure, so which were removed is
+       * only known from LVM itself
+       */
+      if (*errmsg)
+        {
+          g_printerr ("%s: %s\n", result->vgname, errmsg);
+          n_failed++;
+        }
+      else
+        n_removed += g_variant_n_children (expired);
+    }
+
+  if (n_failed > 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to prune %u VG(s)", n_failed);
+      goto out;
+    }
+
+  if (!opt_dry_run)
+    g_print ("Pruned %u snapshot(s) across %u VG(s)\n", n_removed, vgnames->len);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -35,27 +35,30 @@ rd_builtin_remove (int             argc,
 {
   gboolean ret = FALSE;
   GOptionContext *context;
-  const char *lvname;
+  gs_strfreev char **vgnames = NULL;
 
-  context = g_option_context_new ("LVPATH: Remove logical volume LVPATH from rollback");
+  context = g_option_context_new ("LVPATH... - Remove logical volumes from rollback; LVPATH may be VG/* or another glob");
   g_option_context_add_group (context, rd_app_get_options (app));
 
   if (!g_option_context_parse (context, &argc, &argv, error))
     goto out;
 
-  if (argc == 0)
+  if (argc < 2)
     {
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVAL,
                            "Must specify LVPATH");
       goto out;
     }
-  lvname = argv[0];
 
-  if (!rd_tag_one_lv (rd_app_get_lvmh (app), lvname, FALSE,
-                      cancellable, error))
+  vgnames = rd_lvpaths_get_vgnames (argc - 1, argv + 1);
+  rd_app_set_scan_scope (app, (const char *const*)vgnames);
+
+  if (!rd_tag_lvs (rd_app_get_lvmh (app), argc - 1, argv + 1, FALSE,
+                   cancellable, error))
     goto out;
 
-  g_print ("Removed %s from rollback\n", lvname);
+  /* As for add, keeping the VGs' PVs current for later scoped scans */
+  rd_app_remember_vgs (app, (const char *const*)vgnames, FALSE);
 
   ret = TRUE;
  out:
@@ -0,0 +1,562 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+/* Bounds for polling merge progress */
+#define MERGE_POLL_MIN_USEC (20 * 1000)
+#define MERGE_POLL_MAX_USEC (1000 * 1000)
+
+static char *opt_timestamp;
+
+static GOptionEntry options[] = {
+  { "timestamp", 0, 0, G_OPTION_ARG_STRING, &opt_timestamp, "Merge the snapshots taken at TIMESTAMP, rather than each LV's latest", "TIMESTAMP" },
+  { NULL }
+};
+
+typedef struct {
+  GHashTable  *lvs_by_vg;
+  gint64       timestamp;   /* -1 for latest */
+} RollbackData;
+
+typedef struct {
+  const char  *lv_name;
+  const char  *origin;
+} SnapshotProps;
+
+static const GlvmPropSpec snapshot_props[] = {
+  { "lv_name", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (SnapshotProps, lv_name) },
+  { "origin", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_EMPTY_IS_NULL, G_STRUCT_OFFSET (SnapshotProps, origin) },
+};
+
+typedef struct {
+  const char  *lv_attr;
+} OriginProps;
+
+static const GlvmPropSpec origin_props[] = {
+  { "lv_attr", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (OriginProps, lv_attr) },
+};
+
+typedef struct {
+  RdLvRecord  *rec;
+  char        *snapname;
+  gint64       snaptime;
+  guint        snapserial;
+  char        *errmsg;
+  gboolean     started;
+  gboolean     deferred;
+} PlannedMerge;
+
+/* If @props describes a roller-derby snapshot of @lvname, return its
+ * timestamp and store its serial in @out_serial, otherwise -1.
+ */
+static gint64
+snapshot_timestamp (SnapshotProps  *props,
+                    const char     *lvname,
+                    guint          *out_serial)
+{
+  gs_free char *origin = NULL;
+  gint64 ts;
+
+  if (!props->origin || strcmp (props->origin, lvname) != 0)
+    return -1;
+  if (!rd_snapshot_name_parse (props->lv_name, &origin, &ts, out_serial)
+      || strcmp (origin, lvname) != 0)
+    return -1;
+  return ts;
+}
+
+/* Decide from the state lvconvert left behind whether @merge has
+ * begun.  An origin with a merge pending or in progress has 'O' as its
+ * volume type; only one in progress has the snapshot-merge target.
+ * A pending merge starts when the origin is next activated, e.g. on
+ * reboot, since the kernel cannot switch targets while it is open.
+ */
+static gboolean
+merge_is_deferred (vg_t            vg,
+                   PlannedMerge   *merge,
+                   gboolean       *out_deferred,
+                   GError        **error)
+{
+  gboolean ret = FALSE;
+  RdLvRecord *rec = merge->rec;
+  OriginProps props = { NULL };
+  gs_free char *target_type = NULL;
+  gs_free char *params = NULL;
+  lv_t lv;
+
+  lv = lvm_lv_from_name (vg, rec->lvname);
+  if (lv == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "%s: No such LV", rec->path);
+      goto out;
+    }
+  if (!glvm_lv_get_properties (lv, origin_props, G_N_ELEMENTS (origin_props),
+                               &props, NULL, error))
+    goto out;
+
+  /* Already finished by lvm's poller */
+  if (props.lv_attr[0] != 'O')
+    {
+      *out_deferred = FALSE;
+      ret = TRUE;
+      goto out;
+    }
+  if (rec->major < 0)
+    {
+      *out_deferred = TRUE;
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!glvm_dm_get_status (rec->major, rec->minor, &target_type, &params, error))
+    goto out;
+
+  ret = TRUE;
+  *out_deferred = strcmp (target_type, "snapshot-merge") != 0;
+ out:
+  return ret;
+}
+
+/* Runs in a worker process, one per VG.  Starts a merge for each
+ * record and returns without waiting for it; progress is tracked
+ * from device-mapper status by the parent.
+ *
+ * Returns a(sssb): origin LV, snapshot LV, an error message which is
+ * empty on success, and whether the merge is deferred until the
+ * origin is next activated.
+ */
+static gboolean
+rollback_vg (RdVgWorker        *worker,
+             lvm_t              lvmh,
+             const char        *vgname,
+             gpointer           user_data,
+             GVariant         **out_result,
+             GCancellable      *cancellable,
+             GError           **error)
+{
+  gboolean ret = FALSE;
+  RollbackData *data = user_data;
+  GPtrArray *records = g_hash_table_lookup (data->lvs_by_vg, vgname);
+  glvm_cleanup_vg vg_t vg = NULL;
+  PlannedMerge *planned = NULL;
+  struct dm_list *lvs;
+  struct lvm_lv_list *lvsl;
+  GVariantBuilder builder;
+  guint i;
+
+  vg = glvm_vg_open (lvmh, vgname, "r", GLVM_VG_OPEN_FLAGS_NONE, NULL,
+                     cancellable, error);
+  if (vg == NULL)
+    goto out;
+
+  planned = g_new0 (PlannedMerge, records->len);
+  for (i = 0; i < records->len; i++)
+    {
+      planned[i].rec = records->pdata[i];
+      planned[i].snaptime = -1;
+    }
+
+  lvs = lvm_vg_list_lvs (vg);
+  /* NULL if the VG has no LVs left */
+  if (lvs)
+    {
+      dm_list_iterate_items (lvsl, lvs)
+        {
+          SnapshotProps props = { NULL, NULL };
+
+          if (!glvm_lv_get_properties (lvsl->lv, snapshot_props, G_N_ELEMENTS (snapshot_props),
+                                       &props, NULL, error))
+            goto out;
+          if (!props.origin)
+            continue;
+
+          for (i = 0; i < records->len; i++)
+            {
+              PlannedMerge *merge = &planned[i];
+              guint serial;
+              gint64 ts = snapshot_timestamp (&props, merge->rec->lvname, &serial);
+
+              if (ts < 0 || (data->timestamp >= 0 && ts != data->timestamp))
+                continue;
+              if (ts > merge->snaptime
+                  || (ts == merge->snaptime && serial > merge->snapserial))
+                {
+                  g_free (merge->snapname);
+                  merge->snapname = g_strdup (props.lv_name);
+                  merge->snaptime = ts;
+                  merge->snapserial = serial;
+                }
+            }
+        }
+    }
+
+  /* lvconvert takes the VG lock itself */
+  lvm_vg_close (vg);
+  vg = NULL;
+
+  for (i = 0; i < records->len; i++)
+    {
+      PlannedMerge *merge = &planned[i];
+      GError *local_error = NULL;
+      gs_free char *cmdline = NULL;
+
+      if (!merge->snapname)
+        {
+          merge->errmsg = g_strdup ("No roller-derby snapshot found");
+          continue;
+        }
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      /* --background leaves finishing the merge (removing the snapshot
+       * LV) to lvm's own poller; we only need the kernel's progress.
+       */
+      cmdline = g_strdup_printf ("lvconvert --merge --background %s/%s",
+                                 vgname, merge->snapname);
+      if (!glvm_run_command (cmdline, NULL, &local_error))
+        {
+          merge->errmsg = g_strdup (local_error->message);
+          g_error_free (local_error);
+          continue;
+        }
+      merge->started = TRUE;
+    }
+
+  vg = glvm_vg_open (lvmh, vgname, "r", GLVM_VG_OPEN_FLAGS_NONE, NULL,
+                     cancellable, error);
+  if (vg == NULL)
+    goto out;
+
+  for (i = 0; i < records->len; i++)
+    {
+      PlannedMerge *merge = &planned[i];
+      GError *local_error = NULL;
+
+      if (!merge->started)
+        continue;
+      if (!merge_is_deferred (vg, merge, &merge->deferred, &local_error))
+        {
+          merge->errmsg = g_strdup_printf ("Merge started, but its state is unknown: %s",
+                                           local_error->message);
+          g_error_free (local_error);
+        }
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sssb)"));
+  for (i = 0; i < records->len; i++)
+    {
+      PlannedMerge *merge = &planned[i];
+      g_variant_builder_add (&builder, "(sssb)", merge->rec->lvname,
+                             merge->snapname ? merge->snapname : "",
+                             merge->errmsg ? merge->errmsg : "", merge->deferred);
+    }
+
+  ret = TRUE;
+  *out_result = g_variant_builder_end (&builder);
+ out:
+  if (planned)
+    {
+      for (i = 0; i < records->len; i++)
+        {
+          g_free (planned[i].snapname);
+          g_free (planned[i].errmsg);
+        }
+      g_free (planned);
+    }
+  return ret;
+}
+
+typedef struct {
+  RdLvRecord  *rec;
+  char        *snapname;
+  guint64      initial;     /* Sectors left to merge when first seen */
+  guint64      remaining;
+  int          percent;
+  gboolean     done;
+} ActiveMerge;
+
+static void
+active_merge_free (ActiveMerge *merge)
+{
+  g_free (merge->snapname);
+  g_free (merge);
+}
+
+/* A merging origin has a snapshot-merge target whose status is
+ * "<allocated>/<total> <metadata>" in sectors; the merge is complete
+ * when only the metadata remains allocated.  Once lvm's poller has
+ * finished up, the origin goes back to a plain target.
+ */
+static gboolean
+update_merge (ActiveMerge   *merge,
+              GError       **error)
+{
+  gboolean ret = FALSE;
+  gs_free char *target_type = NULL;
+  gs_free char *params = NULL;
+  guint64 allocated, total, metadata;
+
+  if (!glvm_dm_get_status (merge->rec->major, merge->rec->minor,
+                           &target_type, &params, error))
+    goto out;
+
+  if (strcmp (target_type, "snapshot-merge") != 0)
+    {
+      merge->remaining = 0;
+      merge->done = TRUE;
+      ret = TRUE;
+      goto out;
+    }
+
+  if (sscanf (params, "%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+              &allocated, &total, &metadata) != 3)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Merge of %s failed: %s", merge->rec->path, params);
+      goto out;
+    }
+
+  merge->remaining = allocated > metadata ? allocated - metadata : 0;
+  if (merge->initial == 0)
+    merge->initial = merge->remaining;
+  merge->done = merge->remaining == 0;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Poll all merges together.  The interval adapts to the observed
+ * merge rate, aiming for about ten polls over the remaining time:
+ * frequent enough to notice completion promptly, rare enough that
+ * large merges don't spin.
+ */
+static gboolean
+wait_for_merges (GPtrArray      *merges,
+                 GCancellable   *cancellable,
+                 GError        **error)
+{
+  gboolean ret = FALSE;
+  gint64 interval = MERGE_POLL_MIN_USEC;
+  gint64 last_time = 0;
+  guint64 last_remaining = 0;
+  guint n_active = merges->len;
+
+  while (n_active > 0)
+    {
+      guint64 remaining = 0;
+      gint64 now;
+      guint i;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      n_active = 0;
+      for (i = 0; i < merges->len; i++)
+        {
+          ActiveMerge *merge = merges->pdata[i];
+          int percent;
+
+          if (merge->done)
+            continue;
+
+          if (!update_merge (merge, error))
+            goto out;
+
+          percent = merge->initial > 0
+            ? (int)(100 * (merge->initial - merge->remaining) / merge->initial)
+            : 100;
+          if (merge->done)
+            g_print ("Merged %s/%s into %s\n", merge->rec->vgname,
+                     merge->snapname, merge->rec->path);
+          else if (percent != merge->percent)
+            g_print ("Merging %s: %d%%\n", merge->rec->path, percent);
+          merge->percent = percent;
+
+          if (!merge->done)
+            n_active++;
+          remaining += merge->remaining;
+        }
+
+      if (n_active == 0)
+        break;
+
+      now = g_get_monotonic_time ();
+      if (last_time > 0 && last_remaining > remaining)
+        {
+          gint64 eta = (now - last_time) * (remaining / (double)(last_remaining - remaining));
+          interval = CLAMP (eta / 10, MERGE_POLL_MIN_USEC, MERGE_POLL_MAX_USEC);
+        }
+      else if (last_time > 0)
+        interval = MIN (interval * 2, MERGE_POLL_MAX_USEC);
+      last_time = now;
+      last_remaining = remaining;
+
+      g_usleep (interval);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+gboolean
+rd_builtin_rollback (int             argc,
+                     char          **argv,
+                     RdApp          *app,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  GPtrArray *records;
+  RollbackData data;
+  gs_unref_hashtable GHashTable *lvs_by_vg = NULL;
+  gs_unref_ptrarray GPtrArray *vgnames = NULL;
+  gs_unref_ptrarray GPtrArray *results = NULL;
+  gs_unref_ptrarray GPtrArray *merges = NULL;
+  guint n_deferred = 0;
+  guint n_failed = 0;
+  gint64 start;
+  guint i;
+
+  context = g_option_context_new ("Merge snapshots back into all LVs selected for rollback");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
+
+  memset (&data, 0, sizeof (data));
+  data.timestamp = -1;
+  if (opt_timestamp)
+    {
+      char *end;
+      data.timestamp = g_ascii_strtoll (opt_timestamp, &end, 10);
+      if (end == opt_timestamp || *end != '\0' || data.timestamp < 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                       "Invalid --timestamp '%s'", opt_timestamp);
+          goto out;
+        }
+    }
+
+  start = g_get_monotonic_time ();
+
+  records = rd_app_get_inventory (app, cancellable, error);
+  if (!records)
+    goto out;
+
+  if (records->len == 0)
+    {
+      g_print ("No LVs in the selected rollback sets; use add to select them\n");
+      ret = TRUE;
+      goto out;
+    }
+
+  rd_inventory_group_by_vg (records, &lvs_by_vg, &vgnames);
+  data.lvs_by_vg = lvs_by_vg;
+
+  /* Merges in different VGs are independent; start them all at once */
+  if (!rd_run_vg_workers (vgnames, 0, rollback_vg, NULL, &data,
+                          &results, cancellable, error))
+    goto out;
+
+  merges = g_ptr_array_new_with_free_func ((GDestroyNotify)active_merge_free);
+  for (i = 0; i < results->len; i++)
+    {
+      RdVgWorkerResult *result = results->pdata[i];
+      GPtrArray *vg_records = g_hash_table_lookup (lvs_by_vg, result->vgname);
+      GVariantIter iter;
+      const char *lvname;
+      const char *snapname;
+      const char *errmsg;
+      gboolean deferred;
+      guint j = 0;
+
+      if (result->error)
+        {
+          g_printerr ("%s: %s\n", result->vgname, result->error->message);
+          n_failed += vg_records->len;
+          continue;
+        }
+
+      g_variant_iter_init (&iter, result->result);
+      while (g_variant_iter_loop (&iter, "(&s&s&sb)", &lvname, &snapname, &errmsg, &deferred))
+        {
+          RdLvRecord *rec = vg_records->pdata[j++];
+
+          if (*errmsg)
+            {
+              g_printerr ("%s/%s: %s\n", result->vgname, lvname, errmsg);
+              n_failed++;
+            }
+          else if (deferred || rec->major < 0)
+            {
+              g_print ("Merge of %s/%s into %s will happen when it is next activated\n",
+                       result->vgname, snapname, rec->path);
+              n_deferred++;
+            }
+          else
+            {
+              ActiveMerge *merge = g_new0 (ActiveMerge, 1);
+              merge->rec = rec;
+              merge->snapname = g_strdup (snapname);
+              merge->percent = -1;
+              g_ptr_array_add (merges, merge);
+            }
+        }
+    }
+
+  if (!wait_for_merges (merges, cancellable, error))
+    goto out;
+
+  g_print ("Rolled back %u LV(s), %u deferred, across %u VG(s) in %.1f s\n",
+           merges->len, n_deferred, vgnames->len,
+           (g_get_monotonic_time () - start) / (double)G_USEC_PER_SEC);
+
+  if (n_failed > 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to roll back %u LV(s)", n_failed);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
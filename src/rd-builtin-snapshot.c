@@ -0,0 +1,707 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <linux/fs.h>
+
+#include "rd-main.h"
+#include "libgsystem.h"
+
+static int opt_size_percent = 20;
+static int opt_sample_secs;
+static char *opt_retention;
+static gboolean opt_freeze;
+static int opt_freeze_timeout = 30;
+
+static GOptionEntry options[] = {
+  { "size-percent", 0, 0, G_OPTION_ARG_INT, &opt_size_percent, "Size of each classic snapshot as a percentage of its origin (default 20)", "PERCENT" },
+  { "sample-secs", 0, 0, G_OPTION_ARG_INT, &opt_sample_secs, "Size classic snapshots and their chunks from SECS of observed origin writes, rather than --size-percent", "SECS" },
+  { "retention", 0, 0, G_OPTION_ARG_STRING, &opt_retention, "With --sample-secs, how long snapshots are expected to be kept (e.g. 12h, 7d; default 1d)", "AGE" },
+  { "freeze", 0, 0, G_OPTION_ARG_NONE, &opt_freeze, "Freeze mounted filesystems while their snapshots are taken; needs Linux 6.8 or newer, older kernels only get the freeze done by device-mapper suspend", NULL },
+  { "freeze-timeout", 0, 0, G_OPTION_ARG_INT, &opt_freeze_timeout, "With --freeze, kill snapshot workers and thaw after SECS (default 30)", "SECS" },
+  { NULL }
+};
+
+typedef struct {
+  char        *path;
+  int          fd;
+  gboolean     frozen;
+  gint64       freeze_time;
+  gint64       thaw_time;
+  int          sync_errno;
+} FrozenFs;
+
+typedef struct {
+  GHashTable  *lvs_by_vg;
+  GHashTable  *estimates;   /* RdLvRecord -> CowEstimate */
+  gint64       timestamp;
+  GPtrArray   *filesystems;
+  sigset_t     saved_sigmask;
+} SnapshotData;
+
+typedef struct {
+  guint64      size;
+  guint32      chunk_size;
+} CowEstimate;
+
+typedef struct {
+  lv_t         lv;
+  char        *snapname;
+  guint64      size;
+  char        *command;     /* lvcreate, for a chunk size lvm2app cannot do */
+  const char  *errmsg;
+  GError      *cmd_error;
+  guint64      usec;
+} PreparedSnapshot;
+
+static void
+frozen_fs_free (FrozenFs *fs)
+{
+  if (fs->fd != -1)
+    (void) close (fs->fd);
+  g_free (fs->path);
+  g_free (fs);
+}
+
+/* Runs in a worker process, one per VG.  Everything that can be done
+ * ahead of time is, so the only work between rd_vg_worker_sync() and
+ * rd_vg_worker_notify_done() is the snapshot creation itself.
+ *
+ * Returns a(sstbs): origin LV, snapshot LV, creation time in
+ * microseconds, whether it is a thin snapshot, and an error message
+ * which is empty on success.
+ */
+static gboolean
+snapshot_vg (RdVgWorker        *worker,
+             lvm_t              lvmh,
+             const char        *vgname,
+             gpointer           user_data,
+             GVariant         **out_result,
+             GCancellable      *cancellable,
+             GError           **error)
+{
+  gboolean ret = FALSE;
+  SnapshotData *data = user_data;
+  GPtrArray *records = g_hash_table_lookup (data->lvs_by_vg, vgname);
+  glvm_cleanup_vg vg_t vg = NULL;
+  PreparedSnapshot *prepared = NULL;
+  GVariantBuilder builder;
+  guint n_commands = 0;
+  guint i;
+
+  /* With filesystems frozen, writing the metadata backup and archive
+   * under /etc/lvm could block forever on a frozen root; backup_vgs()
+   * catches up after the thaw.  An override replaces the previous one,
+   * so keep the handle's own settings.
+   */
+  if (data->filesystems)
+    {
+      gs_free char *base_config = rd_lvm_get_config ();
+      gs_free char *config = g_strconcat (base_config, " backup { backup = 0 archive = 0 }", NULL);
+
+      if (lvm_config_override (lvmh, config) == -1)
+        {
+          glvm_set_error (error, lvmh);
+          goto out;
+        }
+    }
+
+  vg = glvm_vg_open (lvmh, vgname, "w", GLVM_VG_OPEN_FLAGS_NONE, NULL,
+                     cancellable, error);
+  if (vg == NULL)
+    goto out;
+
+  prepared = g_new0 (PreparedSnapshot, records->len);
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      PreparedSnapshot *snap = &prepared[i];
+      CowEstimate *estimate = NULL;
+
+      snap->snapname = rd_vg_new_snapshot_name (vg, rec->lvname, data->timestamp);
+      /* A size of zero asks lvm2app for a thin snapshot: metadata-only,
+       * allocated from the origin's pool, with no COW penalty on origin
+       * writes.  Thick LVs get a classic COW snapshot, of at least one
+       * extent so that a small LV's is not taken for thin.
+       */
+      if (rec->thin)
+        snap->size = 0;
+      else
+        {
+          if ((estimate = g_hash_table_lookup (data->estimates, rec)) != NULL)
+            snap->size = estimate->size;
+          else
+            snap->size = rec->size / 100 * opt_size_percent;
+          snap->size = MAX (snap->size, lvm_vg_get_extent_size (vg));
+        }
+      snap->errmsg = "";
+      snap->lv = lvm_lv_from_name (vg, rec->lvname);
+      if (snap->lv == NULL)
+        snap->errmsg = "No such LV";
+
+      /* lvm2app always uses the default chunk size.  lvcreate takes the
+       * VG lock and writes the metadata archive itself, so it can only
+       * run once the VG is closed, and not under a freeze.
+       */
+      if (snap->lv && estimate && !data->filesystems
+          && estimate->chunk_size != RD_COW_DEFAULT_CHUNK_SIZE)
+        {
+          snap->command = g_strdup_printf ("lvcreate --snapshot --size %" G_GUINT64_FORMAT "k"
+                                           " --chunksize %uk --name %s %s/%s",
+                                           (snap->size + 1023) / 1024,
+                                           estimate->chunk_size / 1024,
+                                           snap->snapname, vgname, rec->lvname);
+          n_commands++;
+        }
+    }
+
+  if (!rd_vg_worker_sync (worker, error))
+    goto out;
+
+  for (i = 0; i < records->len; i++)
+    {
+      PreparedSnapshot *snap = &prepared[i];
+      gint64 start;
+
+      if (snap->lv == NULL || snap->command)
+        continue;
+
+      start = g_get_monotonic_time ();
+      if (lvm_lv_snapshot (snap->lv, snap->snapname, snap->size) == NULL)
+        snap->errmsg = g_strerror (lvm_errno (lvmh));
+      snap->usec = g_get_monotonic_time () - start;
+    }
+
+  if (n_commands > 0)
+    {
+      lvm_vg_close (vg);
+      vg = NULL;
+    }
+
+  for (i = 0; i < records->len; i++)
+    {
+      PreparedSnapshot *snap = &prepared[i];
+      gint64 start;
+
+      if (!snap->command)
+        continue;
+
+      start = g_get_monotonic_time ();
+      if (!glvm_run_command (snap->command, NULL, &snap->cmd_error))
+        snap->errmsg = snap->cmd_error->message;
+      snap->usec = g_get_monotonic_time () - start;
+    }
+
+  rd_vg_worker_notify_done (worker);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sstbs)"));
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      PreparedSnapshot *snap = &prepared[i];
+
+      g_variant_builder_add (&builder, "(sstbs)", rec->lvname, snap->snapname,
+                             snap->usec, rec->thin, snap->errmsg);
+    }
+
+  ret = TRUE;
+  *out_result = g_variant_builder_end (&builder);
+ out:
+  if (prepared)
+    {
+      for (i = 0; i < records->len; i++)
+        {
+          g_free (prepared[i].snapname);
+          g_free (prepared[i].command);
+          g_clear_error (&prepared[i].cmd_error);
+        }
+      g_free (prepared);
+    }
+  return ret;
+}
+
+static gpointer
+syncfs_thread (gpointer data)
+{
+  FrozenFs *fs = data;
+
+  if (syncfs (fs->fd) == -1)
+    fs->sync_errno = errno;
+  return NULL;
+}
+
+/* Flush every filesystem concurrently, so the freeze itself has as
+ * little dirty data left to write as possible.
+ */
+static gboolean
+sync_filesystems (GPtrArray     *filesystems,
+                  GError       **error)
+{
+  gboolean ret = FALSE;
+  GThread **threads = g_new0 (GThread *, filesystems->len);
+  guint i;
+
+  for (i = 0; i < filesystems->len; i++)
+    threads[i] = g_thread_new ("syncfs", syncfs_thread, filesystems->pdata[i]);
+  for (i = 0; i < filesystems->len; i++)
+    g_thread_join (threads[i]);
+
+  for (i = 0; i < filesystems->len; i++)
+    {
+      FrozenFs *fs = filesystems->pdata[i];
+      if (fs->sync_errno != 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (fs->sync_errno),
+                       "syncfs(%s): %s", fs->path, g_strerror (fs->sync_errno));
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  g_free (threads);
+  return ret;
+}
+
+static void
+thaw_filesystems (gpointer user_data)
+{
+  SnapshotData *data = user_data;
+  guint i;
+
+  for (i = 0; i < data->filesystems->len; i++)
+    {
+      FrozenFs *fs = data->filesystems->pdata[i];
+      int res;
+
+      if (!fs->frozen)
+        continue;
+
+      do
+        res = ioctl (fs->fd, FITHAW, 0);
+      while (res == -1 && errno == EINTR);
+      fs->thaw_time = g_get_monotonic_time ();
+      if (res == -1)
+        g_printerr ("Failed to thaw %s: %s\n", fs->path, g_strerror (errno));
+      fs->frozen = FALSE;
+    }
+
+  (void) sigprocmask (SIG_SETMASK, &data->saved_sigmask, NULL);
+}
+
+/* Called once every worker is prepared.  Signals that would kill us
+ * are held off until everything is thawed again.
+ */
+static gboolean
+freeze_filesystems (gpointer      user_data,
+                    GError      **error)
+{
+  SnapshotData *data = user_data;
+  sigset_t blocked;
+  guint i;
+
+  sigemptyset (&blocked);
+  sigaddset (&blocked, SIGINT);
+  sigaddset (&blocked, SIGTERM);
+  sigaddset (&blocked, SIGHUP);
+  (void) sigprocmask (SIG_BLOCK, &blocked, &data->saved_sigmask);
+
+  for (i = 0; i < data->filesystems->len; i++)
+    {
+      FrozenFs *fs = data->filesystems->pdata[i];
+      int res;
+
+      do
+        res = ioctl (fs->fd, FIFREEZE, 0);
+      while (res == -1 && errno == EINTR);
+      if (res == -1)
+        {
+          int errsv = errno;
+          thaw_filesystems (data);
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                       "Failed to freeze %s: %s", fs->path, g_strerror (errsv));
+          return FALSE;
+        }
+      fs->frozen = TRUE;
+      fs->freeze_time = g_get_monotonic_time ();
+    }
+
+  return TRUE;
+}
+
+/* Sample the write counters of every active classic origin across one
+ * window of @window_secs, and size its snapshot from them.  Origins
+ * whose counters cannot be read keep the --size-percent default.
+ */
+static gboolean
+estimate_cow_sizes (GPtrArray      *records,
+                    gint            window_secs,
+                    gint64          retention_secs,
+                    GHashTable     *estimates,
+                    GCancellable   *cancellable,
+                    GError        **error)
+{
+  gboolean ret = FALSE;
+  RdBlockStat *before = g_new0 (RdBlockStat, records->len);
+  gboolean *sampled = g_new0 (gboolean, records->len);
+  GPollFD cancel_pollfd = { -1, G_IO_IN, 0 };
+  gint64 start;
+  gint64 window;
+  guint i;
+
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      GError *local_error = NULL;
+
+      if (rec->thin || rec->major < 0)
+        continue;
+      if (!rd_block_stat_read (rec->major, rec->minor, &before[i], &local_error))
+        {
+          g_printerr ("%s: %s\n", rec->path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+      sampled[i] = TRUE;
+    }
+  start = g_get_monotonic_time ();
+
+  if (cancellable && g_cancellable_make_pollfd (cancellable, &cancel_pollfd))
+    {
+      (void) g_poll (&cancel_pollfd, 1, window_secs * 1000);
+      g_cancellable_release_fd (cancellable);
+    }
+  else
+    g_usleep ((gulong)window_secs * G_USEC_PER_SEC);
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  window = g_get_monotonic_time () - start;
+
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      GError *local_error = NULL;
+      RdBlockStat after;
+      CowEstimate *estimate;
+
+      if (!sampled[i])
+        continue;
+      if (!rd_block_stat_read (rec->major, rec->minor, &after, &local_error))
+        {
+          g_printerr ("%s: %s\n", rec->path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      estimate = g_new0 (CowEstimate, 1);
+      rd_cow_estimate (rec->size, &before[i], &after, window, retention_secs,
+                       &estimate->size, &estimate->chunk_size);
+      g_hash_table_insert (estimates, rec, estimate);
+
+      g_print ("%s: %.1f KiB/s written in %" G_GUINT64_FORMAT " writes; "
+               "snapshot of %" G_GUINT64_FORMAT " MiB with %u KiB chunks\n",
+               rec->path,
+               (after.write_sectors - before[i].write_sectors) * 512.0 / 1024
+               * G_USEC_PER_SEC / window,
+               after.write_ios - before[i].write_ios,
+               estimate->size / (1024 * 1024),
+               estimate->chunk_size / 1024);
+    }
+
+  ret = TRUE;
+ out:
+  g_free (before);
+  g_free (sampled);
+  return ret;
+}
+
+/* Before Linux 6.8 a filesystem could only be frozen once, so the
+ * device-mapper suspend lvm does for each snapshot fails with EBUSY on
+ * one already frozen through FIFREEZE.
+ */
+static gboolean
+kernel_can_freeze_twice (void)
+{
+  struct utsname uts;
+  guint major = 0;
+  guint minor = 0;
+
+  if (uname (&uts) == -1
+      || sscanf (uts.release, "%u.%u", &major, &minor) != 2)
+    return FALSE;
+  return major > 6 || (major == 6 && minor >= 8);
+}
+
+/* The snapshot workers run with metadata backups off, since writing
+ * them under /etc/lvm could block on a frozen root; catch up now that
+ * everything is thawed.
+ */
+static gboolean
+backup_vgs (GPtrArray     *vgnames,
+            GError       **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+
+  for (i = 0; i < vgnames->len; i++)
+    {
+      gs_free char *cmdline = g_strdup_printf ("vgcfgbackup %s",
+                                               (char*)vgnames->pdata[i]);
+
+      if (!glvm_run_command (cmdline, NULL, error))
+        {
+          g_prefix_error (error, "Backing up metadata of VG %s: ",
+                          (char*)vgnames->pdata[i]);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+open_filesystems (GPtrArray     *records,
+                  GPtrArray    **out_filesystems,
+                  GError       **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_ptrarray GPtrArray *ret_filesystems = NULL;
+  guint i;
+
+  ret_filesystems = g_ptr_array_new_with_free_func ((GDestroyNotify)frozen_fs_free);
+
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      FrozenFs *fs;
+
+      if (rec->mount_path == NULL)
+        continue;
+
+      fs = g_new0 (FrozenFs, 1);
+      fs->path = g_strdup (rec->mount_path);
+      fs->fd = open (fs->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      g_ptr_array_add (ret_filesystems, fs);
+      if (fs->fd == -1)
+        {
+          int errsv = errno;
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                       "Failed to open %s: %s", fs->path, g_strerror (errsv));
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+  gs_transfer_out_value (out_filesystems, &ret_filesystems);
+ out:
+  return ret;
+}
+
+gboolean
+rd_builtin_snapshot (int             argc,
+                     char          **argv,
+                     RdApp          *app,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  GPtrArray *records;
+  SnapshotData data;
+  gs_unref_ptrarray GPtrArray *filesystems = NULL;
+  gs_unref_hashtable GHashTable *lvs_by_vg = NULL;
+  gs_unref_hashtable GHashTable *estimates = NULL;
+  gs_unref_ptrarray GPtrArray *vgnames = NULL;
+  gs_unref_ptrarray GPtrArray *results = NULL;
+  RdVgWorkerHooks freeze_hooks = { freeze_filesystems, thaw_filesystems, 0 };
+  gint64 retention = 24 * 60 * 60;
+  guint n_created = 0;
+  guint n_failed = 0;
+  gint64 start;
+  guint i;
+
+  context = g_option_context_new ("Snapshot all LVs selected for rollback");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, rd_app_get_options (app));
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Unexpected argument '%s'", argv[1]);
+      goto out;
+    }
+
+  if (opt_size_percent <= 0 || opt_size_percent > 100)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --size-percent %d", opt_size_percent);
+      goto out;
+    }
+  if (opt_sample_secs < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --sample-secs %d", opt_sample_secs);
+      goto out;
+    }
+  if (opt_freeze_timeout <= 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --freeze-timeout %d", opt_freeze_timeout);
+      goto out;
+    }
+  if (opt_retention && !rd_parse_age (opt_retention, &retention))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                   "Invalid --retention '%s'", opt_retention);
+      goto out;
+    }
+
+  start = g_get_monotonic_time ();
+
+  records = rd_app_get_inventory (app, cancellable, error);
+  if (!records)
+    goto out;
+
+  if (records->len == 0)
+    {
+      g_print ("No LVs in the selected rollback sets; use add to select them\n");
+      ret = TRUE;
+      goto out;
+    }
+
+  rd_inventory_group_by_vg (records, &lvs_by_vg, &vgnames);
+
+  /* Before syncing, which would show up as a burst of writes */
+  estimates = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  if (opt_sample_secs > 0
+      && !estimate_cow_sizes (records, opt_sample_secs, retention, estimates,
+                              cancellable, error))
+    goto out;
+
+  if (opt_freeze && !kernel_can_freeze_twice ())
+    g_printerr ("This kernel cannot freeze a filesystem twice; relying on "
+                "the freeze done by device-mapper suspend\n");
+  else if (opt_freeze)
+    {
+      if (!open_filesystems (records, &filesystems, error))
+        goto out;
+      if (!sync_filesystems (filesystems, error))
+        goto out;
+    }
+
+  memset (&data, 0, sizeof (data));
+  data.lvs_by_vg = lvs_by_vg;
+  data.estimates = estimates;
+  data.timestamp = g_get_real_time () / G_USEC_PER_SEC;
+  data.filesystems = filesystems;
+  /* A worker stuck in lvm would otherwise keep everything frozen, with
+   * the signals that could end it blocked.
+   */
+  freeze_hooks.done_timeout_usec = (gint64)opt_freeze_timeout * G_USEC_PER_SEC;
+
+  /* VG metadata updates are serialized by LVM anyway, so there's
+   * nothing to gain from more than one worker per VG.
+   */
+  if (!rd_run_vg_workers (vgnames, 0, snapshot_vg,
+                          filesystems ? &freeze_hooks : NULL, &data,
+                          &results, cancellable, error))
+    goto out;
+
+  if (filesystems && !backup_vgs (vgnames, error))
+    goto out;
+
+  for (i = 0; i < results->len; i++)
+    {
+      RdVgWorkerResult *result = results->pdata[i];
+      GPtrArray *vg_records = g_hash_table_lookup (lvs_by_vg, result->vgname);
+      GVariantIter iter;
+      const char *lvname;
+      const char *snapname;
+      guint64 usec;
+      gboolean thin;
+      const char *errmsg;
+
+      if (result->lock_wait_usec > 0)
+        g_print ("Waited %.1f ms for the lock on VG %s\n",
+                 result->lock_wait_usec / 1000.0, result->vgname);
+
+      if (result->error)
+        {
+          g_printerr ("%s: %s\n", result->vgname, result->error->message);
+          n_failed += vg_records->len;
+          continue;
+        }
+
+      g_variant_iter_init (&iter, result->result);
+      while (g_variant_iter_loop (&iter, "(&s&stb&s)", &lvname, &snapname, &usec, &thin, &errmsg))
+        {
+          if (*errmsg)
+            {
+              g_printerr ("%s/%s: %s\n", result->vgname, lvname, errmsg);
+              n_failed++;
+            }
+          else
+            {
+              g_print ("Created %s snapshot %s/%s from %s/%s in %.1f ms\n",
+                       thin ? "thin" : "classic",
+                       result->vgname, snapname, result->vgname, lvname,
+                       usec / 1000.0);
+              n_created++;
+            }
+        }
+    }
+
+  for (i = 0; filesystems && i < filesystems->len; i++)
+    {
+      FrozenFs *fs = filesystems->pdata[i];
+      g_print ("Froze %s for %" G_GINT64_FORMAT " us\n", fs->path,
+               fs->thaw_time - fs->freeze_time);
+    }
+
+  g_print ("Created %u snapshot(s) across %u VG(s) in %.1f ms\n",
+           n_created, vgnames->len,
+           (g_get_monotonic_time () - start) / 1000.0);
+
+  if (n_failed > 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to snapshot %u LV(s)", n_failed);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -0,0 +1,254 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+/* The cache file is a single serialized GVariant: a format version,
+ * then one entry per VG sorted by UUID, holding the VG's metadata
+ * sequence number and the selected LVs as of that sequence number.
+ * It is mapped and read in place; lookups are a binary search over
+ * the entries, so a hit costs no parsing.  The data is not trusted,
+ * so a corrupt file only causes misses.
+ */
+#define RD_INVENTORY_CACHE_VERSION 3
+#define RD_INVENTORY_CACHE_ENTRY_TYPE "(st" RD_INVENTORY_CACHE_LVS_TYPE ")"
+#define RD_INVENTORY_CACHE_TYPE "(ua" RD_INVENTORY_CACHE_ENTRY_TYPE ")"
+
+struct _RdInventoryCache {
+  char        *path;
+  GVariant    *entries;    /* Array of entries from the file */
+  GHashTable  *seen;       /* UUID -> entry, for every VG looked up or updated */
+  gboolean     dirty;
+};
+
+/**
+ * rd_inventory_cache_new:
+ * @path: Cache file; need not exist
+ *
+ * Returns: A cache backed by @path.  A missing or unreadable file is
+ * an empty cache.
+ */
+RdInventoryCache *
+rd_inventory_cache_new (const char *path)
+{
+  RdInventoryCache *cache = g_new0 (RdInventoryCache, 1);
+  GMappedFile *mapped;
+
+  cache->path = g_strdup (path);
+  cache->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)g_variant_unref);
+
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  if (mapped)
+    {
+      GVariant *file;
+      guint32 version;
+
+      file = g_variant_new_from_data (G_VARIANT_TYPE (RD_INVENTORY_CACHE_TYPE),
+                                      g_mapped_file_get_contents (mapped),
+                                      g_mapped_file_get_length (mapped),
+                                      FALSE,
+                                      (GDestroyNotify)g_mapped_file_unref, mapped);
+      g_variant_ref_sink (file);
+      g_variant_get_child (file, 0, "u", &version);
+      if (version == RD_INVENTORY_CACHE_VERSION)
+        cache->entries = g_variant_get_child_value (file, 1);
+      g_variant_unref (file);
+    }
+
+  return cache;
+}
+
+void
+rd_inventory_cache_free (RdInventoryCache *cache)
+{
+  g_free (cache->path);
+  if (cache->entries)
+    g_variant_unref (cache->entries);
+  g_hash_table_unref (cache->seen);
+  g_free (cache);
+}
+
+/**
+ * rd_inventory_cache_lookup:
+ * @vg_uuid: UUID of an open VG
+ * @seqno: Its current metadata sequence number
+ *
+ * Returns: (transfer full): The VG's LVs, of type
+ * %RD_INVENTORY_CACHE_LVS_TYPE, if they were cached at @seqno;
+ * otherwise %NULL.
+ */
+GVariant *
+rd_inventory_cache_lookup (RdInventoryCache  *cache,
+                           const char        *vg_uuid,
+                           guint64            seqno)
+{
+  gsize lo = 0;
+  gsize hi;
+
+  if (!cache->entries)
+    return NULL;
+
+  hi = g_variant_n_children (cache->entries);
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      const char *uuid;
+      guint64 entry_seqno;
+      GVariant *lvs;
+      int cmp;
+
+      g_variant_get_child (cache->entries, mid, "(&st@" RD_INVENTORY_CACHE_LVS_TYPE ")",
+                           &uuid, &entry_seqno, &lvs);
+      cmp = strcmp (vg_uuid, uuid);
+      if (cmp == 0)
+        {
+          if (entry_seqno != seqno)
+            {
+              g_variant_unref (lvs);
+              return NULL;
+            }
+          g_hash_table_replace (cache->seen, g_strdup (vg_uuid),
+                                g_variant_get_child_value (cache->entries, mid));
+          return lvs;
+        }
+      g_variant_unref (lvs);
+      if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+/**
+ * rd_inventory_cache_update:
+ * @lvs: (transfer none): The VG's LVs, of type %RD_INVENTORY_CACHE_LVS_TYPE
+ *
+ * Record @lvs as the contents of @vg_uuid at @seqno, after a miss.
+ */
+void
+rd_inventory_cache_update (RdInventoryCache  *cache,
+                           const char        *vg_uuid,
+                           guint64            seqno,
+                           GVariant          *lvs)
+{
+  GVariant *entry = g_variant_new ("(st@" RD_INVENTORY_CACHE_LVS_TYPE ")",
+                                   vg_uuid, seqno, lvs);
+
+  g_hash_table_replace (cache->seen, g_strdup (vg_uuid),
+                        g_variant_ref_sink (entry));
+  cache->dirty = TRUE;
+}
+
+static int
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (*(char**)a, *(char**)b);
+}
+
+/**
+ * rd_inventory_cache_save:
+ * @keep_unseen: If %FALSE, VGs not looked up or updated since @cache
+ * was loaded are dropped; pass %TRUE if not every VG was scanned
+ *
+ * Atomically replace the cache file, if anything changed.
+ */
+gboolean
+rd_inventory_cache_save (RdInventoryCache  *cache,
+                         gboolean           keep_unseen,
+                         GError           **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_hashtable GHashTable *entries =
+    g_hash_table_new (g_str_hash, g_str_equal);
+  gs_unref_ptrarray GPtrArray *kept =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  gs_unref_ptrarray GPtrArray *uuids = g_ptr_array_new ();
+  gs_unref_variant GVariant *file = NULL;
+  gs_free char *dirname = NULL;
+  GVariantBuilder builder;
+  GHashTableIter hiter;
+  gpointer key, value;
+  gsize n_old = cache->entries ? g_variant_n_children (cache->entries) : 0;
+  gsize i;
+
+  /* Every cached VG still there, and unchanged */
+  if (!cache->dirty && (keep_unseen || g_hash_table_size (cache->seen) == n_old))
+    return TRUE;
+
+  g_hash_table_iter_init (&hiter, cache->seen);
+  while (g_hash_table_iter_next (&hiter, &key, &value))
+    g_hash_table_insert (entries, key, value);
+
+  for (i = 0; keep_unseen && i < n_old; i++)
+    {
+      GVariant *entry = g_variant_get_child_value (cache->entries, i);
+      const char *uuid;
+
+      g_ptr_array_add (kept, entry);
+      g_variant_get_child (entry, 0, "&s", &uuid);
+      if (!g_hash_table_contains (entries, uuid))
+        g_hash_table_insert (entries, (char*)uuid, entry);
+    }
+
+  g_hash_table_iter_init (&hiter, entries);
+  while (g_hash_table_iter_next (&hiter, &key, NULL))
+    g_ptr_array_add (uuids, key);
+  g_ptr_array_sort (uuids, compare_strings);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" RD_INVENTORY_CACHE_ENTRY_TYPE));
+  for (i = 0; i < uuids->len; i++)
+    g_variant_builder_add_value (&builder, g_hash_table_lookup (entries, uuids->pdata[i]));
+  file = g_variant_new ("(u@a" RD_INVENTORY_CACHE_ENTRY_TYPE ")",
+                        (guint32)RD_INVENTORY_CACHE_VERSION,
+                        g_variant_builder_end (&builder));
+  g_variant_ref_sink (file);
+
+  dirname = g_path_get_dirname (cache->path);
+  if (g_mkdir_with_parents (dirname, 0755) == -1)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "%s: %s", dirname, g_strerror (errsv));
+      goto out;
+    }
+  /* Written to a temporary file and renamed, so a reader still
+   * mapping the old one is unaffected.
+   */
+  if (!g_file_set_contents (cache->path, g_variant_get_data (file),
+                            g_variant_get_size (file), error))
+    goto out;
+
+  ret = TRUE;
+  cache->dirty = FALSE;
+ out:
+  return ret;
+}
@@ -0,0 +1,835 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+static RdInventoryBackend inventory_backend = RD_INVENTORY_BACKEND_REPORT;
+static guint scan_jobs = RD_INVENTORY_DEFAULT_SCAN_JOBS;
+static char *cache_path;
+static gboolean cache_path_set;
+
+/**
+ * rd_inventory_set_backend:
+ *
+ * Choose how the inventory is read: by default from a single
+ * "lvm lvs" JSON report, or optionally through lvm2app, one VG at a
+ * time.
+ */
+void
+rd_inventory_set_backend (RdInventoryBackend backend)
+{
+  inventory_backend = backend;
+}
+
+RdInventoryBackend
+rd_inventory_get_backend (void)
+{
+  return inventory_backend;
+}
+
+/**
+ * rd_inventory_set_scan_jobs:
+ * @n_jobs: Maximum number of VGs to open at once; 0 for no limit
+ *
+ * With the lvm2app backend, VGs are opened in parallel worker
+ * processes, each with its own lvm handle.  1 opens them one at a time
+ * in this process.
+ */
+void
+rd_inventory_set_scan_jobs (guint n_jobs)
+{
+  scan_jobs = n_jobs;
+}
+
+/**
+ * rd_inventory_set_cache_path:
+ * @path: (allow-none): Where to cache VG contents, or %NULL for no cache
+ *
+ * The lvm2app backend remembers each VG's selected LVs by VG UUID and
+ * metadata sequence number, by default in %RD_INVENTORY_CACHE_PATH,
+ * and only reads the LVs of VGs that changed since.
+ */
+void
+rd_inventory_set_cache_path (const char *path)
+{
+  g_free (cache_path);
+  cache_path = g_strdup (path);
+  cache_path_set = TRUE;
+}
+
+static const char *
+get_cache_path (void)
+{
+  return cache_path_set ? cache_path : RD_INVENTORY_CACHE_PATH;
+}
+
+void
+rd_lv_record_free (RdLvRecord *rec)
+{
+  g_free (rec->vgname);
+  g_free (rec->lvname);
+  g_free (rec->path);
+  g_free (rec->pool_lv);
+  g_strfreev (rec->tags);
+  g_free (rec->mount_path);
+  g_free (rec->mount_fs);
+  g_strfreev (rec->sets);
+  g_free (rec);
+}
+
+/**
+ * rd_parse_age:
+ * @str: A number of seconds, optionally with an s, m, h, d or w suffix
+ * @out_secs: (out): The age in seconds
+ *
+ * Returns: %TRUE if @str is a valid age
+ */
+gboolean
+rd_parse_age (const char  *str,
+              gint64      *out_secs)
+{
+  char *end;
+  gint64 value;
+
+  value = g_ascii_strtoll (str, &end, 10);
+  if (end == str || value < 0)
+    return FALSE;
+
+  switch (*end)
+    {
+    case '\0':
+    case 's':
+      break;
+    case 'm':
+      value *= 60;
+      break;
+    case 'h':
+      value *= 60 * 60;
+      break;
+    case 'd':
+      value *= 24 * 60 * 60;
+      break;
+    case 'w':
+      value *= 7 * 24 * 60 * 60;
+      break;
+    default:
+      return FALSE;
+    }
+  if (*end != '\0' && end[1] != '\0')
+    return FALSE;
+
+  *out_secs = value;
+  return TRUE;
+}
+
+/* Returns the value of string property @propname, or NULL if it is
+ * unset, empty, or unknown to this version of LVM.
+ */
+static const char *
+lv_get_nonempty_string (lv_t          lv,
+                        const char   *propname)
+{
+  struct lvm_property_value prop = lvm_lv_get_property (lv, propname);
+
+  if (prop.is_valid && prop.is_string
+      && prop.value.string != NULL && prop.value.string[0] != '\0')
+    return prop.value.string;
+  return NULL;
+}
+
+/**
+ * rd_lv_attr_is_thin:
+ * @lv_attr: (allow-none): An LV's lv_attr
+ *
+ * Its first character is the volume type, 'V' exactly for LVs of
+ * segtype "thin".  segtype itself is a segment field rather than an
+ * LV property, which lvs would report once per segment.  pool_lv is no
+ * substitute, being set for cached LVs too.
+ *
+ * Returns: %TRUE if the LV is thin-provisioned
+ */
+gboolean
+rd_lv_attr_is_thin (const char *lv_attr)
+{
+  return lv_attr != NULL && lv_attr[0] == 'V';
+}
+
+/**
+ * rd_lv_is_selectable:
+ *
+ * Whether an LV name pattern should match @lv.  Snapshots, and
+ * pools and the hidden LVs making up pools, mirrors and RAID (told
+ * apart by the volume type in lv_attr), are not rolled back in their
+ * own right; naming one explicitly still works.
+ */
+gboolean
+rd_lv_is_selectable (lv_t    lv)
+{
+  const char *attr;
+
+  if (lv_get_nonempty_string (lv, "origin") != NULL)
+    return FALSE;
+  attr = lv_get_nonempty_string (lv, "lv_attr");
+  return attr == NULL || strchr ("sSvptTeiIldD", attr[0]) == NULL;
+}
+
+static gboolean
+lv_is_snapshot (lv_t    lv)
+{
+  return lv_get_nonempty_string (lv, "origin") != NULL;
+}
+
+static char **
+tag_list_to_strv (struct dm_list    *tags)
+{
+  GPtrArray *ret = g_ptr_array_new ();
+  struct lvm_str_list *tagl;
+
+  dm_list_iterate_items (tagl, tags)
+    g_ptr_array_add (ret, g_strdup (tagl->str));
+  g_ptr_array_add (ret, NULL);
+
+  return (char**)g_ptr_array_free (ret, FALSE);
+}
+
+/* Only what lvm2app has no direct getter for; name and size are read
+ * with lvm_lv_get_name() and lvm_lv_get_size(), which need no report
+ * machinery.
+ */
+static const GlvmPropSpec lv_record_props[] = {
+  { "pool_lv", GLVM_PROP_STRING, GLVM_PROP_FLAGS_OPTIONAL | GLVM_PROP_FLAGS_EMPTY_IS_NULL,
+    G_STRUCT_OFFSET (RdLvRecord, pool_lv) },
+};
+
+/* @dm_devices maps device-mapper names to #GlvmDmDevice; an LV is
+ * active exactly when its device is there.  Inactive LVs have no
+ * device node; they're still part of the inventory, just never
+ * mounted.
+ */
+static void
+record_set_device (RdLvRecord        *rec,
+                   RdMountTable      *mountcache,
+                   GHashTable        *dm_devices)
+{
+  gs_free char *dmname = glvm_dm_build_name (rec->vgname, rec->lvname);
+  GlvmDmDevice *dev = g_hash_table_lookup (dm_devices, dmname);
+  const char *mount_path;
+  const char *mount_fs;
+
+  rec->major = rec->minor = -1;
+  if (!dev)
+    return;
+
+  rec->major = dev->major;
+  rec->minor = dev->minor;
+  if (rd_mount_table_lookup (mountcache, makedev (rec->major, rec->minor),
+                             &mount_path, &mount_fs))
+    {
+      rec->mount_path = g_strdup (mount_path);
+      rec->mount_fs = g_strdup (mount_fs);
+    }
+}
+
+/* The part of a record that comes from VG metadata, in the form the
+ * cache stores it.
+ */
+static gboolean
+cache_entry_from_lv (lv_t               lv,
+                     char             **vg_tags,
+                     GVariant         **out_entry,
+                     GError           **error)
+{
+  gboolean ret = FALSE;
+  RdLvRecord *rec = g_new0 (RdLvRecord, 1);
+  char *no_sets[] = { NULL };
+
+  rec->lvname = g_strdup (lvm_lv_get_name (lv));
+  rec->size = lvm_lv_get_size (lv);
+  if (!glvm_lv_get_properties (lv, lv_record_props, G_N_ELEMENTS (lv_record_props),
+                               rec, NULL, error))
+    goto out;
+  rec->thin = rd_lv_attr_is_thin (lv_get_nonempty_string (lv, "lv_attr"));
+  rec->tags = tag_list_to_strv (lvm_lv_get_tags (lv));
+  rec->sets = rd_sets_from_tags ((const char *const*)vg_tags,
+                                 (const char *const*)rec->tags);
+
+  ret = TRUE;
+  *out_entry = g_variant_new ("(stbms^as^as)", rec->lvname, rec->size,
+                              rec->thin, rec->pool_lv, rec->tags,
+                              rec->sets ? rec->sets : no_sets);
+ out:
+  rd_lv_record_free (rec);
+  return ret;
+}
+
+static RdLvRecord *
+record_from_cache_entry (RdMountTable      *mountcache,
+                         GHashTable        *dm_devices,
+                         const char        *vgname,
+                         GVariant          *entry)
+{
+  RdLvRecord *rec = g_new0 (RdLvRecord, 1);
+
+  g_variant_get (entry, "(stbms^as^as)", &rec->lvname, &rec->size,
+                 &rec->thin, &rec->pool_lv, &rec->tags, &rec->sets);
+  rec->vgname = g_strdup (vgname);
+  rec->path = g_strconcat (vgname, "/", rec->lvname, NULL);
+  record_set_device (rec, mountcache, dm_devices);
+  return rec;
+}
+
+/* Report fields are comma-separated lists, possibly empty */
+static char **
+split_report_list (const char *value)
+{
+  if (!value || !*value)
+    return g_new0 (char *, 1);
+  return g_strsplit (value, ",", -1);
+}
+
+typedef struct {
+  RdMountTable     *mountcache;
+  GPtrArray        *records;
+  RdLvRecordFunc    func;
+  gpointer          user_data;
+  GCancellable     *cancellable;
+} ReportScan;
+
+static gboolean
+record_from_report_row (GHashTable   *row,
+                        gpointer      user_data,
+                        GError      **error)
+{
+  ReportScan *scan = user_data;
+  const char *vgname = g_hash_table_lookup (row, "vg_name");
+  const char *lvname = g_hash_table_lookup (row, "lv_name");
+  const char *origin = g_hash_table_lookup (row, "origin");
+  const char *pool_lv = g_hash_table_lookup (row, "pool_lv");
+  const char *size = g_hash_table_lookup (row, "lv_size");
+  const char *major = g_hash_table_lookup (row, "lv_kernel_major");
+  const char *minor = g_hash_table_lookup (row, "lv_kernel_minor");
+  gs_strfreev char **vg_tags = NULL;
+  RdLvRecord *rec;
+  const char *mount_path;
+  const char *mount_fs;
+
+  if (g_cancellable_set_error_if_cancelled (scan->cancellable, error))
+    return FALSE;
+
+  if (!vgname || !lvname || !size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "LV report is missing required fields");
+      return FALSE;
+    }
+
+  /* Snapshots are what we create, never what we select */
+  if (origin && *origin)
+    return TRUE;
+
+  rec = g_new0 (RdLvRecord, 1);
+  rec->tags = split_report_list (g_hash_table_lookup (row, "lv_tags"));
+  vg_tags = split_report_list (g_hash_table_lookup (row, "vg_tags"));
+  rec->sets = rd_sets_from_tags ((const char *const*)vg_tags,
+                                 (const char *const*)rec->tags);
+  if (!rec->sets)
+    {
+      rd_lv_record_free (rec);
+      return TRUE;
+    }
+
+  rec->vgname = g_strdup (vgname);
+  rec->lvname = g_strdup (lvname);
+  rec->path = g_strconcat (vgname, "/", lvname, NULL);
+  rec->size = g_ascii_strtoull (size, NULL, 10);
+  rec->pool_lv = pool_lv && *pool_lv ? g_strdup (pool_lv) : NULL;
+  rec->thin = rd_lv_attr_is_thin (g_hash_table_lookup (row, "lv_attr"));
+  rec->major = major ? (gint)g_ascii_strtoll (major, NULL, 10) : -1;
+  rec->minor = minor ? (gint)g_ascii_strtoll (minor, NULL, 10) : -1;
+  if (rec->major < 0 || rec->minor < 0)
+    rec->major = rec->minor = -1;
+  else if (rd_mount_table_lookup (scan->mountcache, makedev (rec->major, rec->minor),
+                                  &mount_path, &mount_fs))
+    {
+      rec->mount_path = g_strdup (mount_path);
+      rec->mount_fs = g_strdup (mount_fs);
+    }
+
+  if (scan->records)
+    {
+      g_ptr_array_add (scan->records, rec);
+      return TRUE;
+    }
+  else
+    {
+      gboolean ok = scan->func (rec, scan->user_data, error);
+      rd_lv_record_free (rec);
+      return ok;
+    }
+}
+
+/* One lvm process reports every LV along with its VG's tags and its
+ * kernel device number, replacing the per-VG and per-LV lvm2app
+ * calls.
+ */
+static gboolean
+list_lvs_from_report (RdMountTable      *mountcache,
+                      GPtrArray         *records,
+                      RdLvRecordFunc     func,
+                      gpointer           user_data,
+                      GCancellable      *cancellable,
+                      GError           **error)
+{
+  static const char *const fields[] = {
+    "vg_name", "vg_tags", "lv_name", "lv_tags", "lv_size", "lv_attr",
+    "origin", "pool_lv", "lv_kernel_major", "lv_kernel_minor", NULL
+  };
+  ReportScan scan = { mountcache, records, func, user_data, cancellable };
+  gs_free char *config = rd_scan_get_config ();
+
+  return glvm_report_run ("lvs", "lv", fields, config,
+                          record_from_report_row, &scan, cancellable, error);
+}
+
+/* Each record is either appended to @records, or if that is %NULL,
+ * passed to @func and freed straight away.
+ */
+static gboolean
+emit_record (RdLvRecord       *rec,
+             GPtrArray        *records,
+             RdLvRecordFunc    func,
+             gpointer          user_data,
+             GError          **error)
+{
+  gboolean ok;
+
+  if (records)
+    {
+      g_ptr_array_add (records, rec);
+      return TRUE;
+    }
+
+  ok = func (rec, user_data, error);
+  rd_lv_record_free (rec);
+  return ok;
+}
+
+/* Read the selected LVs of @vgname, from the cache if its metadata
+ * has not changed since.  This is the only part of the lvm2app scan
+ * that touches the lvm handle, so it can run in a worker.
+ */
+static gboolean
+read_vg (lvm_t               lvmh,
+         RdInventoryCache   *cache,
+         const char         *vgname,
+         char              **out_uuid,
+         guint64            *out_seqno,
+         gboolean           *out_cached,
+         GVariant          **out_lvs,
+         GError            **error)
+{
+  gboolean ret = FALSE;
+  glvm_cleanup_vg vg_t vg = NULL;
+  struct dm_list *tags;
+  struct dm_list *lvs;
+  struct lvm_lv_list *lvsl;
+  gboolean include_entire_vg = FALSE;
+  gs_strfreev char **vg_tags = NULL;
+  const char *uuid;
+  guint64 seqno;
+  GVariant *ret_lvs = NULL;
+  GVariantBuilder builder;
+
+  vg = glvm_vg_open (lvmh, vgname, "r", GLVM_VG_OPEN_FLAGS_NONE, NULL, NULL, error);
+  if (vg == NULL)
+    goto out;
+
+  uuid = lvm_vg_get_uuid (vg);
+  seqno = lvm_vg_get_seqno (vg);
+
+  if (cache)
+    ret_lvs = rd_inventory_cache_lookup (cache, uuid, seqno);
+  if (ret_lvs)
+    {
+      ret = TRUE;
+      *out_cached = TRUE;
+      goto done;
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (RD_INVENTORY_CACHE_LVS_TYPE));
+
+  /* Every LV in some rollback set is read, whichever sets are
+   * selected, so the cache serves any selection.
+   */
+  tags = lvm_vg_get_tags (vg);
+  include_entire_vg = rd_sets_tag_list_has_set (tags);
+  if (include_entire_vg)
+    vg_tags = tag_list_to_strv (tags);
+
+  lvs = lvm_vg_list_lvs (vg);
+  /* NULL for a VG with no LVs */
+  if (lvs)
+    {
+      dm_list_iterate_items (lvsl, lvs)
+        {
+          lv_t lv = lvsl->lv;
+          gboolean matches;
+          GVariant *entry;
+
+          /* Snapshots are what we create, never what we select */
+          if (lv_is_snapshot (lv))
+            continue;
+
+          if (include_entire_vg)
+            {
+              matches = TRUE;
+            }
+          else
+            {
+              tags = lvm_lv_get_tags (lv);
+              matches = rd_sets_tag_list_has_set (tags);
+            }
+
+          if (!matches)
+            continue;
+
+          if (!cache_entry_from_lv (lv, vg_tags, &entry, error))
+            {
+              g_variant_builder_clear (&builder);
+              goto out;
+            }
+          g_variant_builder_add_value (&builder, entry);
+        }
+    }
+
+  ret = TRUE;
+  *out_cached = FALSE;
+  ret_lvs = g_variant_ref_sink (g_variant_builder_end (&builder));
+ done:
+  *out_uuid = g_strdup (uuid);
+  *out_seqno = seqno;
+  *out_lvs = ret_lvs;
+ out:
+  return ret;
+}
+
+typedef struct {
+  RdMountTable      *mountcache;
+  GHashTable        *dm_devices;
+  RdInventoryCache  *cache;
+  GPtrArray         *records;
+  RdLvRecordFunc     func;
+  gpointer           user_data;
+} ScanData;
+
+static gboolean
+emit_vg (ScanData     *scan,
+         const char   *vgname,
+         const char   *uuid,
+         guint64       seqno,
+         gboolean      cached,
+         GVariant     *lvs,
+         GError      **error)
+{
+  GVariantIter iter;
+  GVariant *entry;
+
+  if (scan->cache && !cached)
+    rd_inventory_cache_update (scan->cache, uuid, seqno, lvs);
+
+  g_variant_iter_init (&iter, lvs);
+  while ((entry = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      RdLvRecord *rec = record_from_cache_entry (scan->mountcache, scan->dm_devices,
+                                                 vgname, entry);
+      g_variant_unref (entry);
+
+      if (!emit_record (rec, scan->records, scan->func, scan->user_data, error))
+        return FALSE;
+    }
+  return TRUE;
+}
+
+/* Runs in a forked worker, with its own lvm handle, and the parent's
+ * cache mapping inherited across fork().
+ */
+static gboolean
+read_vg_worker (RdVgWorker        *worker,
+                lvm_t              lvmh,
+                const char        *vgname,
+                gpointer           user_data,
+                GVariant         **out_result,
+                GCancellable      *cancellable,
+                GError           **error)
+{
+  ScanData *scan = user_data;
+  gs_free char *uuid = NULL;
+  guint64 seqno;
+  gboolean cached;
+  gs_unref_variant GVariant *lvs = NULL;
+
+  if (!read_vg (lvmh, scan->cache, vgname, &uuid, &seqno, &cached, &lvs, error))
+    return FALSE;
+
+  *out_result = g_variant_new ("(stb@" RD_INVENTORY_CACHE_LVS_TYPE ")",
+                               uuid, seqno, cached, lvs);
+  return TRUE;
+}
+
+/* Read each VG in a worker process, at most scan_jobs at a time, and
+ * emit the records in @vgnames order once all are done.
+ */
+static gboolean
+scan_vgs_parallel (ScanData          *scan,
+                   GPtrArray         *vgnames,
+                   GCancellable      *cancellable,
+                   GError           **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_ptrarray GPtrArray *results = NULL;
+  guint i;
+
+  if (!rd_run_vg_workers (vgnames, scan_jobs, read_vg_worker, NULL, scan,
+                          &results, cancellable, error))
+    goto out;
+
+  for (i = 0; i < results->len; i++)
+    {
+      RdVgWorkerResult *result = results->pdata[i];
+      const char *uuid;
+      guint64 seqno;
+      gboolean cached;
+      gs_unref_variant GVariant *lvs = NULL;
+
+      if (result->error)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "%s: %s", result->vgname, result->error->message);
+          goto out;
+        }
+
+      g_variant_get (result->result, "(&stb@" RD_INVENTORY_CACHE_LVS_TYPE ")",
+                     &uuid, &seqno, &cached, &lvs);
+
+      /* The worker's lookup only marked the entry as still in use in
+       * its own copy of the cache.
+       */
+      if (cached && scan->cache)
+        {
+          GVariant *hit = rd_inventory_cache_lookup (scan->cache, uuid, seqno);
+          if (hit)
+            g_variant_unref (hit);
+        }
+
+      if (!emit_vg (scan, result->vgname, uuid, seqno, cached, lvs, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+list_lvs_to_snapshot (lvm_t              lvmh,
+                      RdMountTable      *mountcache,
+                      GPtrArray         *records,
+                      RdLvRecordFunc     func,
+                      gpointer           user_data,
+                      GCancellable      *cancellable,
+                      GError           **error)
+{
+  gboolean ret = FALSE;
+  struct dm_list *vgnames_list = NULL;
+  struct lvm_str_list *strl;
+  gs_unref_ptrarray GPtrArray *vgnames = g_ptr_array_new ();
+  gs_unref_ptrarray GPtrArray *dm_list = NULL;
+  gs_unref_hashtable GHashTable *dm_devices = NULL;
+  RdInventoryCache *cache = NULL;
+  ScanData scan;
+  guint i;
+  GlvmTimer timer;
+
+  if (inventory_backend == RD_INVENTORY_BACKEND_REPORT)
+    return list_lvs_from_report (mountcache, records, func, user_data,
+                                 cancellable, error);
+
+  g_return_val_if_fail (lvmh != NULL, FALSE);
+
+  /* One ioctl gives every active LV's dev_t, rather than asking LVM
+   * whether each is active and stat()ing its /dev node.
+   */
+  if (!glvm_dm_list_devices (&dm_list, error))
+    goto out;
+  dm_devices = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < dm_list->len; i++)
+    {
+      GlvmDmDevice *dev = dm_list->pdata[i];
+      g_hash_table_insert (dm_devices, dev->name, dev);
+    }
+
+  if (get_cache_path ())
+    cache = rd_inventory_cache_new (get_cache_path ());
+
+  scan.mountcache = mountcache;
+  scan.dm_devices = dm_devices;
+  scan.cache = cache;
+  scan.records = records;
+  scan.func = func;
+  scan.user_data = user_data;
+
+  GLVM_TRACE_BEGIN (timer, lvm_list_vgs, NULL);
+  vgnames_list = lvm_list_vg_names (lvmh);
+  GLVM_TRACE_END (timer, lvm_list_vgs, NULL);
+  dm_list_iterate_items (strl, vgnames_list)
+    g_ptr_array_add (vgnames, (char*)strl->str);
+
+  /* A VG whose PVs are slow to read would hold up every VG after it,
+   * so with more than one, open them concurrently.
+   */
+  if (scan_jobs != 1 && vgnames->len > 1)
+    {
+      if (!scan_vgs_parallel (&scan, vgnames, cancellable, error))
+        goto out;
+    }
+  else
+    {
+      for (i = 0; i < vgnames->len; i++)
+        {
+          const char *vgname = vgnames->pdata[i];
+          gs_free char *uuid = NULL;
+          guint64 seqno;
+          gboolean cached;
+          gs_unref_variant GVariant *lvs = NULL;
+
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            goto out;
+
+          if (!read_vg (lvmh, cache, vgname, &uuid, &seqno, &cached, &lvs, error))
+            goto out;
+          if (!emit_vg (&scan, vgname, uuid, seqno, cached, lvs, error))
+            goto out;
+        }
+    }
+
+  /* A stale or unwritable cache only costs speed */
+  if (cache)
+    (void) rd_inventory_cache_save (cache, rd_scan_is_scoped (), NULL);
+
+  ret = TRUE;
+ out:
+  if (cache)
+    rd_inventory_cache_free (cache);
+  return ret;
+}
+
+/**
+ * rd_inventory_scan:
+ * @lvmh: (allow-none): Only used by %RD_INVENTORY_BACKEND_LVM2APP
+ *
+ * Build one #RdLvRecord for every LV selected for rollback, opening
+ * each VG exactly once.
+ */
+gboolean
+rd_inventory_scan (lvm_t              lvmh,
+                   RdMountTable      *mountcache,
+                   GPtrArray        **out_records,
+                   GCancellable      *cancellable,
+                   GError           **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_ptrarray GPtrArray *ret_records = NULL;
+
+  ret_records = g_ptr_array_new_with_free_func ((GDestroyNotify)rd_lv_record_free);
+
+  if (!list_lvs_to_snapshot (lvmh, mountcache, ret_records, NULL, NULL,
+                             cancellable, error))
+    goto out;
+
+  ret = TRUE;
+  gs_transfer_out_value (out_records, &ret_records);
+ out:
+  return ret;
+}
+
+/**
+ * rd_inventory_foreach:
+ * @func: Called for each record as soon as it is built
+ *
+ * Like rd_inventory_scan(), but streams records to @func instead of
+ * collecting them, so memory use does not grow with the number of
+ * LVs.  The record is only valid for the duration of the call.
+ */
+gboolean
+rd_inventory_foreach (lvm_t              lvmh,
+                      RdMountTable      *mountcache,
+                      RdLvRecordFunc     func,
+                      gpointer           user_data,
+                      GCancellable      *cancellable,
+                      GError           **error)
+{
+  return list_lvs_to_snapshot (lvmh, mountcache, NULL, func, user_data,
+                               cancellable, error);
+}
+
+/**
+ * rd_inventory_group_by_vg:
+ * @out_lvs_by_vg: (out): Map from VG name to a #GPtrArray of its records
+ * @out_vgnames: (out): VG names, in the order they first appear
+ *
+ * Split @records by VG, e.g. for rd_run_vg_workers().  Names and
+ * records are borrowed from @records.
+ */
+void
+rd_inventory_group_by_vg (GPtrArray     *records,
+                          GHashTable   **out_lvs_by_vg,
+                          GPtrArray    **out_vgnames)
+{
+  GHashTable *lvs_by_vg;
+  GPtrArray *vgnames;
+  guint i;
+
+  lvs_by_vg = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                     (GDestroyNotify)g_ptr_array_unref);
+  vgnames = g_ptr_array_new ();
+  for (i = 0; i < records->len; i++)
+    {
+      RdLvRecord *rec = records->pdata[i];
+      GPtrArray *vg_records = g_hash_table_lookup (lvs_by_vg, rec->vgname);
+
+      if (!vg_records)
+        {
+          vg_records = g_ptr_array_new ();
+          g_hash_table_insert (lvs_by_vg, rec->vgname, vg_records);
+          g_ptr_array_add (vgnames, rec->vgname);
+        }
+      g_ptr_array_add (vg_records, rec);
+    }
+
+  *out_lvs_by_vg = lvs_by_vg;
+  *out_vgnames = vgnames;
+}
@@ -0,0 +1,149 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+/* The kernel counts sectors in the stat file in 512-byte units,
+ * whatever the device's own sector size.
+ */
+#define RD_STAT_SECTOR_SIZE 512
+
+/* Bounds on the chunk size for classic snapshots, per lvcreate */
+#define RD_COW_MAX_CHUNK_SIZE (512 * 1024)
+
+/* Each chunk copied to the COW area also costs an exception record */
+#define RD_COW_EXCEPTION_SIZE 16
+
+/* The estimate assumes every write in the retention period lands on a
+ * chunk not yet copied; keep this much on top, as a fraction, for
+ * bursts above the sampled rate.
+ */
+#define RD_COW_HEADROOM 0.5
+
+/* Never go below this, so that an idle sample does not produce a
+ * snapshot that the first burst invalidates.
+ */
+#define RD_COW_MIN_SIZE (64 * 1024 * 1024)
+
+/**
+ * rd_block_stat_read:
+ *
+ * Read the write counters of block device @major:@minor from
+ * /sys/dev/block/MAJ:MIN/stat.
+ */
+gboolean
+rd_block_stat_read (gint           major,
+                    gint           minor,
+                    RdBlockStat   *out_stat,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+  gs_free char *path = g_strdup_printf ("/sys/dev/block/%d:%d/stat", major, minor);
+  gs_free char *contents = NULL;
+  guint64 fields[7];
+  char *p;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    goto out;
+
+  /* Reads: ios, merges, sectors, ticks; then writes: ios, merges,
+   * sectors, ...
+   */
+  p = contents;
+  for (i = 0; i < G_N_ELEMENTS (fields); i++)
+    {
+      char *end;
+
+      fields[i] = g_ascii_strtoull (p, &end, 10);
+      if (end == p)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Malformed %s", path);
+          goto out;
+        }
+      p = end;
+    }
+
+  ret = TRUE;
+  out_stat->write_ios = fields[4];
+  out_stat->write_sectors = fields[6];
+ out:
+  return ret;
+}
+
+/**
+ * rd_cow_estimate:
+ * @origin_size: Size of the origin LV in bytes
+ * @before: Counters of the origin at the start of the sample window
+ * @after: Counters at the end
+ * @window_usec: Length of the sample window
+ * @retention_secs: How long the snapshot is expected to be kept
+ * @out_cow_size: (out): Size for the snapshot's COW area, in bytes
+ * @out_chunk_size: (out): Chunk size, in bytes
+ *
+ * Size a classic snapshot from the origin's observed writes.  The chunk
+ * is the smallest power of two covering the average write, so that a
+ * typical write copies one chunk and little more than it changed.  The
+ * COW area then holds the sampled write rate for @retention_secs,
+ * scaled by that over-copy, plus the exception records and headroom;
+ * it never needs to be larger than a full copy of the origin.
+ */
+void
+rd_cow_estimate (guint64             origin_size,
+                 const RdBlockStat  *before,
+                 const RdBlockStat  *after,
+                 gint64              window_usec,
+                 gint64              retention_secs,
+                 guint64            *out_cow_size,
+                 guint32            *out_chunk_size)
+{
+  guint64 n_writes = after->write_ios - before->write_ios;
+  guint64 written = (after->write_sectors - before->write_sectors) * RD_STAT_SECTOR_SIZE;
+  guint64 avg_write = n_writes > 0 ? written / n_writes : 0;
+  guint32 chunk_size = RD_COW_DEFAULT_CHUNK_SIZE;
+  double rate;
+  double copied;
+  double size;
+  double max_size;
+
+  while (chunk_size < avg_write && chunk_size < RD_COW_MAX_CHUNK_SIZE)
+    chunk_size *= 2;
+
+  rate = window_usec > 0 ? (double)written * G_USEC_PER_SEC / window_usec : 0;
+  copied = rate * retention_secs;
+  if (avg_write > 0 && avg_write < chunk_size)
+    copied *= (double)chunk_size / avg_write;
+
+  size = copied * (1 + RD_COW_HEADROOM);
+  size += size / chunk_size * RD_COW_EXCEPTION_SIZE + chunk_size;
+
+  max_size = (double)origin_size
+    + (double)origin_size / chunk_size * RD_COW_EXCEPTION_SIZE + chunk_size;
+  size = CLAMP (size, MIN (RD_COW_MIN_SIZE, max_size), max_size);
+
+  *out_cow_size = (guint64)size;
+  *out_chunk_size = chunk_size;
+}
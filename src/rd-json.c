@@ -0,0 +1,83 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "rd.h"
+
+/**
+ * rd_json_append_string:
+ *
+ * Append @str to @buf as a quoted JSON string, or "null" if @str is
+ * %NULL.  Bytes that are not valid UTF-8 (LV and mount names are
+ * arbitrary bytes) are replaced by U+FFFD.
+ */
+void
+rd_json_append_string (GString     *buf,
+                       const char  *str)
+{
+  const char *p;
+  const char *end;
+
+  if (str == NULL)
+    {
+      g_string_append (buf, "null");
+      return;
+    }
+
+  end = str + strlen (str);
+  g_string_append_c (buf, '"');
+  for (p = str; p < end; )
+    {
+      guchar c = *p;
+
+      if (c == '"' || c == '\\')
+        {
+          g_string_append_c (buf, '\\');
+          g_string_append_c (buf, c);
+          p++;
+        }
+      else if (c < 0x20)
+        {
+          g_string_append_printf (buf, "\\u%04x", c);
+          p++;
+        }
+      else if (c < 0x80)
+        {
+          g_string_append_c (buf, c);
+          p++;
+        }
+      else if (g_utf8_get_char_validated (p, end - p) < (gunichar)-2)
+        {
+          gsize len = g_utf8_skip[c];
+          g_string_append_len (buf, p, len);
+          p += len;
+        }
+      else
+        {
+          g_string_append (buf, "\xef\xbf\xbd");
+          p++;
+        }
+    }
+  g_string_append_c (buf, '"');
+}
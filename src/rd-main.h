@@ -32,17 +32,44 @@ typedef struct _RdApp RdApp;
 
 typedef gboolean (*RdBuiltinFunc) (int, char **, RdApp *, GCancellable *, GError **);
 
+typedef enum {
+  RD_BUILTIN_FLAG_READONLY = (1 << 0),   /* Never modifies LVM state */
+  RD_BUILTIN_FLAG_INVENTORY = (1 << 1),  /* Uses the tagged-LV inventory */
+  RD_BUILTIN_FLAG_LOCAL = (1 << 2)       /* Never forwarded to the daemon */
+} RdBuiltinFlags;
+
 typedef struct {
   const char     *name;
   RdBuiltinFunc   func;
   int             flags;
 } RdBuiltin;
 
+RdBuiltin *rd_app_lookup_builtin (const char *name);
+RdBuiltin *rd_app_parse_builtin (RdApp          *app,
+                                 int            *argc,
+                                 char         ***argv,
+                                 GError        **error);
+void       rd_app_reset_options (RdApp *app);
+gboolean   rd_app_apply_options (RdApp    *app,
+                                 GError  **error);
+void       rd_app_invalidate (RdApp     *app,
+                              gboolean   mounts);
+
+gboolean rd_daemon_client_run (int      argc,
+                               char   **argv,
+                               int     *out_exit_status);
+
 gboolean rd_builtin_list (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
 gboolean rd_builtin_add (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
 gboolean rd_builtin_remove (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
 gboolean rd_builtin_add_vg (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
 gboolean rd_builtin_remove_vg (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
 gboolean rd_builtin_snapshot (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
+gboolean rd_builtin_rollback (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
+gboolean rd_builtin_prune (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
+gboolean rd_builtin_plan (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
+gboolean rd_builtin_apply (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
+gboolean rd_builtin_monitor (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
+gboolean rd_builtin_daemon (int argc, char **argv, RdApp *app, GCancellable *cancellable, GError **error);
 
 G_END_DECLS
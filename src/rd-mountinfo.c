@@ -0,0 +1,250 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/sysmacros.h>
+
+#include "rd.h"
+
+/* The table is a single copy of mountinfo, with the fields we care
+ * about NUL-terminated and unescaped in place, plus an array of
+ * entries pointing into it sorted by device.  The only allocations
+ * are the buffer and the entry array.
+ */
+typedef struct {
+  dev_t        dev;
+  guint        line;
+  const char  *mount_point;
+  const char  *fstype;
+} RdMountEntry;
+
+struct _RdMountTable {
+  char          *buf;
+  RdMountEntry  *entries;
+  guint          n_entries;
+};
+
+/* Advance to the start of the next space-separated field, terminating
+ * the current one.  Returns NULL at end of line.
+ */
+static char *
+next_field (char *p)
+{
+  p = strchr (p, ' ');
+  if (!p)
+    return NULL;
+  *p = '\0';
+  return p + 1;
+}
+
+static gboolean
+is_octal (char c)
+{
+  return c >= '0' && c <= '7';
+}
+
+/* The kernel escapes space, tab, newline and backslash in mount paths
+ * as \ooo; decoding only ever shrinks the string, so do it in place.
+ */
+static void
+unescape_octal (char *s)
+{
+  char *out = s;
+
+  while (*s)
+    {
+      if (s[0] == '\\' && is_octal (s[1]) && is_octal (s[2]) && is_octal (s[3]))
+        {
+          *out++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+          s += 4;
+        }
+      else
+        *out++ = *s++;
+    }
+  *out = '\0';
+}
+
+/* Fields: mount ID, parent ID, major:minor, root, mount point,
+ * options, zero or more optional fields, "-", fstype, source,
+ * superblock options.
+ */
+static gboolean
+parse_line (char          *line,
+            RdMountEntry  *entry)
+{
+  char *fields[5];
+  char *p = line;
+  char *end;
+  guint i;
+  unsigned long maj, min;
+
+  for (i = 0; i < G_N_ELEMENTS (fields); i++)
+    {
+      if (!p)
+        return FALSE;
+      fields[i] = p;
+      p = next_field (p);
+    }
+
+  maj = strtoul (fields[2], &end, 10);
+  if (*end != ':')
+    return FALSE;
+  min = strtoul (end + 1, &end, 10);
+  if (*end != '\0')
+    return FALSE;
+
+  /* Skip the options and optional fields up to the separator */
+  while (p && !(p[0] == '-' && p[1] == ' '))
+    {
+      p = strchr (p, ' ');
+      if (p)
+        p++;
+    }
+  if (!p)
+    return FALSE;
+  p += 2;
+
+  entry->fstype = p;
+  (void) next_field (p);
+
+  unescape_octal (fields[4]);
+  entry->mount_point = fields[4];
+  entry->dev = makedev (maj, min);
+
+  return TRUE;
+}
+
+static int
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  const RdMountEntry *ea = a;
+  const RdMountEntry *eb = b;
+
+  if (ea->dev != eb->dev)
+    return ea->dev < eb->dev ? -1 : 1;
+  return ea->line < eb->line ? -1 : (ea->line > eb->line);
+}
+
+/**
+ * rd_mount_table_new_from_file:
+ * @path: Path to a file in /proc/PID/mountinfo format
+ */
+RdMountTable *
+rd_mount_table_new_from_file (const char    *path,
+                              GError       **error)
+{
+  RdMountTable *ret = NULL;
+  char *buf = NULL;
+  gsize len;
+  guint n_lines = 0;
+  guint n_entries = 0;
+  RdMountEntry *entries;
+  char *line;
+  char *p;
+  GlvmTimer timer;
+
+  GLVM_TRACE_BEGIN (timer, mountinfo, path);
+
+  if (!g_file_get_contents (path, &buf, &len, error))
+    {
+      GLVM_TRACE_END (timer, mountinfo, path);
+      return NULL;
+    }
+
+  for (p = buf; (p = memchr (p, '\n', len - (p - buf))) != NULL; p++)
+    n_lines++;
+
+  entries = g_new (RdMountEntry, n_lines + 1);
+
+  for (line = buf; line < buf + len; line = p + 1)
+    {
+      p = memchr (line, '\n', len - (line - buf));
+      if (!p)
+        p = buf + len;
+      *p = '\0';
+
+      if (parse_line (line, &entries[n_entries]))
+        {
+          entries[n_entries].line = n_entries;
+          n_entries++;
+        }
+    }
+
+  qsort (entries, n_entries, sizeof (RdMountEntry), compare_entries);
+
+  ret = g_new0 (RdMountTable, 1);
+  ret->buf = buf;
+  ret->entries = entries;
+  ret->n_entries = n_entries;
+  GLVM_TRACE_END (timer, mountinfo, path);
+  return ret;
+}
+
+void
+rd_mount_table_free (RdMountTable  *table)
+{
+  g_free (table->buf);
+  g_free (table->entries);
+  g_free (table);
+}
+
+/**
+ * rd_mount_table_lookup:
+ * @out_path: (out) (transfer none): Mount point
+ * @out_fstype: (out) (transfer none): Filesystem type
+ *
+ * Find where block device @dev is mounted.  If it is mounted more than
+ * once (e.g. bind mounts), the first mount in the table wins.
+ *
+ * Returns: %TRUE if @dev is mounted
+ */
+gboolean
+rd_mount_table_lookup (RdMountTable  *table,
+                       dev_t          dev,
+                       const char   **out_path,
+                       const char   **out_fstype)
+{
+  guint lo = 0;
+  guint hi = table->n_entries;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      if (table->entries[mid].dev < dev)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo == table->n_entries || table->entries[lo].dev != dev)
+    {
+      *out_path = *out_fstype = NULL;
+      return FALSE;
+    }
+
+  *out_path = table->entries[lo].mount_point;
+  *out_fstype = table->entries[lo].fstype;
+  return TRUE;
+}
@@ -0,0 +1,115 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2011,2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "rd-names.h"
+
+/**
+ * rd_tag_get_set:
+ *
+ * Returns: The rollback set @tag puts an LV in, or %NULL if it is not
+ * a rollback tag.
+ */
+const char *
+rd_tag_get_set (const char *tag)
+{
+  if (tag[0] != 'r' || strncmp (tag, RD_SET_TAG_PREFIX, strlen (RD_SET_TAG_PREFIX)) != 0)
+    return NULL;
+  tag += strlen (RD_SET_TAG_PREFIX);
+  if (*tag == '\0')
+    return RD_SET_DEFAULT;
+  if (*tag == '.' && tag[1] != '\0')
+    return tag + 1;
+  return NULL;
+}
+
+/**
+ * rd_snapshot_name:
+ * @lvname: Origin LV name
+ * @timestamp: Creation time, in seconds since the epoch
+ * @serial: 0, or a count distinguishing snapshots of @lvname made in
+ *   the same second
+ *
+ * Returns: The name roller-derby gives to a snapshot of @lvname.
+ */
+char *
+rd_snapshot_name (const char *lvname,
+                  gint64      timestamp,
+                  guint       serial)
+{
+  if (serial == 0)
+    return g_strdup_printf ("%s-rd-%" G_GINT64_FORMAT, lvname, timestamp);
+  return g_strdup_printf ("%s-rd-%" G_GINT64_FORMAT ".%u", lvname, timestamp, serial);
+}
+
+/**
+ * rd_snapshot_name_parse:
+ * @snapname: An LV name
+ * @out_lvname: (out): Origin LV name
+ * @out_timestamp: (out): Creation time
+ * @out_serial: (out) (allow-none): Order among snapshots made in the
+ *   same second
+ *
+ * Returns: %TRUE if @snapname is a name made by rd_snapshot_name()
+ */
+gboolean
+rd_snapshot_name_parse (const char   *snapname,
+                        char        **out_lvname,
+                        gint64       *out_timestamp,
+                        guint        *out_serial)
+{
+  const char *sep = NULL;
+  const char *p;
+  char *end;
+  gint64 ts;
+  guint64 serial = 0;
+
+  /* The origin name may itself contain "-rd-", so use the last one */
+  for (p = strstr (snapname, "-rd-"); p; p = strstr (p + 1, "-rd-"))
+    sep = p;
+  if (!sep || sep == snapname)
+    return FALSE;
+
+  p = sep + strlen ("-rd-");
+  if (!g_ascii_isdigit (*p))
+    return FALSE;
+  ts = g_ascii_strtoll (p, &end, 10);
+  if (*end == '.')
+    {
+      p = end + 1;
+      if (!g_ascii_isdigit (*p))
+        return FALSE;
+      serial = g_ascii_strtoull (p, &end, 10);
+      if (serial == 0 || serial > G_MAXUINT)
+        return FALSE;
+    }
+  if (*end != '\0')
+    return FALSE;
+
+  *out_lvname = g_strndup (snapname, sep - snapname);
+  *out_timestamp = ts;
+  if (out_serial)
+    *out_serial = serial;
+  return TRUE;
+}
@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2011,2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+/* Naming conventions shared with roller-derby-early, which links
+ * only GLib, so nothing here may depend on GIO or lvm.
+ */
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An LV (or every LV of a VG) is in rollback set NAME when tagged
+ * "rollback_include.NAME"; the bare "rollback_include" tag is the
+ * default set.
+ */
+#define RD_SET_TAG_PREFIX "rollback_include"
+#define RD_SET_DEFAULT "default"
+
+const char    *rd_tag_get_set (const char *tag);
+
+char          *rd_snapshot_name (const char *lvname,
+                                 gint64      timestamp,
+                                 guint       serial);
+gboolean       rd_snapshot_name_parse (const char   *snapname,
+                                       char        **out_lvname,
+                                       gint64       *out_timestamp,
+                                       guint        *out_serial);
+
+G_END_DECLS
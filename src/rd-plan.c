@@ -0,0 +1,194 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+/* A plan file is a single serialized GVariant of type %RD_PLAN_TYPE.
+ * It is written by "plan" and read back by "apply", possibly on
+ * another day, so nothing in it is trusted beyond its type.
+ */
+
+/**
+ * rd_plan_save:
+ * @plan: Of type %RD_PLAN_TYPE
+ */
+gboolean
+rd_plan_save (GVariant     *plan,
+              const char   *path,
+              GError      **error)
+{
+  return g_file_set_contents (path, g_variant_get_data (plan),
+                              g_variant_get_size (plan), error);
+}
+
+/**
+ * rd_plan_load:
+ *
+ * Returns: (transfer full): The plan saved in @path
+ */
+GVariant *
+rd_plan_load (const char   *path,
+              GError      **error)
+{
+  GVariant *ret = NULL;
+  gs_unref_variant GVariant *plan = NULL;
+  GMappedFile *mapped;
+  guint32 version;
+
+  mapped = g_mapped_file_new (path, FALSE, error);
+  if (!mapped)
+    goto out;
+
+  plan = g_variant_new_from_data (G_VARIANT_TYPE (RD_PLAN_TYPE),
+                                  g_mapped_file_get_contents (mapped),
+                                  g_mapped_file_get_length (mapped),
+                                  FALSE,
+                                  (GDestroyNotify)g_mapped_file_unref, mapped);
+  g_variant_ref_sink (plan);
+
+  g_variant_get_child (plan, 0, "u", &version);
+  if (version != RD_PLAN_VERSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s: Not a plan, or made by another version of roller-derby", path);
+      goto out;
+    }
+
+  ret = g_variant_ref (plan);
+ out:
+  return ret;
+}
+
+/**
+ * rd_plan_add_vg_cost:
+ * @vg_plan: An element of a plan, of type %RD_PLAN_VG_TYPE
+ * @cost: (inout): Totals to add the VG's cost to
+ *
+ * Estimate what "apply" will cost for one VG.  Tag changes and
+ * snapshots share one open of the VG; each snapshot commits the
+ * metadata, taking any pending tag changes with it, so tags only cost
+ * a commit of their own when there are no snapshots.  Removals and
+ * merges each run as one command, which takes the VG lock once and
+ * commits once per LV.
+ */
+void
+rd_plan_add_vg_cost (GVariant     *vg_plan,
+                     RdPlanCost   *cost)
+{
+  gs_unref_variant GVariant *ops = g_variant_get_child_value (vg_plan, 2);
+  guint n_tags = 0, n_snapshots = 0, n_removes = 0, n_merges = 0;
+  GVariantIter iter;
+  const char *kind;
+  guint64 size;
+
+  g_variant_iter_init (&iter, ops);
+  while (g_variant_iter_next (&iter, "(&s&s&st)", &kind, NULL, NULL, &size))
+    {
+      if (strcmp (kind, RD_PLAN_OP_TAG) == 0 || strcmp (kind, RD_PLAN_OP_UNTAG) == 0)
+        n_tags++;
+      else if (strcmp (kind, RD_PLAN_OP_SNAPSHOT) == 0)
+        {
+          n_snapshots++;
+          cost->space += size;
+        }
+      else if (strcmp (kind, RD_PLAN_OP_REMOVE) == 0)
+        {
+          n_removes++;
+          cost->space -= size;
+        }
+      else if (strcmp (kind, RD_PLAN_OP_MERGE) == 0)
+        n_merges++;
+    }
+
+  cost->n_ops += g_variant_n_children (ops);
+  /* The seqno check opens the VG even when nothing else needs it */
+  cost->n_locks += 1 + (n_removes > 0) + (n_merges > 0);
+  cost->n_commits += (n_snapshots > 0 ? n_snapshots : n_tags > 0)
+    + n_removes + n_merges;
+}
+
+static char *
+format_space (gint64 space)
+{
+  gs_free char *size = g_format_size (ABS (space));
+
+  return g_strconcat (space < 0 ? "-" : "+", size, NULL);
+}
+
+/**
+ * rd_plan_print:
+ *
+ * Print each operation of @plan, and its estimated cost.
+ */
+void
+rd_plan_print (GVariant *plan)
+{
+  gs_unref_variant GVariant *vgs = g_variant_get_child_value (plan, 2);
+  gs_free char *space = NULL;
+  RdPlanCost cost;
+  GVariantIter iter;
+  gsize i;
+
+  memset (&cost, 0, sizeof (cost));
+
+  for (i = 0; i < g_variant_n_children (vgs); i++)
+    {
+      gs_unref_variant GVariant *vg_plan = g_variant_get_child_value (vgs, i);
+      gs_unref_variant GVariant *ops = NULL;
+      const char *vgname;
+      guint64 seqno;
+      const char *kind;
+      const char *lvname;
+      const char *arg;
+      guint64 size;
+
+      g_variant_get (vg_plan, "(&st@a(ssst))", &vgname, &seqno, &ops);
+      g_print ("%s (seqno %" G_GUINT64_FORMAT "):\n", vgname, seqno);
+
+      g_variant_iter_init (&iter, ops);
+      while (g_variant_iter_next (&iter, "(&s&s&st)", &kind, &lvname, &arg, &size))
+        {
+          gs_free char *sizestr = size > 0 ? g_format_size (size) : NULL;
+
+          if (strcmp (kind, RD_PLAN_OP_SNAPSHOT) == 0)
+            g_print ("  %-8s  %s/%s -> %s (%s)\n", kind, vgname, lvname, arg,
+                     sizestr ? sizestr : "thin");
+          else if (strcmp (kind, RD_PLAN_OP_REMOVE) == 0)
+            g_print ("  %-8s  %s/%s (snapshot of %s%s%s)\n", kind, vgname, lvname, arg,
+                     sizestr ? ", frees " : "", sizestr ? sizestr : "");
+          else if (strcmp (kind, RD_PLAN_OP_MERGE) == 0)
+            g_print ("  %-8s  %s/%s -> %s\n", kind, vgname, lvname, arg);
+          else
+            g_print ("  %-8s  %s/%s %s\n", kind, vgname, lvname, arg);
+        }
+
+      rd_plan_add_vg_cost (vg_plan, &cost);
+    }
+
+  space = format_space (cost.space);
+  g_print ("%u operation(s) in %u VG(s): %u metadata commit(s), %u VG lock(s), %s of snapshot space\n",
+           cost.n_ops, (guint)g_variant_n_children (vgs), cost.n_commits, cost.n_locks, space);
+}
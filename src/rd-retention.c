@@ -0,0 +1,235 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+typedef struct {
+  const char  *lv_name;
+  const char  *origin;
+  guint64      lv_size;
+  const char  *lv_attr;
+} SnapshotProps;
+
+static const GlvmPropSpec snapshot_props[] = {
+  { "lv_name", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (SnapshotProps, lv_name) },
+  { "origin", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_EMPTY_IS_NULL, G_STRUCT_OFFSET (SnapshotProps, origin) },
+  { "lv_size", GLVM_PROP_UINT64, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (SnapshotProps, lv_size) },
+  { "lv_attr", GLVM_PROP_STRING_BORROWED, GLVM_PROP_FLAGS_NONE, G_STRUCT_OFFSET (SnapshotProps, lv_attr) },
+};
+
+void
+rd_snapshot_info_free (RdSnapshotInfo *snap)
+{
+  g_free (snap->name);
+  g_free (snap);
+}
+
+/* Newest first */
+static int
+compare_snapshots (gconstpointer a,
+                   gconstpointer b)
+{
+  const RdSnapshotInfo *sa = *(RdSnapshotInfo**)a;
+  const RdSnapshotInfo *sb = *(RdSnapshotInfo**)b;
+
+  if (sa->timestamp != sb->timestamp)
+    return sa->timestamp > sb->timestamp ? -1 : 1;
+  if (sa->serial != sb->serial)
+    return sa->serial > sb->serial ? -1 : 1;
+  return strcmp (sa->name, sb->name);
+}
+
+/**
+ * rd_vg_new_snapshot_name:
+ * @timestamp: Creation time, in seconds since the epoch
+ *
+ * Returns: (transfer full): A name for a new snapshot of @lvname,
+ * made at @timestamp, that no LV in @vg has yet.  Snapshots made in
+ * the same second, e.g. by runs in quick succession, get a serial.
+ */
+char *
+rd_vg_new_snapshot_name (vg_t         vg,
+                         const char  *lvname,
+                         gint64       timestamp)
+{
+  char *ret = rd_snapshot_name (lvname, timestamp, 0);
+  guint serial = 0;
+
+  while (lvm_lv_from_name (vg, ret) != NULL)
+    {
+      g_free (ret);
+      ret = rd_snapshot_name (lvname, timestamp, ++serial);
+    }
+  return ret;
+}
+
+/**
+ * rd_vg_list_snapshots:
+ * @origins: Names of the LVs of interest
+ * @out_snaps_by_origin: (out): Map from each name in @origins to a
+ *   #GPtrArray of its #RdSnapshotInfo, newest first
+ *
+ * Find the roller-derby snapshots of @origins in @vg.
+ */
+gboolean
+rd_vg_list_snapshots (vg_t                 vg,
+                      const char *const   *origins,
+                      GHashTable         **out_snaps_by_origin,
+                      GError             **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_hashtable GHashTable *snaps_by_origin = NULL;
+  const char *const *iter;
+  struct dm_list *lvs;
+  struct lvm_lv_list *lvsl;
+  GHashTableIter hiter;
+  gpointer value;
+
+  snaps_by_origin = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify)g_ptr_array_unref);
+  for (iter = origins; *iter; iter++)
+    g_hash_table_insert (snaps_by_origin, g_strdup (*iter),
+                         g_ptr_array_new_with_free_func ((GDestroyNotify)rd_snapshot_info_free));
+
+  /* NULL if the VG has no LVs */
+  lvs = lvm_vg_list_lvs (vg);
+  if (!lvs)
+    goto done;
+
+  dm_list_iterate_items (lvsl, lvs)
+    {
+      SnapshotProps props = { NULL, NULL, 0, NULL };
+      gs_free char *origin = NULL;
+      GPtrArray *snaps;
+      RdSnapshotInfo *snap;
+      gint64 ts;
+      guint serial;
+
+      if (!glvm_lv_get_properties (lvsl->lv, snapshot_props, G_N_ELEMENTS (snapshot_props),
+                                   &props, NULL, error))
+        goto out;
+      if (!props.origin)
+        continue;
+
+      snaps = g_hash_table_lookup (snaps_by_origin, props.origin);
+      if (!snaps)
+        continue;
+      if (!rd_snapshot_name_parse (props.lv_name, &origin, &ts, &serial)
+          || strcmp (origin, props.origin) != 0)
+        continue;
+
+      snap = g_new0 (RdSnapshotInfo, 1);
+      snap->name = g_strdup (props.lv_name);
+      snap->timestamp = ts;
+      snap->serial = serial;
+      /* A thin snapshot's size is virtual; what it frees is unknown */
+      snap->cow_size = rd_lv_attr_is_thin (props.lv_attr) ? 0 : props.lv_size;
+      g_ptr_array_add (snaps, snap);
+    }
+
+  g_hash_table_iter_init (&hiter, snaps_by_origin);
+  while (g_hash_table_iter_next (&hiter, NULL, &value))
+    g_ptr_array_sort (value, compare_snapshots);
+
+ done:
+  ret = TRUE;
+  gs_transfer_out_value (out_snaps_by_origin, &snaps_by_origin);
+ out:
+  return ret;
+}
+
+/**
+ * rd_retention_policy_update:
+ *
+ * Apply @tag over @policy if it is a retention tag.
+ */
+gboolean
+rd_retention_policy_update (RdRetentionPolicy  *policy,
+                            const char         *tag,
+                            GError            **error)
+{
+  if (g_str_has_prefix (tag, RD_KEEP_TAG))
+    {
+      const char *value = tag + strlen (RD_KEEP_TAG);
+      char *end;
+
+      policy->keep = g_ascii_strtoll (value, &end, 10);
+      if (end == value || *end != '\0' || policy->keep < 0)
+        goto invalid;
+    }
+  else if (g_str_has_prefix (tag, RD_MAX_AGE_TAG))
+    {
+      if (!rd_parse_age (tag + strlen (RD_MAX_AGE_TAG), &policy->max_age))
+        goto invalid;
+    }
+  return TRUE;
+
+ invalid:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Invalid tag '%s'", tag);
+  return FALSE;
+}
+
+/**
+ * rd_retention_policy_update_from_vg:
+ *
+ * Apply the retention tags of @vg over @policy.
+ */
+gboolean
+rd_retention_policy_update_from_vg (RdRetentionPolicy  *policy,
+                                    vg_t                vg,
+                                    GError            **error)
+{
+  struct dm_list *tags = lvm_vg_get_tags (vg);
+  struct lvm_str_list *tagl;
+
+  if (!tags)
+    return TRUE;
+
+  dm_list_iterate_items (tagl, tags)
+    {
+      if (!rd_retention_policy_update (policy, tagl->str, error))
+        {
+          g_prefix_error (error, "%s: ", lvm_vg_get_name (vg));
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+/**
+ * rd_retention_is_expired:
+ * @rank: Position of the snapshot among its origin's, newest first
+ * @age: Age of the snapshot in seconds
+ */
+gboolean
+rd_retention_is_expired (const RdRetentionPolicy  *policy,
+                         guint                     rank,
+                         gint64                    age)
+{
+  return (policy->keep >= 0 && rank >= policy->keep)
+    || (policy->max_age >= 0 && age > policy->max_age);
+}
@@ -0,0 +1,366 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+/* PVs backing the VGs we care about are remembered per boot, since
+ * device names are only stable that long.
+ */
+#define RD_SCAN_PVS_DIR  "/run/roller-derby"
+#define RD_SCAN_PVS_PATH RD_SCAN_PVS_DIR "/pvs"
+
+/* lvm "devices" config restricting scanning; NULL to scan everything */
+static char *scan_filter;
+static gboolean scan_readonly;
+
+static void
+append_regex_escaped (GString     *buf,
+                      const char  *str)
+{
+  for (; *str; str++)
+    {
+      /* '|' delimits the regex; '"' and '\' are special to the config
+       * parser, so they need escaping twice.
+       */
+      if (*str == '"' || *str == '\\')
+        g_string_append (buf, "\\\\\\");
+      else if (strchr (".[]()*+?^$|{}", *str))
+        g_string_append (buf, "\\\\");
+      g_string_append_c (buf, *str);
+    }
+}
+
+/**
+ * rd_scan_set_pvs:
+ * @pvs: (allow-none): Device paths
+ *
+ * Make every LVM handle opened afterwards by rd_lvm_open() (in this
+ * process or a forked worker) scan only @pvs, or every block device
+ * if @pvs is %NULL.
+ */
+void
+rd_scan_set_pvs (const char *const *pvs)
+{
+  GString *buf;
+
+  g_clear_pointer (&scan_filter, g_free);
+  if (!pvs)
+    return;
+
+  buf = g_string_new ("devices { filter = [ ");
+  for (; *pvs; pvs++)
+    {
+      g_string_append (buf, "\"a|^");
+      append_regex_escaped (buf, *pvs);
+      g_string_append (buf, "$|\", ");
+    }
+  g_string_append (buf, "\"r|.*|\" ] }");
+  scan_filter = g_string_free (buf, FALSE);
+}
+
+/**
+ * rd_scan_set_readonly:
+ *
+ * Make handles opened afterwards by rd_lvm_open() work as lvm's own
+ * --readonly does: with no locking at all (locking_type 5, dummy
+ * locking), so that they never wait on a command holding a VG lock,
+ * and with metadata_read_only set so that any metadata change is
+ * refused.  This is safe for builtins that only read: a VG being
+ * changed concurrently is seen either before or after the commit,
+ * since lvm checks each copy of the metadata against its checksum,
+ * and nothing read this way is acted on without reopening the VG
+ * under its lock (apply checks each VG's seqno first).
+ */
+void
+rd_scan_set_readonly (gboolean readonly)
+{
+  scan_readonly = readonly;
+}
+
+gboolean
+rd_scan_is_scoped (void)
+{
+  return scan_filter != NULL;
+}
+
+/**
+ * rd_scan_get_config:
+ *
+ * Returns: (transfer full): LVM configuration implementing
+ * rd_scan_set_pvs() and rd_scan_set_readonly(), or %NULL if there is
+ * nothing to override.
+ */
+char *
+rd_scan_get_config (void)
+{
+  if (!scan_filter && !scan_readonly)
+    return NULL;
+
+  return g_strconcat (scan_filter ? scan_filter : "",
+                      scan_readonly ? " global { locking_type = 5 metadata_read_only = 1 }" : "",
+                      NULL);
+}
+
+/**
+ * rd_lvm_get_config:
+ *
+ * Returns: (transfer full): The configuration rd_lvm_open() overrides
+ * in new handles; a caller overriding more must include it.  Unless
+ * read-only, handles do not block on busy VG locks, leaving the
+ * waiting to glvm_vg_open().
+ */
+char *
+rd_lvm_get_config (void)
+{
+  gs_free char *scan_config = rd_scan_get_config ();
+
+  /* Without locking there are no locks to wait for */
+  return g_strconcat (scan_config ? scan_config : "",
+                      scan_readonly ? "" : " " GLVM_LOCK_NOWAIT_CONFIG,
+                      NULL);
+}
+
+/**
+ * rd_lvm_open:
+ *
+ * Returns: A new LVM handle, restricted to the PVs given to
+ * rd_scan_set_pvs() and read-only if rd_scan_set_readonly() was
+ * called.  No devices are scanned until it is first used.
+ */
+lvm_t
+rd_lvm_open (GError **error)
+{
+  lvm_t lvmh;
+  gs_free char *config = NULL;
+  GlvmTimer timer;
+
+  GLVM_TRACE_BEGIN (timer, lvm_init, NULL);
+  lvmh = lvm_init (NULL);
+  GLVM_TRACE_END (timer, lvm_init, NULL);
+  if (!lvmh)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Failed to initialize LVM");
+      return NULL;
+    }
+
+  config = rd_lvm_get_config ();
+  if (*config
+      && (lvm_config_override (lvmh, config) == -1
+          || lvm_config_reload (lvmh) == -1))
+    {
+      glvm_set_error (error, lvmh);
+      lvm_quit (lvmh);
+      return NULL;
+    }
+
+  return lvmh;
+}
+
+static GKeyFile *
+load_remembered (void)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (keyfile, RD_SCAN_PVS_PATH, G_KEY_FILE_NONE, NULL))
+    {
+      g_key_file_free (keyfile);
+      return NULL;
+    }
+  return keyfile;
+}
+
+/**
+ * rd_scan_lookup_pvs:
+ * @vgnames: (allow-none): VGs to look up, or %NULL for all remembered VGs
+ * @out_pvs: (out): PVs backing @vgnames
+ *
+ * Returns: %TRUE if the PVs of every VG in @vgnames are known, and
+ * all still exist.  A missing device means the remembered list is
+ * stale, e.g. after a disk was detached or renamed, so the caller
+ * should scan everything.
+ */
+gboolean
+rd_scan_lookup_pvs (const char *const  *vgnames,
+                    char             ***out_pvs)
+{
+  gboolean ret = FALSE;
+  GKeyFile *keyfile;
+  gs_strfreev char **all_vgnames = NULL;
+  GPtrArray *pvs = NULL;
+  const char *const *iter;
+
+  keyfile = load_remembered ();
+  if (!keyfile)
+    goto out;
+
+  if (!vgnames)
+    {
+      all_vgnames = g_key_file_get_groups (keyfile, NULL);
+      vgnames = (const char *const*)all_vgnames;
+    }
+
+  pvs = g_ptr_array_new_with_free_func (g_free);
+  for (iter = vgnames; *iter; iter++)
+    {
+      gs_strfreev char **vg_pvs = NULL;
+      char **pviter;
+
+      vg_pvs = g_key_file_get_string_list (keyfile, *iter, "pvs", NULL, NULL);
+      if (!vg_pvs)
+        goto out;
+      for (pviter = vg_pvs; *pviter; pviter++)
+        {
+          if (!g_file_test (*pviter, G_FILE_TEST_EXISTS))
+            goto out;
+          g_ptr_array_add (pvs, g_strdup (*pviter));
+        }
+    }
+  /* An empty filter would hide everything */
+  if (pvs->len == 0)
+    goto out;
+  g_ptr_array_add (pvs, NULL);
+
+  ret = TRUE;
+  *out_pvs = (char**)g_ptr_array_free (pvs, FALSE);
+  pvs = NULL;
+ out:
+  if (pvs)
+    g_ptr_array_unref (pvs);
+  if (keyfile)
+    g_key_file_free (keyfile);
+  return ret;
+}
+
+static gboolean
+collect_pv_row (GHashTable   *row,
+                gpointer      user_data,
+                GError      **error)
+{
+  GHashTable *pvs_by_vg = user_data;
+  const char *pvname = g_hash_table_lookup (row, "pv_name");
+  const char *vgname = g_hash_table_lookup (row, "vg_name");
+  GPtrArray *pvnames;
+
+  if (!pvname || !vgname || !*vgname)
+    return TRUE;
+
+  pvnames = g_hash_table_lookup (pvs_by_vg, vgname);
+  if (!pvnames)
+    {
+      pvnames = g_ptr_array_new_with_free_func (g_free);
+      g_hash_table_insert (pvs_by_vg, g_strdup (vgname), pvnames);
+    }
+  g_ptr_array_add (pvnames, g_strdup (pvname));
+  return TRUE;
+}
+
+/**
+ * rd_scan_remember_vgs:
+ * @lvmh: (allow-none): An unscoped LVM handle, or %NULL to ask lvm pvs
+ * @vgnames: VGs whose PVs should be remembered
+ * @replace: If %TRUE, forget all other VGs
+ *
+ * Record which PVs back @vgnames, so later runs can pass them to
+ * rd_scan_set_pvs() instead of scanning every block device.
+ */
+gboolean
+rd_scan_remember_vgs (lvm_t               lvmh,
+                      const char *const  *vgnames,
+                      gboolean            replace,
+                      GError            **error)
+{
+  gboolean ret = FALSE;
+  GKeyFile *keyfile = NULL;
+  gs_free char *contents = NULL;
+  gsize len;
+  const char *const *iter;
+
+  if (!replace)
+    keyfile = load_remembered ();
+  if (!keyfile)
+    keyfile = g_key_file_new ();
+
+  if (!lvmh)
+    {
+      static const char *const fields[] = { "pv_name", "vg_name", NULL };
+      gs_unref_hashtable GHashTable *pvs_by_vg =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)g_ptr_array_unref);
+
+      if (!glvm_report_run ("pvs", "pv", fields, NULL, collect_pv_row, pvs_by_vg,
+                            NULL, error))
+        goto out;
+
+      for (iter = vgnames; *iter; iter++)
+        {
+          GPtrArray *pvnames = g_hash_table_lookup (pvs_by_vg, *iter);
+          if (pvnames)
+            g_key_file_set_string_list (keyfile, *iter, "pvs",
+                                        (const char *const*)pvnames->pdata, pvnames->len);
+        }
+    }
+
+  for (iter = vgnames; lvmh && *iter; iter++)
+    {
+      glvm_cleanup_vg vg_t vg = NULL;
+      gs_unref_ptrarray GPtrArray *pvnames = g_ptr_array_new ();
+      struct dm_list *pvs;
+      struct lvm_pv_list *pvl;
+
+      vg = glvm_vg_open (lvmh, *iter, "r", GLVM_VG_OPEN_FLAGS_NONE, NULL, NULL, error);
+      if (vg == NULL)
+        goto out;
+
+      pvs = lvm_vg_list_pvs (vg);
+      if (pvs)
+        {
+          dm_list_iterate_items (pvl, pvs)
+            g_ptr_array_add (pvnames, (char*)lvm_pv_get_name (pvl->pv));
+        }
+
+      g_key_file_set_string_list (keyfile, *iter, "pvs",
+                                  (const char *const*)pvnames->pdata, pvnames->len);
+    }
+
+  contents = g_key_file_to_data (keyfile, &len, NULL);
+
+  if (g_mkdir_with_parents (RD_SCAN_PVS_DIR, 0755) == -1)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "%s: %s", RD_SCAN_PVS_DIR, g_strerror (errsv));
+      goto out;
+    }
+  if (!g_file_set_contents (RD_SCAN_PVS_PATH, contents, len, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  g_key_file_free (keyfile);
+  return ret;
+}
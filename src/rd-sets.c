@@ -0,0 +1,194 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+/* See rd-names.h for how tags map to rollback sets.  The scan records
+ * each LV's sets once, so selecting sets later is a hash lookup per
+ * set the LV is in, rather than a look at its tags.
+ */
+
+static GHashTable *selected_sets;
+
+static void
+add_sets_from_tags (GPtrArray     *sets,
+                    const char   **tags)
+{
+  const char **iter;
+  guint i;
+
+  for (iter = tags; iter && *iter; iter++)
+    {
+      const char *set = rd_tag_get_set (*iter);
+      gboolean seen = FALSE;
+
+      if (!set)
+        continue;
+      for (i = 0; i < sets->len && !seen; i++)
+        seen = strcmp (sets->pdata[i], set) == 0;
+      if (!seen)
+        g_ptr_array_add (sets, g_strdup (set));
+    }
+}
+
+/**
+ * rd_sets_from_tags:
+ * @vg_tags: (allow-none): Tags of the LV's VG
+ * @lv_tags: (allow-none): Tags of the LV
+ *
+ * Returns: (transfer full): The rollback sets the LV is in, or %NULL
+ * if none
+ */
+char **
+rd_sets_from_tags (const char *const *vg_tags,
+                   const char *const *lv_tags)
+{
+  GPtrArray *sets = g_ptr_array_new ();
+
+  add_sets_from_tags (sets, (const char **)vg_tags);
+  add_sets_from_tags (sets, (const char **)lv_tags);
+  if (sets->len == 0)
+    {
+      g_ptr_array_free (sets, TRUE);
+      return NULL;
+    }
+  g_ptr_array_add (sets, NULL);
+  return (char**)g_ptr_array_free (sets, FALSE);
+}
+
+/**
+ * rd_sets_tag_list_has_set:
+ *
+ * Returns: %TRUE if any of the lvm2app tag list @tags is a rollback tag
+ */
+gboolean
+rd_sets_tag_list_has_set (struct dm_list *tags)
+{
+  struct lvm_str_list *tagl;
+
+  dm_list_iterate_items (tagl, tags)
+    {
+      if (rd_tag_get_set (tagl->str))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/**
+ * rd_sets_select:
+ * @sets: (allow-none): Set names, or %NULL for just the default set
+ *
+ * Choose which rollback sets the builtins work on, and which sets
+ * add and remove tag LVs for.
+ */
+gboolean
+rd_sets_select (const char *const  *sets,
+                GError            **error)
+{
+  static const char *const default_sets[] = { RD_SET_DEFAULT, NULL };
+  const char *const *iter;
+
+  if (!sets || !*sets)
+    sets = default_sets;
+
+  for (iter = sets; *iter; iter++)
+    {
+      const char *p;
+
+      /* Anything else is not allowed in an LVM tag */
+      for (p = *iter; *p; p++)
+        {
+          if (!(g_ascii_isalnum (*p) || strchr ("_+.-", *p)))
+            break;
+        }
+      if (p == *iter || *p)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVAL,
+                       "Invalid rollback set name '%s'", *iter);
+          return FALSE;
+        }
+    }
+
+  if (selected_sets)
+    g_hash_table_unref (selected_sets);
+  selected_sets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (iter = sets; *iter; iter++)
+    g_hash_table_add (selected_sets, g_strdup (*iter));
+  return TRUE;
+}
+
+static GHashTable *
+get_selected_sets (void)
+{
+  if (!selected_sets)
+    (void) rd_sets_select (NULL, NULL);
+  return selected_sets;
+}
+
+/**
+ * rd_sets_is_selected:
+ * @sets: (allow-none): An LV's sets, from rd_sets_from_tags()
+ *
+ * Returns: %TRUE if any of @sets was selected with rd_sets_select()
+ */
+gboolean
+rd_sets_is_selected (char **sets)
+{
+  GHashTable *selected = get_selected_sets ();
+  char **iter;
+
+  for (iter = sets; iter && *iter; iter++)
+    {
+      if (g_hash_table_contains (selected, *iter))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/**
+ * rd_sets_get_tags:
+ *
+ * Returns: (transfer full): The tags putting an LV in each selected set
+ */
+char **
+rd_sets_get_tags (void)
+{
+  GHashTable *selected = get_selected_sets ();
+  GPtrArray *tags = g_ptr_array_new ();
+  GHashTableIter hiter;
+  gpointer key;
+
+  g_hash_table_iter_init (&hiter, selected);
+  while (g_hash_table_iter_next (&hiter, &key, NULL))
+    {
+      if (strcmp (key, RD_SET_DEFAULT) == 0)
+        g_ptr_array_add (tags, g_strdup (RD_SET_TAG_PREFIX));
+      else
+        g_ptr_array_add (tags, g_strconcat (RD_SET_TAG_PREFIX ".", key, NULL));
+    }
+  g_ptr_array_add (tags, NULL);
+  return (char**)g_ptr_array_free (tags, FALSE);
+}
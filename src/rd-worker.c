@@ -0,0 +1,659 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "rd.h"
+#include "libgsystem.h"
+
+/* lvm2app is not thread-safe, so per-VG parallelism is done with one
+ * child process per VG, each with its own lvm handle.
+ *
+ * Each child writes a stream of single-byte status messages to its
+ * reply pipe, followed by RD_WORKER_MSG_REPLY and a serialized GVariant
+ * of type (bsvx): success, error message, the worker function's
+ * result, and the time it spent waiting for busy VG locks.  When the
+ * caller supplies #RdVgWorkerHooks, each child also gets a control
+ * pipe; rd_vg_worker_sync() sends RD_WORKER_MSG_READY and blocks until
+ * the parent writes RD_WORKER_MSG_GO (or closes the pipe to abort).
+ */
+#define RD_WORKER_REPLY_TYPE "(bsvx)"
+
+#define RD_WORKER_MSG_READY 'r'
+#define RD_WORKER_MSG_DONE  'd'
+#define RD_WORKER_MSG_REPLY 'v'
+#define RD_WORKER_MSG_GO    'g'
+
+static gint64 worker_timeout = -1;
+
+struct _RdVgWorker {
+  int          reply_fd;
+  int          control_fd;
+};
+
+typedef struct {
+  guint        index;
+  pid_t        pid;
+  int          fd;
+  int          control_fd;
+  GByteArray  *buf;
+  gint64       start_time;
+  guint        in_reply : 1;
+  guint        ready : 1;
+  guint        done : 1;
+  guint        killed : 1;
+} RdWorkerSlot;
+
+/**
+ * rd_set_vg_worker_timeout:
+ * @timeout_usec: Microseconds, or -1 for no limit
+ *
+ * Bound how long each worker started by rd_run_vg_workers() may run
+ * before it is killed.
+ */
+void
+rd_set_vg_worker_timeout (gint64 timeout_usec)
+{
+  worker_timeout = timeout_usec;
+}
+
+void
+rd_vg_worker_result_free (RdVgWorkerResult *result)
+{
+  if (!result)
+    return;
+  g_free (result->vgname);
+  if (result->result)
+    g_variant_unref (result->result);
+  g_clear_error (&result->error);
+  g_free (result);
+}
+
+static gboolean
+write_all (int            fd,
+           const guint8  *buf,
+           gsize          len)
+{
+  while (len > 0)
+    {
+      ssize_t res = write (fd, buf, len);
+      if (res == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      buf += res;
+      len -= res;
+    }
+  return TRUE;
+}
+
+static gboolean
+write_msg (int    fd,
+           char   msg)
+{
+  return write_all (fd, (guint8*)&msg, 1);
+}
+
+/**
+ * rd_vg_worker_sync:
+ *
+ * Called from a worker function once it has done all of its
+ * preparation.  Blocks until every worker has reached this point and
+ * the parent's ready hook has run.
+ *
+ * Returns: %FALSE if the parent aborted the operation
+ */
+gboolean
+rd_vg_worker_sync (RdVgWorker    *worker,
+                   GError       **error)
+{
+  gboolean ret = FALSE;
+  char msg = 0;
+  ssize_t res;
+
+  if (worker->control_fd == -1)
+    return TRUE;
+
+  if (!write_msg (worker->reply_fd, RD_WORKER_MSG_READY))
+    {
+      int errsv = errno;
+      g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      goto out;
+    }
+
+  do
+    res = read (worker->control_fd, &msg, 1);
+  while (res == -1 && errno == EINTR);
+  if (res != 1 || msg != RD_WORKER_MSG_GO)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                           "Aborted by parent");
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * rd_vg_worker_notify_done:
+ *
+ * Called from a worker function when it has finished the work that
+ * had to happen between rd_vg_worker_sync() and the parent's done
+ * hook.  Exiting the worker implies this.
+ */
+void
+rd_vg_worker_notify_done (RdVgWorker    *worker)
+{
+  if (worker->control_fd == -1)
+    return;
+  (void) write_msg (worker->reply_fd, RD_WORKER_MSG_DONE);
+}
+
+static void
+run_child (const char      *vgname,
+           RdVgWorkerFunc   func,
+           gpointer         user_data,
+           int              reply_fd,
+           int              control_fd) G_GNUC_NORETURN;
+
+static void
+run_child (const char      *vgname,
+           RdVgWorkerFunc   func,
+           gpointer         user_data,
+           int              reply_fd,
+           int              control_fd)
+{
+  GError *local_error = NULL;
+  GVariant *result = NULL;
+  GVariant *reply;
+  RdVgWorker worker = { reply_fd, control_fd };
+  lvm_t lvmh;
+
+  glvm_reset_lock_wait ();
+  lvmh = rd_lvm_open (&local_error);
+  if (lvmh)
+    (void) func (&worker, lvmh, vgname, user_data, &result, NULL, &local_error);
+
+  if (local_error)
+    reply = g_variant_new ("(bsvx)", FALSE, local_error->message,
+                           g_variant_new ("()"), glvm_get_lock_wait ());
+  else
+    reply = g_variant_new ("(bsvx)", TRUE, "",
+                           result ? result : g_variant_new ("()"),
+                           glvm_get_lock_wait ());
+  g_variant_ref_sink (reply);
+
+  if (!write_msg (reply_fd, RD_WORKER_MSG_REPLY))
+    _exit (1);
+  if (!write_all (reply_fd, g_variant_get_data (reply), g_variant_get_size (reply)))
+    _exit (1);
+  _exit (0);
+}
+
+static gboolean
+open_pipe (int       *fds,
+           GError   **error)
+{
+  if (pipe (fds) == -1)
+    {
+      int errsv = errno;
+      g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+start_worker (RdWorkerSlot    *slot,
+              guint            index,
+              const char      *vgname,
+              RdVgWorkerFunc   func,
+              gpointer         user_data,
+              gboolean         with_control,
+              GError         **error)
+{
+  gboolean ret = FALSE;
+  int reply_pipe[2] = { -1, -1 };
+  int control_pipe[2] = { -1, -1 };
+
+  if (!open_pipe (reply_pipe, error))
+    goto out;
+  if (with_control && !open_pipe (control_pipe, error))
+    goto out;
+
+  slot->pid = fork ();
+  if (slot->pid == -1)
+    {
+      int errsv = errno;
+      g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      goto out;
+    }
+  else if (slot->pid == 0)
+    {
+      (void) close (reply_pipe[0]);
+      if (control_pipe[1] != -1)
+        (void) close (control_pipe[1]);
+      run_child (vgname, func, user_data, reply_pipe[1], control_pipe[0]);
+    }
+
+  slot->index = index;
+  slot->fd = reply_pipe[0];
+  reply_pipe[0] = -1;
+  slot->control_fd = control_pipe[1];
+  control_pipe[1] = -1;
+  slot->buf = g_byte_array_new ();
+  slot->start_time = g_get_monotonic_time ();
+  slot->in_reply = slot->ready = slot->done = slot->killed = FALSE;
+
+  ret = TRUE;
+ out:
+  if (reply_pipe[0] != -1)
+    (void) close (reply_pipe[0]);
+  if (reply_pipe[1] != -1)
+    (void) close (reply_pipe[1]);
+  if (control_pipe[0] != -1)
+    (void) close (control_pipe[0]);
+  if (control_pipe[1] != -1)
+    (void) close (control_pipe[1]);
+  return ret;
+}
+
+static void
+close_control (RdWorkerSlot    *slot)
+{
+  if (slot->control_fd == -1)
+    return;
+  (void) close (slot->control_fd);
+  slot->control_fd = -1;
+}
+
+static RdVgWorkerResult *
+finish_worker (RdWorkerSlot    *slot,
+               const char      *vgname)
+{
+  RdVgWorkerResult *result = g_new0 (RdVgWorkerResult, 1);
+  GVariant *reply = NULL;
+  gboolean success;
+  const char *message;
+  int estatus;
+  pid_t res;
+
+  (void) close (slot->fd);
+  slot->fd = -1;
+  close_control (slot);
+
+  do
+    res = waitpid (slot->pid, &estatus, 0);
+  while (res == -1 && errno == EINTR);
+
+  result->vgname = g_strdup (vgname);
+  result->elapsed_usec = g_get_monotonic_time () - slot->start_time;
+
+  if (slot->killed)
+    {
+      g_set_error (&result->error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   "Worker for VG %s timed out and was killed", vgname);
+      goto out;
+    }
+  else if (res == -1 || !WIFEXITED (estatus) || WEXITSTATUS (estatus) != 0
+           || !slot->in_reply)
+    {
+      g_set_error (&result->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Worker for VG %s exited abnormally", vgname);
+      goto out;
+    }
+
+  reply = g_variant_new_from_data (G_VARIANT_TYPE (RD_WORKER_REPLY_TYPE),
+                                   slot->buf->data, slot->buf->len, FALSE,
+                                   (GDestroyNotify)g_byte_array_unref, slot->buf);
+  slot->buf = NULL;
+  g_variant_ref_sink (reply);
+
+  g_variant_get (reply, "(b&svx)", &success, &message, &result->result,
+                 &result->lock_wait_usec);
+  /* The worker's own timings die with it */
+  if (result->lock_wait_usec > 0)
+    glvm_timings_add ("vg_lock_wait", result->lock_wait_usec);
+  if (!success)
+    {
+      g_set_error_literal (&result->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           message);
+      g_clear_pointer (&result->result, g_variant_unref);
+    }
+
+ out:
+  if (reply)
+    g_variant_unref (reply);
+  if (slot->buf)
+    g_byte_array_unref (slot->buf);
+  slot->buf = NULL;
+  return result;
+}
+
+/* Split what was read from a worker into status messages and reply
+ * payload.
+ */
+static void
+consume_worker_data (RdWorkerSlot   *slot,
+                     const guint8   *buf,
+                     gsize           len)
+{
+  while (len > 0 && !slot->in_reply)
+    {
+      switch (*buf)
+        {
+        case RD_WORKER_MSG_READY:
+          slot->ready = TRUE;
+          break;
+        case RD_WORKER_MSG_DONE:
+          slot->done = TRUE;
+          break;
+        case RD_WORKER_MSG_REPLY:
+          slot->in_reply = TRUE;
+          break;
+        }
+      buf++;
+      len--;
+    }
+  if (len > 0)
+    g_byte_array_append (slot->buf, buf, len);
+}
+
+/* Kill a worker that has run out of time.  It is reaped as usual once
+ * its reply pipe reports end of file, but nothing waits for it before
+ * then: a worker stuck in the kernel may take a while to die.
+ */
+static void
+expire_worker (RdWorkerSlot   *slot)
+{
+  (void) kill (slot->pid, SIGKILL);
+  slot->killed = TRUE;
+  slot->ready = slot->done = TRUE;
+}
+
+/* Milliseconds until the earliest of @deadline and the running
+ * workers' own deadlines, for poll()
+ */
+static int
+get_poll_timeout (RdWorkerSlot   *slots,
+                  guint           n_slots,
+                  gint64          deadline)
+{
+  gint64 remaining;
+  guint i;
+
+  for (i = 0; worker_timeout >= 0 && i < n_slots; i++)
+    {
+      gint64 slot_deadline = slots[i].start_time + worker_timeout;
+
+      if (slots[i].fd == -1 || slots[i].killed)
+        continue;
+      if (deadline == 0 || slot_deadline < deadline)
+        deadline = slot_deadline;
+    }
+
+  if (deadline == 0)
+    return -1;
+  remaining = deadline - g_get_monotonic_time ();
+  if (remaining <= 0)
+    return 0;
+  return (int) MIN ((remaining + 999) / 1000, G_MAXINT);
+}
+
+static void
+kill_workers (RdWorkerSlot   *slots,
+              guint           n_slots)
+{
+  guint i;
+
+  for (i = 0; i < n_slots; i++)
+    {
+      if (slots[i].fd == -1)
+        continue;
+      (void) kill (slots[i].pid, SIGKILL);
+      (void) close (slots[i].fd);
+      close_control (&slots[i]);
+      (void) waitpid (slots[i].pid, NULL, 0);
+      g_byte_array_unref (slots[i].buf);
+      slots[i].fd = -1;
+    }
+}
+
+/**
+ * rd_run_vg_workers:
+ * @vgnames: VG names, one worker each
+ * @max_workers: Maximum number of concurrently running workers
+ * @func: Invoked in a child process with a fresh lvm handle
+ * @hooks: (allow-none): Barrier callbacks, see below
+ * @out_results: (out): Array of #RdVgWorkerResult, in @vgnames order
+ *
+ * Run @func once per VG, with up to @max_workers running at a time.
+ * A failing worker, or one killed for running longer than allowed by
+ * rd_set_vg_worker_timeout(), is recorded in its #RdVgWorkerResult and
+ * does not affect the others; %FALSE is only returned if the workers could not
+ * be run at all, or @cancellable was triggered.
+ *
+ * If @hooks is given, all workers run at once regardless of
+ * @max_workers.  @hooks->ready is called once every worker has either
+ * called rd_vg_worker_sync() or exited; if it fails, the workers are
+ * aborted.  Otherwise they are released, and @hooks->done is called
+ * once all of them have called rd_vg_worker_notify_done() or exited.
+ * @hooks->done is always called if @hooks->ready succeeded.  If
+ * @hooks->done_timeout_usec is nonzero, workers that have not notified
+ * by then are killed, and @hooks->done is called without waiting for
+ * them to exit; their results carry %G_IO_ERROR_TIMED_OUT.
+ */
+gboolean
+rd_run_vg_workers (GPtrArray              *vgnames,
+                   guint                   max_workers,
+                   RdVgWorkerFunc          func,
+                   const RdVgWorkerHooks  *hooks,
+                   gpointer                user_data,
+                   GPtrArray             **out_results,
+                   GCancellable           *cancellable,
+                   GError                **error)
+{
+  gboolean ret = FALSE;
+  gs_unref_ptrarray GPtrArray *ret_results = NULL;
+  RdWorkerSlot *slots = NULL;
+  struct pollfd *pollfds = NULL;
+  GPollFD cancel_pollfd = { -1, 0, 0 };
+  gboolean released = FALSE;
+  gboolean done_called = FALSE;
+  gint64 done_deadline = 0;
+  guint n_slots;
+  guint next = 0;
+  guint n_running = 0;
+  guint i;
+  GlvmTimer timer;
+
+  /* Time spent in the children is only visible as a whole */
+  GLVM_TRACE_BEGIN (timer, vg_workers, NULL);
+
+  ret_results = g_ptr_array_new_with_free_func ((GDestroyNotify)rd_vg_worker_result_free);
+  g_ptr_array_set_size (ret_results, vgnames->len);
+
+  if (max_workers == 0 || hooks != NULL)
+    max_workers = vgnames->len;
+  n_slots = MIN (max_workers, vgnames->len);
+  slots = g_new0 (RdWorkerSlot, n_slots);
+  for (i = 0; i < n_slots; i++)
+    slots[i].fd = slots[i].control_fd = -1;
+  pollfds = g_new0 (struct pollfd, n_slots + 1);
+
+  if (cancellable)
+    (void) g_cancellable_make_pollfd (cancellable, &cancel_pollfd);
+
+  while (next < vgnames->len || n_running > 0)
+    {
+      guint n_pollfds = 0;
+      int res;
+
+      for (i = 0; i < n_slots && next < vgnames->len; i++)
+        {
+          if (slots[i].fd != -1)
+            continue;
+          if (!start_worker (&slots[i], next, vgnames->pdata[next],
+                             func, user_data, hooks != NULL, error))
+            goto out;
+          next++;
+          n_running++;
+        }
+
+      for (i = 0; i < n_slots; i++)
+        {
+          pollfds[i].fd = slots[i].fd;
+          pollfds[i].events = POLLIN;
+          pollfds[i].revents = 0;
+        }
+      n_pollfds = n_slots;
+      if (cancel_pollfd.fd != -1)
+        {
+          pollfds[n_pollfds].fd = cancel_pollfd.fd;
+          pollfds[n_pollfds].events = POLLIN;
+          pollfds[n_pollfds].revents = 0;
+          n_pollfds++;
+        }
+
+      do
+        res = poll (pollfds, n_pollfds,
+                    get_poll_timeout (slots, n_slots,
+                                      done_called ? 0 : done_deadline));
+      while (res == -1 && errno == EINTR);
+      if (res == -1)
+        {
+          int errsv = errno;
+          g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                               g_strerror (errsv));
+          goto out;
+        }
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      for (i = 0; worker_timeout >= 0 && i < n_slots; i++)
+        {
+          if (slots[i].fd != -1 && !slots[i].killed
+              && g_get_monotonic_time () - slots[i].start_time >= worker_timeout)
+            expire_worker (&slots[i]);
+        }
+
+      for (i = 0; i < n_slots; i++)
+        {
+          guint8 buf[8192];
+          ssize_t bytes_read;
+
+          if (slots[i].fd == -1 || pollfds[i].revents == 0)
+            continue;
+
+          do
+            bytes_read = read (slots[i].fd, buf, sizeof (buf));
+          while (bytes_read == -1 && errno == EINTR);
+
+          if (bytes_read > 0)
+            consume_worker_data (&slots[i], buf, bytes_read);
+          else
+            {
+              guint index = slots[i].index;
+              ret_results->pdata[index] = finish_worker (&slots[i], vgnames->pdata[index]);
+              slots[i].ready = slots[i].done = TRUE;
+              n_running--;
+            }
+        }
+
+      if (hooks == NULL)
+        continue;
+
+      if (released && !done_called && done_deadline > 0
+          && g_get_monotonic_time () >= done_deadline)
+        {
+          for (i = 0; i < n_slots; i++)
+            {
+              if (slots[i].fd != -1 && !slots[i].done)
+                expire_worker (&slots[i]);
+            }
+        }
+
+      if (!released)
+        {
+          gboolean all_ready = TRUE;
+          for (i = 0; i < n_slots; i++)
+            all_ready = all_ready && slots[i].ready;
+          if (!all_ready)
+            continue;
+
+          if (!hooks->ready (user_data, error))
+            {
+              for (i = 0; i < n_slots; i++)
+                close_control (&slots[i]);
+              goto out;
+            }
+          released = TRUE;
+          if (hooks->done_timeout_usec > 0)
+            done_deadline = g_get_monotonic_time () + hooks->done_timeout_usec;
+          for (i = 0; i < n_slots; i++)
+            {
+              if (slots[i].control_fd != -1)
+                (void) write_msg (slots[i].control_fd, RD_WORKER_MSG_GO);
+            }
+        }
+
+      if (released && !done_called)
+        {
+          gboolean all_done = TRUE;
+          for (i = 0; i < n_slots; i++)
+            all_done = all_done && slots[i].done;
+          if (all_done)
+            {
+              hooks->done (user_data);
+              done_called = TRUE;
+            }
+        }
+    }
+
+  ret = TRUE;
+  gs_transfer_out_value (out_results, &ret_results);
+ out:
+  if (slots)
+    kill_workers (slots, n_slots);
+  if (released && !done_called)
+    hooks->done (user_data);
+  if (cancel_pollfd.fd != -1)
+    g_cancellable_release_fd (cancellable);
+  g_free (slots);
+  g_free (pollfds);
+  GLVM_TRACE_END (timer, vg_workers, NULL);
+  return ret;
+}
@@ -22,20 +22,300 @@
 
 #include <gio/gio.h>
 #include "glvm.h"
+#include "rd-names.h"
 
 G_BEGIN_DECLS
 
 typedef struct _RdApp RdApp;
+typedef struct _RdMountTable RdMountTable;
+
+/* One tagged LV, with everything the builtins want to know about it
+ * gathered while its VG was open.  major/minor are -1 when the LV is
+ * not active; mount_path/mount_fs are NULL when it is not mounted;
+ * pool_lv names the thin pool of a thin LV, or the cache pool of a
+ * cached one, and is NULL otherwise; thin is set only for thin LVs,
+ * whose snapshots are thin too.  sets names the rollback sets the LV
+ * is in, through its own tags or its VG's.
+ */
+typedef struct {
+  char     *vgname;
+  char     *lvname;
+  char     *path;
+  gint      major;
+  gint      minor;
+  guint64   size;
+  char     *pool_lv;
+  gboolean  thin;
+  char    **tags;
+  char     *mount_path;
+  char     *mount_fs;
+  char    **sets;
+} RdLvRecord;
+
+void           rd_lv_record_free (RdLvRecord *rec);
+gboolean       rd_lv_attr_is_thin (const char *lv_attr);
+gboolean       rd_lv_is_selectable (lv_t lv);
+
+typedef gboolean (*RdLvRecordFunc) (RdLvRecord   *rec,
+                                    gpointer      user_data,
+                                    GError      **error);
+
+gboolean       rd_parse_age (const char  *str,
+                             gint64      *out_secs);
+
+/* Retention is configured with tags on an origin LV, or on its VG for
+ * all of its LVs; the LV's own tags win.
+ */
+#define RD_KEEP_TAG     "rollback_keep="
+#define RD_MAX_AGE_TAG  "rollback_max_age="
+
+/* -1 in either field means no limit */
+typedef struct {
+  gint64  keep;
+  gint64  max_age;
+} RdRetentionPolicy;
+
+typedef struct {
+  char     *name;
+  gint64    timestamp;
+  guint     serial;
+  guint64   cow_size;   /* 0 for thin snapshots */
+} RdSnapshotInfo;
+
+void     rd_snapshot_info_free (RdSnapshotInfo *snap);
+char    *rd_vg_new_snapshot_name (vg_t         vg,
+                                  const char  *lvname,
+                                  gint64       timestamp);
+gboolean rd_vg_list_snapshots (vg_t                 vg,
+                               const char *const   *origins,
+                               GHashTable         **out_snaps_by_origin,
+                               GError             **error);
+gboolean rd_retention_policy_update (RdRetentionPolicy  *policy,
+                                     const char         *tag,
+                                     GError            **error);
+gboolean rd_retention_policy_update_from_vg (RdRetentionPolicy  *policy,
+                                             vg_t                vg,
+                                             GError            **error);
+gboolean rd_retention_is_expired (const RdRetentionPolicy  *policy,
+                                  guint                     rank,
+                                  gint64                    age);
+
+/* A plan holds, per VG, the metadata sequence number it was computed
+ * against and its operations in the order they are applied: kind, LV,
+ * argument and size.  The argument is the tag for "tag" and "untag",
+ * the new snapshot's name for "snapshot", and the origin for "remove"
+ * and "merge", whose LV is the snapshot.  The size is that of a new
+ * snapshot (0 for thin) or of a removed one's COW space.
+ */
+#define RD_PLAN_VERSION 1
+#define RD_PLAN_OP_TYPE "(ssst)"
+#define RD_PLAN_VG_TYPE "(sta" RD_PLAN_OP_TYPE ")"
+/* Version, creation time and VGs */
+#define RD_PLAN_TYPE "(uxa" RD_PLAN_VG_TYPE ")"
+
+#define RD_PLAN_OP_TAG       "tag"
+#define RD_PLAN_OP_UNTAG     "untag"
+#define RD_PLAN_OP_SNAPSHOT  "snapshot"
+#define RD_PLAN_OP_REMOVE    "remove"
+#define RD_PLAN_OP_MERGE     "merge"
+
+typedef struct {
+  guint    n_ops;
+  guint    n_commits;
+  guint    n_locks;
+  gint64   space;       /* Bytes allocated, or freed if negative */
+} RdPlanCost;
+
+gboolean  rd_plan_save (GVariant     *plan,
+                        const char   *path,
+                        GError      **error);
+GVariant *rd_plan_load (const char   *path,
+                        GError      **error);
+void      rd_plan_add_vg_cost (GVariant     *vg_plan,
+                               RdPlanCost   *cost);
+void      rd_plan_print (GVariant *plan);
 
 lvm_t          rd_app_get_lvmh (RdApp *app);
-GHashTable    *rd_app_get_mounts (RdApp *app);
+RdMountTable  *rd_app_get_mounts (RdApp *app);
+GPtrArray     *rd_app_get_inventory (RdApp         *app,
+                                     GCancellable  *cancellable,
+                                     GError       **error);
+gboolean       rd_app_foreach_lv (RdApp           *app,
+                                  RdLvRecordFunc   func,
+                                  gpointer         user_data,
+                                  GCancellable    *cancellable,
+                                  GError         **error);
 GOptionGroup  *rd_app_get_options (RdApp *app);
+void           rd_app_set_scan_scope (RdApp              *app,
+                                      const char *const  *vgnames);
+void           rd_app_remember_vgs (RdApp              *app,
+                                    const char *const  *vgnames,
+                                    gboolean            replace);
+
+/* Default bound on waiting for a VG lock held by another command */
+#define RD_DEFAULT_LOCK_TIMEOUT_SECS 60
+
+void     rd_scan_set_pvs (const char *const *pvs);
+void     rd_scan_set_readonly (gboolean readonly);
+gboolean rd_scan_is_scoped (void);
+char    *rd_scan_get_config (void);
+char    *rd_lvm_get_config (void);
+lvm_t    rd_lvm_open (GError **error);
+gboolean rd_scan_lookup_pvs (const char *const  *vgnames,
+                             char             ***out_pvs);
+gboolean rd_scan_remember_vgs (lvm_t               lvmh,
+                               const char *const  *vgnames,
+                               gboolean            replace,
+                               GError            **error);
+
+RdMountTable *rd_mount_table_new_from_file (const char    *path,
+                                            GError       **error);
+void          rd_mount_table_free (RdMountTable  *table);
+gboolean      rd_mount_table_lookup (RdMountTable  *table,
+                                     dev_t          dev,
+                                     const char   **out_path,
+                                     const char   **out_fstype);
+
+/* Cumulative write counters of a block device, from its sysfs stat */
+typedef struct {
+  guint64   write_ios;
+  guint64   write_sectors;
+} RdBlockStat;
+
+gboolean rd_block_stat_read (gint           major,
+                             gint           minor,
+                             RdBlockStat   *out_stat,
+                             GError       **error);
+
+/* lvcreate's default snapshot chunk size, and the only one lvm2app
+ * can create
+ */
+#define RD_COW_DEFAULT_CHUNK_SIZE (4 * 1024)
+
+void     rd_cow_estimate (guint64             origin_size,
+                          const RdBlockStat  *before,
+                          const RdBlockStat  *after,
+                          gint64              window_usec,
+                          gint64              retention_secs,
+                          guint64            *out_cow_size,
+                          guint32            *out_chunk_size);
+
+typedef enum {
+  RD_INVENTORY_BACKEND_REPORT,
+  RD_INVENTORY_BACKEND_LVM2APP
+} RdInventoryBackend;
+
+void               rd_inventory_set_backend (RdInventoryBackend backend);
+RdInventoryBackend rd_inventory_get_backend (void);
+
+#define RD_INVENTORY_DEFAULT_SCAN_JOBS 4
+
+void               rd_inventory_set_scan_jobs (guint n_jobs);
+
+#define RD_INVENTORY_CACHE_PATH "/run/roller-derby/inventory"
+
+void               rd_inventory_set_cache_path (const char *path);
+
+typedef struct _RdInventoryCache RdInventoryCache;
+
+/* Per VG: name, size, whether thin, pool LV, tags and rollback sets
+ * of each LV in any set
+ */
+#define RD_INVENTORY_CACHE_LVS_TYPE "a(stbmsasas)"
+
+RdInventoryCache *rd_inventory_cache_new (const char *path);
+void              rd_inventory_cache_free (RdInventoryCache *cache);
+GVariant         *rd_inventory_cache_lookup (RdInventoryCache  *cache,
+                                             const char        *vg_uuid,
+                                             guint64            seqno);
+void              rd_inventory_cache_update (RdInventoryCache  *cache,
+                                             const char        *vg_uuid,
+                                             guint64            seqno,
+                                             GVariant          *lvs);
+gboolean          rd_inventory_cache_save (RdInventoryCache  *cache,
+                                           gboolean           keep_unseen,
+                                           GError           **error);
+
+gboolean rd_inventory_scan (lvm_t              lvmh,
+                            RdMountTable      *mountcache,
+                            GPtrArray        **out_records,
+                            GCancellable      *cancellable,
+                            GError           **error);
+
+gboolean rd_inventory_foreach (lvm_t              lvmh,
+                               RdMountTable      *mountcache,
+                               RdLvRecordFunc     func,
+                               gpointer           user_data,
+                               GCancellable      *cancellable,
+                               GError           **error);
+
+void rd_inventory_group_by_vg (GPtrArray     *records,
+                               GHashTable   **out_lvs_by_vg,
+                               GPtrArray    **out_vgnames);
+
+gboolean rd_sets_select (const char *const  *sets,
+                         GError            **error);
+gboolean rd_sets_is_selected (char **sets);
+char   **rd_sets_get_tags (void);
+char   **rd_sets_from_tags (const char *const *vg_tags,
+                            const char *const *lv_tags);
+gboolean rd_sets_tag_list_has_set (struct dm_list *tags);
+
+void rd_json_append_string (GString     *buf,
+                            const char  *str);
+
+char   **rd_lvpaths_get_vgnames (int      n_paths,
+                                char   **paths);
+
+gboolean rd_tag_lvs (lvm_t              lvmh,
+                     int                n_paths,
+                     char             **paths,
+                     gboolean           do_tag,
+                     GCancellable      *cancellable,
+                     GError           **error);
+
+
+typedef struct _RdVgWorker RdVgWorker;
+
+typedef gboolean (*RdVgWorkerFunc) (RdVgWorker        *worker,
+                                    lvm_t              lvmh,
+                                    const char        *vgname,
+                                    gpointer           user_data,
+                                    GVariant         **out_result,
+                                    GCancellable      *cancellable,
+                                    GError           **error);
+
+typedef struct {
+  char      *vgname;
+  GVariant  *result;
+  GError    *error;
+  gint64     elapsed_usec;
+  gint64     lock_wait_usec;
+} RdVgWorkerResult;
+
+typedef struct {
+  gboolean (*ready) (gpointer user_data, GError **error);
+  void     (*done)  (gpointer user_data);
+  gint64     done_timeout_usec;
+} RdVgWorkerHooks;
+
+/* Default bound on a single per-VG worker's run time */
+#define RD_DEFAULT_WORKER_TIMEOUT_SECS 600
+
+void     rd_set_vg_worker_timeout (gint64 timeout_usec);
+void     rd_vg_worker_result_free (RdVgWorkerResult *result);
 
-gboolean rd_tag_one_lv (lvm_t              lvmh,
-                        const char        *path,
-                        gboolean           do_tag,
-                        GCancellable      *cancellable,
-                        GError           **error);
+gboolean rd_vg_worker_sync (RdVgWorker        *worker,
+                            GError           **error);
+void     rd_vg_worker_notify_done (RdVgWorker *worker);
 
+gboolean rd_run_vg_workers (GPtrArray              *vgnames,
+                            guint                   max_workers,
+                            RdVgWorkerFunc          func,
+                            const RdVgWorkerHooks  *hooks,
+                            gpointer                user_data,
+                            GPtrArray             **out_results,
+                            GCancellable           *cancellable,
+                            GError                **error);
 
 G_END_DECLS